@@ -12,20 +12,67 @@ using std::numeric_limits;
 using std::max;
 using std::min;
 
+namespace {
+
+distance_t dist_to_segment(point p, point line_start, point line_end)
+{
+    vec v = line_end - line_start, w = p - line_start;
+    distance_t length_sqr = sqr(v.x) + sqr(v.y);
+    distance_t t = length_sqr > 0 ? std::clamp((w.x * v.x + w.y * v.y) / length_sqr, 0.0, 1.0) : 0;
+    return dist(p, point(line_start.x + t * v.x, line_start.y + t * v.y));
+}
+
+// Critical values where a passage of the free space opens: distance of a vertex of one curve from a segment of the other
+void get_critical_values(const curve& a, const curve& b, distance_t lower, distance_t upper, vector<distance_t>& critical)
+{
+    for (size_t i = 0; i < a.size(); ++i) {
+        for (size_t j = 0; j + 1 < b.size(); ++j) {
+            distance_t d = dist_to_segment(a[i], b[j], b[j + 1]);
+            if (lower < d && d < upper) critical.push_back(d);
+        }
+    }
+}
+
+} // namespace
+
 distance_t get_frechet_distance(const curve& a, const curve& b)
 {
-    distance_t min_coordinate = a[0].x, max_coordinate = a[0].x;
-    for (const curve& c: {a, b}) {
-        for (const point& p: c) {
-            min_coordinate = min(min_coordinate, min(p.x, p.y));
-            max_coordinate = max(max_coordinate, max(p.x, p.y));
+    distance_t lower = max(dist(a.front(), b.front()), dist(a.back(), b.back()));
+    return get_frechet_distance(a, b, lower, max(lower, get_frechet_distance_upper_bound(a, b)));
+}
+
+distance_t get_frechet_distance_within(const curve& a, const curve& b, distance_t d)
+{
+    distance_t lower = max(dist(a.front(), b.front()), dist(a.back(), b.back()));
+    return get_frechet_distance(a, b, lower, max(lower, min(d, get_frechet_distance_upper_bound(a, b))));
+}
+
+distance_t get_frechet_distance(const curve& a, const curve& b, distance_t lower, distance_t upper)
+{
+    // Parametric search over the critical values within the bracket: the decision procedure
+    // is evaluated at medians (selected in linear time), O(log(critical values)) times
+    vector<distance_t> critical;
+    get_critical_values(a, b, lower, upper, critical);
+    get_critical_values(b, a, lower, upper, critical);
+
+    distance_t min_d = lower, max_d = upper;
+    auto first = critical.begin(), last = critical.end();
+    while (first != last) {
+        auto mid = first + (last - first) / 2;
+        std::nth_element(first, mid, last);
+        if (is_frechet_distance_at_most(a, b, *mid)) {
+            max_d = *mid;
+            last = mid;
+        } else {
+            min_d = *mid;
+            first = mid + 1;
         }
     }
 
-    distance_t min_d = 0, max_d = (max_coordinate - min_coordinate) * 3 + 1;
-    int cnt = 0;
+    // The distance is usually the critical value found; otherwise (two vertices of a curve equidistant
+    // from a point of a segment of the other) bisect the interval left between consecutive critical values
+    if (min_d + epsilon < max_d && !is_frechet_distance_at_most(a, b, max_d - epsilon)) min_d = max_d - epsilon;
     while (min_d + epsilon < max_d) {
-        ++cnt;
         distance_t m = (min_d + max_d) / 2;
         if (is_frechet_distance_at_most(a, b, m)) max_d = m;
         else min_d = m;
@@ -14,10 +14,25 @@ bool is_frechet_distance_at_most(const curve& a, const curve& b, distance_t d);
 
 /*
  * Returns the frechet distance between a and b, accurate to +/- epsilon.
- * O(log(possible results) * a.size() * b.size())
+ * The search is bracketed by the endpoint distance and get_frechet_distance_upper_bound.
  */
 distance_t get_frechet_distance(const curve& a, const curve& b);
 
+/*
+ * Returns the frechet distance between a and b, accurate to +/- epsilon, when it is known to lie in [lower, upper]
+ * (e.g. the endpoint distance and get_frechet_distance_upper_bound).
+ * Parametric search over the critical values (vertex-segment distances) within the bracket, then bisection
+ * only if the distance lies strictly between two of them.
+ * O(log(a.size() * b.size())) decisions of O(a.size() * b.size()) in the common case
+ */
+distance_t get_frechet_distance(const curve& a, const curve& b, distance_t lower, distance_t upper);
+
+/*
+ * Returns the frechet distance between a and b, accurate to +/- epsilon, when it is known to be at most d
+ * (e.g. a pair that passed the similarity test at threshold d): the bracket is capped at d.
+ */
+distance_t get_frechet_distance_within(const curve& a, const curve& b, distance_t d);
+
 /*
  * Calculates an upper bound for the frechet distance of a and b by guessing a matching between a and b
  * O(a.size() + b.size())
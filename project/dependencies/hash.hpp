@@ -2,6 +2,8 @@
 #define _HASH_HPP
 
 #include <vector>
+#include <queue>
+#include <algorithm>
 #include <cmath>
 #include "rand.h"
 #include "geometry_basics.hpp"
@@ -88,6 +90,94 @@ struct FrechetLSH {
 		}
 		return res + (sum >> 32);
 	}
+
+	// Hash of a sequence of grid cells: a cell is counted once per visit (as in hash)
+	uint64_t hash_cells(const std::vector<int32_t> &xs, const std::vector<int32_t> &ys, int32_t z){
+		int n = xs.size();
+		
+		int32_t last_x = std::numeric_limits<int32_t>::max();
+		int32_t last_y = std::numeric_limits<int32_t>::max();
+		int32_t last_z = std::numeric_limits<int32_t>::max();
+		
+		long res = m_id << 32;
+		uint64_t sum = 0;
+		
+		Splitmix64 seeder(m_seed);
+		Xorshift1024star rnd(seeder.next());
+		
+		for (int i = 0; i < n; ++i) {
+			if (xs[i] != last_x || ys[i] != last_y || z != last_z) {
+				last_x = xs[i];
+				last_y = ys[i];
+				last_z = z;
+				sum += xs[i]*rnd.next() + ys[i]*rnd.next() + z*rnd.next();
+			}
+		}
+		return res + (sum >> 32);
+	}
+
+	// Multi-probe: the primary hash of a curve followed by (up to) num_probes distinct hashes of the
+	// perturbed cell sequences most likely to be shared by a similar curve. A perturbation moves some
+	// points to the neighbouring cell across their nearest boundary; sets of moves are scored by the sum
+	// of the squared distances (in cells) of the points to those boundaries and generated in increasing
+	// score order (shift/expand on a heap, as in query-directed multi-probe LSH).
+	std::vector<uint64_t> probes(const curve &input_curve, size_t num_probes){
+		int n = input_curve.size();
+		std::vector<int32_t> xs(n), ys(n);
+		int32_t z = std::lround((m_origins[2]) / m_grid_delta);
+
+		// Cells of the points and the move of each coordinate across its nearest boundary
+		struct move_t { double score; int point; int dim; int32_t step; };
+		std::vector<move_t> moves;
+		for (int i = 0; i < n; ++i) {
+			double cx = (input_curve[i].x + m_origins[0]) / m_grid_delta;
+			double cy = (input_curve[i].y + m_origins[1]) / m_grid_delta;
+			xs[i] = std::lround(cx);
+			ys[i] = std::lround(cy);
+			double fx = cx - xs[i], fy = cy - ys[i];
+			moves.push_back({(0.5 - std::abs(fx)) * (0.5 - std::abs(fx)), i, 0, fx >= 0 ? 1 : -1});
+			moves.push_back({(0.5 - std::abs(fy)) * (0.5 - std::abs(fy)), i, 1, fy >= 0 ? 1 : -1});
+		}
+
+		std::vector<uint64_t> res(1, hash_cells(xs, ys, z));
+		if (num_probes == 0 || moves.empty())
+			return res;
+
+		// Perturbations equal to the primary cell sequence (e.g. a point next to a crossing) are skipped,
+		// so some more moves than probes are ranked
+		size_t num_moves = std::min(moves.size(), 4 * num_probes);
+		std::partial_sort(moves.begin(), moves.begin() + num_moves, moves.end(),
+			[](const move_t &a, const move_t &b) { return a.score < b.score; });
+
+		typedef std::pair<double, std::vector<uint32_t>> set_t;
+		auto greater = [](const set_t &a, const set_t &b) { return a.first > b.first; };
+		std::priority_queue<set_t, std::vector<set_t>, decltype(greater)> sets(greater);
+		sets.push({moves[0].score, {0}});
+		for (size_t pops = 0; !sets.empty() && res.size() <= num_probes && pops < 8 * num_probes; ++pops) {
+			set_t set = sets.top();
+			sets.pop();
+
+			// Hash of the perturbed cells
+			std::vector<int32_t> px(xs), py(ys);
+			for (uint32_t m : set.second)
+				(moves[m].dim == 0 ? px : py)[moves[m].point] += moves[m].step;
+			uint64_t h = hash_cells(px, py, z);
+			if (std::find(res.begin(), res.end(), h) == res.end())
+				res.push_back(h);
+
+			// Shift (replace the last move with the next one) and expand (add the next move)
+			uint32_t last = set.second.back();
+			if (last + 1 < num_moves) {
+				set_t expand(set.first + moves[last + 1].score, set.second);
+				expand.second.push_back(last + 1);
+				set.first += moves[last + 1].score - moves[last].score;
+				set.second.back() = last + 1;
+				sets.push(std::move(set));
+				sets.push(std::move(expand));
+			}
+		}
+		return res;
+	}
 };
 
 
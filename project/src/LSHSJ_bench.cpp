@@ -0,0 +1,330 @@
+/**
+* @author   Irene Pisani
+* @note     University of Pisa, Computer Science department.
+*           M.Sc. Computer Science, Artificial Intelligence
+*           Parallel and Distributed Systems: Paradigms and models (23/24).
+*
+* @brief    Project track 3: Locality Sensitive Hashing based Similarity Join (LSHSJ)
+* @details  Microbenchmarks of the hot kernels: parseLine, FrechetLSH::hash, equalTime,
+*           get_frechet_distance_upper_bound, negfilter, is_frechet_distance_at_most and intersection_interval.
+*           Kernels on pairs run on the candidate pairs of a dataset (trajectories sharing a bucket of the first
+*           LSH function), as in the join. Results are CSV rows (ns/op mean, standard deviation and min over the
+*           repetitions, ops/s); with a baseline (a previous output), each row is compared with it and the run
+*           fails if a kernel got slower than the tolerance.
+*/
+
+#include <iostream>
+#include <fstream>
+#include <ostream>
+#include <sstream>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <getopt.h>
+
+#include "hash.hpp"
+#include "geometry_basics.hpp"
+#include "frechet_distance.hpp"
+
+using namespace std;
+
+#define LSH_SEED 234           // Seed for LSH function
+#define LSH_RESOLUTION 80      // Resolution for LSH function
+
+// Similarity threshold of the datasets without one
+const static double SIM_THRESHOLD = 10;
+
+// Max num of candidate pairs of a dataset
+#define BENCH_MAX_PAIRS 4096
+
+/**
+ * @brief Structure to represent an item in the dataset.
+ */
+struct item {
+    size_t id;         // Unique identifier
+    int dataset;       // Dataset identifier
+    curve content;     // Curve representing the trajectory
+};
+
+/**
+ * @brief Structure to represent the timings of a kernel.
+ */
+struct bench_t {
+    string dataset;
+    string kernel;
+    size_t ops = 0;            // Ops of a repetition
+    size_t reps = 0;           // Repetitions
+    double mean = 0;           // ns/op
+    double stddev = 0;         // ns/op
+    double best = 0;           // ns/op
+};
+
+/**
+ * @brief Parses a line of data into an item object.
+ *
+ * @param line The input line as a string
+ * @return item The parsed item containing id, dataset, and trajectory
+ */
+item parseLine(string& line) {
+    istringstream ss(line);
+    item output;
+    ss >> output.id;
+    ss >> output.dataset;
+    string tmp;
+    ss >> tmp;
+
+    // Parse trajectory
+    if (!(tmp.find_first_of("[") == string::npos)) {
+        tmp.replace(0, 1, "");
+        tmp.replace(tmp.length() - 1, tmp.length(), "");
+        bool ext = false;
+        while (!ext) {
+            string extrait = tmp.substr(tmp.find("["), tmp.find("]") + 1);
+            string extrait1 = extrait.substr(1, extrait.find(",") - 1);
+            string extrait2 = extrait.substr(extrait.find(",") + 1);
+            extrait2 = extrait2.substr(0, extrait2.length() - 1);
+            double e1 = stod(extrait1);
+            double e2 = stod(extrait2);
+            output.content.push_back(move(point(e1, e2)));
+            ext = (tmp.length() == extrait.length());
+            if (!ext)
+                tmp = tmp.substr(tmp.find_first_of("]") + 2, tmp.length());
+        }
+    }
+    return output;
+}
+
+/**
+ * @brief Times a kernel: one warm-up pass, then reps passes over its inputs.
+ * @param dataset Name of the dataset
+ * @param kernel Name of the kernel
+ * @param ops Ops of a pass
+ * @param reps Num of timed passes
+ * @param pass A pass over the inputs, returning a value depending on every op
+ * @return bench_t The timings
+ */
+template<typename Pass>
+bench_t measure(const string& dataset, const string& kernel, size_t ops, size_t reps, Pass pass) {
+    [[maybe_unused]] static volatile double sink;   // Keeps the passes from being optimised away
+    bench_t b{dataset, kernel, ops, reps};
+    if (!ops) return b;
+    sink = pass();
+    vector<double> times;
+    for (size_t r = 0; r < reps; ++r) {
+        auto start = chrono::steady_clock::now();
+        sink = pass();
+        times.push_back(chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / ops);
+    }
+    for (double t : times) b.mean += t / reps;
+    for (double t : times) b.stddev += (t - b.mean) * (t - b.mean) / reps;
+    b.stddev = sqrt(b.stddev);
+    b.best = *min_element(times.begin(), times.end());
+    return b;
+}
+
+/**
+ * @brief Runs every kernel on a dataset.
+ * @param spec Dataset as file[:threshold[:resolution]]
+ * @param reps Num of timed passes
+ * @return vector<bench_t> The timings of the kernels
+ */
+vector<bench_t> benchDataset(const string& spec, size_t reps) {
+
+    // Dataset, threshold and resolution
+    string filename = spec;
+    double threshold = SIM_THRESHOLD, resolution = LSH_RESOLUTION;
+    size_t colon = spec.find(':');
+    if (colon != string::npos) {
+        filename = spec.substr(0, colon);
+        sscanf(spec.c_str() + colon + 1, "%lf:%lf", &threshold, &resolution);
+    }
+    const double threshold_sqr = sqr(threshold);
+
+    ifstream file(filename);
+    if (!file.is_open()) {
+        cerr << "Error opening dataset file " << filename << "!" << endl;
+        exit(EXIT_FAILURE);
+    }
+    vector<string> lines;
+    vector<item> items;
+    string line;
+    while (getline(file, line)) {
+        if (line.empty()) continue;
+        lines.push_back(line);
+        items.push_back(parseLine(line));
+        if (!items.back().content.size()) {
+            items.pop_back();
+            lines.pop_back();
+        }
+    }
+
+    // Candidate pairs: trajectories sharing a bucket of the first LSH function (adjacent ones if too few)
+    FrechetLSH lsh;
+    lsh.init(resolution, 0, 0);
+    map<uint64_t, vector<uint32_t>> buckets;
+    for (uint32_t i = 0; i < items.size(); ++i)
+        buckets[lsh.hash(items[i].content)].push_back(i);
+    vector<pair<uint32_t, uint32_t>> pairs;
+    for (auto& [key, members] : buckets)
+        for (size_t a = 0; a < members.size() && pairs.size() < BENCH_MAX_PAIRS; ++a)
+            for (size_t b = a + 1; b < members.size() && pairs.size() < BENCH_MAX_PAIRS; ++b)
+                pairs.push_back({members[a], members[b]});
+    for (uint32_t i = 0; i + 1 < items.size() && pairs.size() < BENCH_MAX_PAIRS / 4; ++i)
+        pairs.push_back({i, i + 1});
+
+    // Point of a curve against the segment of the other one at the same position
+    size_t segments = 0;
+    for (auto& [a, b] : pairs)
+        segments += (items[b].content.size() > 1) ? items[a].content.size() : 0;
+
+    vector<bench_t> results;
+    results.push_back(measure(filename, "parseLine", lines.size(), reps, [&] {
+        double acc = 0;
+        for (const string& l : lines) {
+            string copy(l);
+            acc += parseLine(copy).content.size();
+        }
+        return acc;
+    }));
+    results.push_back(measure(filename, "FrechetLSH::hash", items.size(), reps, [&] {
+        double acc = 0;
+        for (const item& it : items)
+            acc += lsh.hash(it.content);
+        return acc;
+    }));
+    results.push_back(measure(filename, "equalTime", pairs.size(), reps, [&] {
+        double acc = 0;
+        for (auto& [a, b] : pairs)
+            acc += equalTime(items[a].content, items[b].content, threshold_sqr);
+        return acc;
+    }));
+    results.push_back(measure(filename, "get_frechet_distance_upper_bound", pairs.size(), reps, [&] {
+        double acc = 0;
+        for (auto& [a, b] : pairs)
+            acc += get_frechet_distance_upper_bound(items[a].content, items[b].content);
+        return acc;
+    }));
+    results.push_back(measure(filename, "negfilter", pairs.size(), reps, [&] {
+        double acc = 0;
+        for (auto& [a, b] : pairs)
+            acc += negfilter(items[a].content, items[b].content, threshold);
+        return acc;
+    }));
+    results.push_back(measure(filename, "is_frechet_distance_at_most", pairs.size(), reps, [&] {
+        double acc = 0;
+        for (auto& [a, b] : pairs)
+            acc += is_frechet_distance_at_most(items[a].content, items[b].content, threshold);
+        return acc;
+    }));
+    results.push_back(measure(filename, "intersection_interval", segments, reps, [&] {
+        double acc = 0;
+        for (auto& [a, b] : pairs) {
+            const curve& ca = items[a].content;
+            const curve& cb = items[b].content;
+            if (cb.size() < 2) continue;
+            for (size_t i = 0; i < ca.size(); ++i) {
+                size_t j = min(i, cb.size() - 2);
+                interval in = intersection_interval(ca[i], threshold, cb[j], cb[j + 1]);
+                acc += is_empty_interval(in) ? 0 : in.second - in.first;
+            }
+        }
+        return acc;
+    }));
+    return results;
+}
+
+/**
+* @brief Main function: runs the microbenchmarks and compares them with a baseline.
+* @param argc Argument count
+* @param argv Argument values (options and datasets)
+* @return int Exit status (failure if a kernel regressed)
+*/
+int main(int argc, char** argv) {
+
+    // Usage description
+    auto usage_and_exit = [argv]() {
+        printf("   use: %s [-r repetitions] [-b baselineFile] [-t tolerance] [-o outputFile] dataset[:threshold[:resolution]] ...\n", argv[0]);
+        printf("   -r repetitions  -> timed passes of each kernel (default: 10) \n");
+        printf("   -b baselineFile -> compare with a previous output (same datasets) \n");
+        printf("   -t tolerance    -> slowdown of the min ns/op over the baseline reported as a regression (default: 0.1) \n");
+        printf("   -o outputFile   -> also write the results (e.g. to store a baseline) \n");
+        printf("   threshold and resolution default to %g and %d (e.g. taxi1:0.08:0.01) \n\n", SIM_THRESHOLD, LSH_RESOLUTION);
+        exit(EXIT_FAILURE);
+    };
+
+    // Optional arguments
+    size_t reps = 10;
+    double tolerance = 0.1;
+    const char* baselineFilename = nullptr;
+    const char* outFilename = nullptr;
+    int opt;
+    while ((opt = getopt(argc, argv, "r:b:t:o:")) != -1) {
+        if (opt == 'r') reps = max(1ul, stoul(optarg));
+        else if (opt == 'b') baselineFilename = optarg;
+        else if (opt == 't') tolerance = stod(optarg);
+        else if (opt == 'o') outFilename = optarg;
+        else usage_and_exit();
+    }
+    if (argc - optind < 1) usage_and_exit();
+
+    // Baseline: min ns/op of each (dataset, kernel)
+    map<pair<string, string>, double> baseline;
+    if (baselineFilename) {
+        ifstream in(baselineFilename);
+        if (!in.is_open()) {
+            cerr << "Error opening baseline file!" << endl;
+            return EXIT_FAILURE;
+        }
+        string line;
+        getline(in, line);
+        while (getline(in, line)) {
+            vector<string> fields;
+            stringstream ss(line);
+            string field;
+            while (getline(ss, field, ',')) fields.push_back(field);
+            if (fields.size() >= 7)
+                baseline[{fields[0], fields[1]}] = stod(fields[6]);
+        }
+    }
+
+    vector<bench_t> results;
+    for (int i = optind; i < argc; ++i) {
+        vector<bench_t> r = benchDataset(argv[i], reps);
+        results.insert(results.end(), r.begin(), r.end());
+    }
+
+    // Collect results (CSV: dataset, kernel, ops per repetition, repetitions, ns/op mean, standard deviation and min,
+    // ops/s and, with a baseline, the baseline min ns/op, the ratio and the status)
+    ostringstream csv;
+    csv << "dataset,kernel,ops,reps,ns_per_op,ns_per_op_stddev,ns_per_op_min,ops_per_s";
+    if (baselineFilename) csv << ",baseline_ns_per_op_min,ratio,status";
+    csv << "\n";
+    size_t regressions = 0;
+    for (const bench_t& b : results) {
+        csv << b.dataset << "," << b.kernel << "," << b.ops << "," << b.reps << "," << b.mean << "," << b.stddev << ","
+            << b.best << "," << (b.best > 0 ? 1e9 / b.best : 0);
+        if (baselineFilename) {
+            auto base = baseline.find({b.dataset, b.kernel});
+            if (base == baseline.end() || base->second <= 0) csv << ",,,new";
+            else {
+                double ratio = b.best / base->second;
+                bool regressed = ratio > 1 + tolerance;
+                regressions += regressed;
+                csv << "," << base->second << "," << ratio << "," << (regressed ? "regression" : "ok");
+            }
+        }
+        csv << "\n";
+    }
+    cout << csv.str();
+    if (outFilename) {
+        ofstream out(outFilename);
+        out << csv.str();
+    }
+    if (regressions)
+        cerr << regressions << " kernel(s) slower than the baseline by more than " << tolerance * 100 << "%" << endl;
+
+    return regressions ? EXIT_FAILURE : 0;
+}
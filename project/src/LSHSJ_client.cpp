@@ -0,0 +1,253 @@
+/**
+* @author   Irene Pisani
+* @note     University of Pisa, Computer Science department.
+*           M.Sc. Computer Science, Artificial Intelligence
+*           Parallel and Distributed Systems: Paradigms and models (23/24).
+*
+* @brief    Project track 3: Locality Sensitive Hashing based Similarity Join (LSHSJ)
+* @details  Closed-loop load generator of the local query service (LSHSJ_server):
+*           every connection sends a batch of queries, waits for its answer and sends the next one.
+*           Throughput and batch latency percentiles are measured on the client side.
+*/
+
+#include <iostream>
+#include <fstream>
+#include <ostream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <getopt.h>
+
+#include "geometry_basics.hpp"
+
+// Query protocol
+#include "query_protocol.hpp"
+
+using namespace std;
+
+/**
+ * @brief Structure to represent an item in the dataset.
+ */
+struct item {
+    size_t id;         // Unique identifier
+    int dataset;       // Dataset identifier
+    curve content;     // Curve representing the trajectory
+};
+
+/**
+ * @brief Parses a line of data into an item object.
+ *
+ * @param line The input line as a string
+ * @return item The parsed item containing id, dataset, and trajectory
+ */
+item parseLine(string& line) {
+    istringstream ss(line);
+    item output;
+    ss >> output.id;
+    ss >> output.dataset;
+    string tmp;
+    ss >> tmp;
+
+    // Parse trajectory
+    if (!(tmp.find_first_of("[") == string::npos)) {
+        tmp.replace(0, 1, "");
+        tmp.replace(tmp.length() - 1, tmp.length(), "");
+        bool ext = false;
+        while (!ext) {
+            string extrait = tmp.substr(tmp.find("["), tmp.find("]") + 1);
+            string extrait1 = extrait.substr(1, extrait.find(",") - 1);
+            string extrait2 = extrait.substr(extrait.find(",") + 1);
+            extrait2 = extrait2.substr(0, extrait2.length() - 1);
+            double e1 = stod(extrait1);
+            double e2 = stod(extrait2);
+            output.content.push_back(move(point(e1, e2)));
+            ext = (tmp.length() == extrait.length());
+            if (!ext)
+                tmp = tmp.substr(tmp.find_first_of("]") + 2, tmp.length());
+        }
+    }
+    return output;
+}
+
+/**
+ * @brief A pre-encoded batch of queries.
+ */
+struct batch_t {
+    vector<size_t> ids;     // Ids of the queries
+    vector<char> request;   // Payload of the QUERY_BATCH request
+};
+
+/**
+ * @brief Connects to the service.
+ * @param socketPath Unix socket path
+ * @return int The connected socket (exits on failure)
+ */
+int connectService(const char* socketPath) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr = query::socket_address(socketPath);
+    if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        cerr << "Error connecting to " << socketPath << ": " << strerror(errno) << endl;
+        exit(EXIT_FAILURE);
+    }
+    return fd;
+}
+
+/**
+* @brief Main function: replays the query file against the service.
+* @param argc Argument count
+* @param argv Argument values (options and query file)
+* @return int Exit status
+*/
+int main(int argc, char** argv) {
+
+    // Usage description
+    auto usage_and_exit = [argv]() {
+        printf("   use: %s [-s socket] [-c connections] [-b batch] [-n batches] [-o outputFile] [-S] queryFile\n", argv[0]);
+        printf("   -s socket      -> Unix socket path (default: %s) \n", query::DEFAULT_SOCKET);
+        printf("   -c connections -> concurrent closed-loop connections (default: 1) \n");
+        printf("   -b batch       -> queries per batch (default: 64) \n");
+        printf("   -n batches     -> batches sent per connection (default: one pass over the query file) \n");
+        printf("   -o outputFile  -> write the similar pairs (query id, indexed id) \n");
+        printf("   -S             -> print the server statistics at the end \n\n");
+        exit(EXIT_FAILURE);
+    };
+
+    // Optional arguments
+    const char* socketPath = query::DEFAULT_SOCKET;
+    size_t connections = 1, batchSize = 64, numBatches = 0;
+    const char* outFilename = nullptr;
+    bool serverStats = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:c:b:n:o:S")) != -1) {
+        if (opt == 's') socketPath = optarg;
+        else if (opt == 'c') connections = max(1ul, stoul(optarg));
+        else if (opt == 'b') batchSize = max(1ul, stoul(optarg));
+        else if (opt == 'n') numBatches = stoul(optarg);
+        else if (opt == 'o') outFilename = optarg;
+        else if (opt == 'S') serverStats = true;
+        else usage_and_exit();
+    }
+    if (argc - optind < 1) usage_and_exit();
+
+    // Pre-encode the batches of queries
+    ifstream file(argv[optind]);
+    if (!file.is_open()) {
+        cerr << "Error opening dataset file!" << endl;
+        return EXIT_FAILURE;
+    }
+    vector<item> items;
+    string line;
+    while (getline(file, line)) {
+        if (line.empty()) continue;
+        items.push_back(parseLine(line));
+    }
+    vector<batch_t> batches;
+    for (size_t first = 0; first < items.size(); first += batchSize) {
+        batch_t b;
+        size_t last = min(items.size(), first + batchSize);
+        wire::put_varint(b.request, last - first);
+        for (size_t k = first; k < last; ++k) {
+            b.ids.push_back(items[k].id);
+            wire::put_trajectory(b.request, items[k].id, items[k].dataset, items[k].content, wire::RAW_CODEC);
+        }
+        batches.push_back(move(b));
+    }
+    if (batches.empty()) usage_and_exit();
+
+    // One pass over the query file unless the num of batches is given; pairs are written only then
+    const bool onePass = (numBatches == 0);
+    if (onePass) numBatches = (batches.size() + connections - 1) / connections;
+    ofstream filestream;
+    if (outFilename && onePass)
+        filestream = ofstream(outFilename);
+
+    // Closed loop on each connection
+    mutex m;
+    vector<float> latencies;
+    size_t queries = 0, similar = 0;
+    auto start_time = chrono::steady_clock::now();
+    vector<thread> clients;
+    for (size_t c = 0; c < connections; ++c) {
+        clients.emplace_back([&, c] {
+            int fd = connectService(socketPath);
+            vector<float> myLatencies;
+            size_t myQueries = 0, mySimilar = 0;
+            ostringstream myPairs;
+            uint8_t type;
+            vector<char> response;
+            for (size_t n = 0; n < numBatches; ++n) {
+                // With one pass, connection c sends batches c, c + connections, ...
+                size_t b = onePass ? c + n * connections : (c + n) % batches.size();
+                if (b >= batches.size()) break;
+                auto start = chrono::steady_clock::now();
+                if (!query::send_frame(fd, query::QUERY_BATCH, batches[b].request) || !query::recv_frame(fd, type, response)) {
+                    cerr << "Connection closed by the server!" << endl;
+                    exit(EXIT_FAILURE);
+                }
+                myLatencies.push_back(chrono::duration<float, micro>(chrono::steady_clock::now() - start).count());
+
+                // Decode the matches of each query
+                const char* p = response.data();
+                for (size_t qid : batches[b].ids) {
+                    uint64_t m = wire::get_varint(p);
+                    mySimilar += m;
+                    for (uint64_t k = 0; k < m; ++k) {
+                        uint64_t rid = wire::get_varint(p);
+                        if (filestream.is_open())
+                            myPairs << qid << "\t" << rid << "\n";
+                    }
+                }
+                myQueries += batches[b].ids.size();
+            }
+            close(fd);
+            lock_guard<mutex> lock(m);
+            latencies.insert(latencies.end(), myLatencies.begin(), myLatencies.end());
+            queries += myQueries;
+            similar += mySimilar;
+            if (filestream.is_open())
+                filestream << myPairs.str();
+        });
+    }
+    for (thread& t : clients)
+        t.join();
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start_time).count();
+
+    sort(latencies.begin(), latencies.end());
+    auto percentile = [&latencies](double p) -> double {
+        if (latencies.empty()) return 0;
+        return latencies[min(latencies.size() - 1, static_cast<size_t>(p * latencies.size()))];
+    };
+
+    // Collect results (connections, batch size, queries, similar pairs, time, queries/s, batch latency percentiles in us)
+    cout <<
+        argv[0] << "\t" <<
+        argv[optind] << "\t" <<
+        connections << "\t" <<
+        batchSize << "\t" <<
+        queries << "\t" <<
+        similar << "\t" <<
+        elapsed << "\t" <<
+        (elapsed > 0 ? queries / elapsed : 0) << "\t" <<
+        percentile(0.50) << "\t" <<
+        percentile(0.90) << "\t" <<
+        percentile(0.99) << "\t" <<
+        (latencies.empty() ? 0 : latencies.back()) <<
+    endl;
+
+    // Server side statistics
+    if (serverStats) {
+        int fd = connectService(socketPath);
+        uint8_t type;
+        vector<char> response;
+        if (query::send_frame(fd, query::STATS, {}) && query::recv_frame(fd, type, response))
+            cout << string(response.begin(), response.end());
+        close(fd);
+    }
+
+    return 0;
+}
@@ -0,0 +1,371 @@
+/**
+* @author   Irene Pisani
+* @note     University of Pisa, Computer Science department.
+*           M.Sc. Computer Science, Artificial Intelligence
+*           Parallel and Distributed Systems: Paradigms and models (23/24).
+*
+* @brief    Project track 3: Locality Sensitive Hashing based Similarity Join (LSHSJ)
+* @details  Recall/precision evaluation of an LSH setup against the exact join.
+*           - ground truth: parallel all-pairs join of the trajectories of different datasets, pruned by
+*             a sweep on the first point, the endpoints and the bounding boxes (optionally cached on file);
+*           - LSH join: the given resolution, concatenated functions (r), tables (L) and probes, with the
+*             pair deduplication of checkHelper, reporting recall, candidates, verification work and times.
+*/
+
+#include <iostream>
+#include <fstream>
+#include <ostream>
+#include <sstream>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <cstring>
+#include <getopt.h>
+
+#include "hash.hpp"
+#include "geometry_basics.hpp"
+#include "frechet_distance.hpp"
+
+// Bucket keys of concatenated functions
+#include "lsh_index.hpp"
+
+using namespace std;
+
+#define LSH_FAMILY_SIZE 8      // Number of LSH functions
+#define LSH_SEED 234           // Seed for LSH function
+#define LSH_RESOLUTION 80      // Resolution for LSH function
+
+// Similarity threasholds
+const static double SIM_THRESHOLD = 10;
+const static double SIM_THRESHOLD_SQR = sqr(SIM_THRESHOLD);
+
+atomic<size_t> decisions{0};      // Counter for Frechet decision procedures (verification work)
+
+/**
+ * @brief Structure to represent an item in the dataset.
+ */
+struct item {
+    size_t id;         // Unique identifier
+    int dataset;       // Dataset identifier
+    curve content;     // Curve representing the trajectory
+};
+
+/**
+ * @brief Structure to represent the bounding box of a trajectory.
+ */
+struct box_t {
+    double min_x, min_y, max_x, max_y;
+
+    // True if the box lies within the other one enlarged by d (necessary for a Frechet distance <= d)
+    bool within(const box_t& other, double d) const {
+        return min_x >= other.min_x - d && min_y >= other.min_y - d && max_x <= other.max_x + d && max_y <= other.max_y + d;
+    }
+};
+
+/**
+ * @brief Parses a line of data into an item object.
+ *
+ * @param line The input line as a string
+ * @return item The parsed item containing id, dataset, and trajectory
+ */
+item parseLine(string& line) {
+    istringstream ss(line);
+    item output;
+    ss >> output.id;
+    ss >> output.dataset;
+    string tmp;
+    ss >> tmp;
+
+    // Parse trajectory
+    if (!(tmp.find_first_of("[") == string::npos)) {
+        tmp.replace(0, 1, "");
+        tmp.replace(tmp.length() - 1, tmp.length(), "");
+        bool ext = false;
+        while (!ext) {
+            string extrait = tmp.substr(tmp.find("["), tmp.find("]") + 1);
+            string extrait1 = extrait.substr(1, extrait.find(",") - 1);
+            string extrait2 = extrait.substr(extrait.find(",") + 1);
+            extrait2 = extrait2.substr(0, extrait2.length() - 1);
+            double e1 = stod(extrait1);
+            double e2 = stod(extrait2);
+            output.content.push_back(move(point(e1, e2)));
+            ext = (tmp.length() == extrait.length());
+            if (!ext)
+                tmp = tmp.substr(tmp.find_first_of("]") + 2, tmp.length());
+        }
+    }
+    return output;
+}
+
+/**
+ * @brief Checks if two curves (trajectories) are similar based on various distance metrics.
+ *
+ * @param c1 The first trajectory
+ * @param c2 The second trajectory
+ * @return bool True if the curves are similar, false otherwise
+ */
+bool similarity_test(const curve& c1, const curve& c2) {
+
+    // Check euclidean distance
+    if (euclideanSqr(c1[0], c2[0]) > SIM_THRESHOLD_SQR || euclideanSqr(c1.back(), c2.back()) > SIM_THRESHOLD_SQR)
+        return false;
+
+    // Check equal time
+    if (equalTime(c1, c2, SIM_THRESHOLD_SQR) || get_frechet_distance_upper_bound(c1, c2) <= SIM_THRESHOLD)
+        return true;
+
+    // Check using negative filter
+    if (negfilter(c1, c2, SIM_THRESHOLD))
+        return false;
+
+    // Full check using Frechet distance
+    ++decisions;
+    if (is_frechet_distance_at_most(c1, c2, SIM_THRESHOLD))
+        return true;
+
+    return false;
+}
+
+/**
+ * @brief Computes the exact join: every pair of trajectories from different datasets within SIM_THRESHOLD.
+ * @details Trajectories are swept in order of the x of their first point, so that only the ones with
+ *          a first point closer than SIM_THRESHOLD on x are paired; endpoints and bounding boxes prune
+ *          the pairs before the similarity test. Rows of the sweep are interleaved among the threads.
+ * @param items The trajectories
+ * @param threads Num of threads
+ * @return vector<pair<uint32_t, uint32_t>> The similar pairs (positions in items, sorted)
+ */
+vector<pair<uint32_t, uint32_t>> groundTruth(const vector<item>& items, size_t threads) {
+
+    vector<box_t> boxes(items.size());
+    vector<uint32_t> order(items.size());
+    for (uint32_t i = 0; i < items.size(); ++i) {
+        box_t& b = boxes[i];
+        b = {INFINITY, INFINITY, -INFINITY, -INFINITY};
+        for (const point& p : items[i].content) {
+            b.min_x = min(b.min_x, p.x);
+            b.min_y = min(b.min_y, p.y);
+            b.max_x = max(b.max_x, p.x);
+            b.max_y = max(b.max_y, p.y);
+        }
+        order[i] = i;
+    }
+    sort(order.begin(), order.end(), [&items](uint32_t a, uint32_t b) { return items[a].content[0].x < items[b].content[0].x; });
+
+    vector<vector<pair<uint32_t, uint32_t>>> found(threads);
+    vector<thread> workers;
+    for (size_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            for (size_t i = t; i < order.size(); i += threads) {
+                const item& a = items[order[i]];
+                for (size_t j = i + 1; j < order.size() && items[order[j]].content[0].x - a.content[0].x <= SIM_THRESHOLD; ++j) {
+                    const item& b = items[order[j]];
+                    if (a.dataset == b.dataset)
+                        continue;
+                    if (euclideanSqr(a.content[0], b.content[0]) > SIM_THRESHOLD_SQR || euclideanSqr(a.content.back(), b.content.back()) > SIM_THRESHOLD_SQR)
+                        continue;
+                    if (!boxes[order[i]].within(boxes[order[j]], SIM_THRESHOLD) || !boxes[order[j]].within(boxes[order[i]], SIM_THRESHOLD))
+                        continue;
+                    if (similarity_test(a.content, b.content))
+                        found[t].push_back(minmax(order[i], order[j]));
+                }
+            }
+        });
+    }
+    for (thread& w : workers)
+        w.join();
+
+    vector<pair<uint32_t, uint32_t>> pairs;
+    for (auto& f : found)
+        pairs.insert(pairs.end(), f.begin(), f.end());
+    sort(pairs.begin(), pairs.end());
+    return pairs;
+}
+
+/**
+ * @brief Joins the trajectories of different datasets sharing a bucket (LSH setup under evaluation).
+ * @details Every trajectory is indexed under the primary key of each table, then each one probes its
+ *          keys against the trajectories of the lower datasets; a pair is verified only in the bucket
+ *          of the first table on which the two collide, as checkHelper does in the batch executables.
+ * @param items The trajectories
+ * @param lsh_family The LSH function family (r functions per table)
+ * @param r Num of functions concatenated in each key
+ * @param probes Num of perturbed hashes per function
+ * @param candidates Num of candidate pairs (verified pairs)
+ * @param timeHash Time to hash the trajectories
+ * @return vector<pair<uint32_t, uint32_t>> The similar pairs (positions in items, sorted)
+ */
+vector<pair<uint32_t, uint32_t>> lshJoin(const vector<item>& items, vector<FrechetLSH>& lsh_family, size_t r, size_t probes,
+                                         size_t& candidates, double& timeHash) {
+
+    auto start_time = chrono::steady_clock::now();
+    const size_t tables = lsh_family.size() / r, keysPerTable = 1 + r * probes;
+    vector<vector<int64_t>> keys(items.size());
+    unordered_map<int64_t, vector<uint32_t>> buckets;
+    for (uint32_t i = 0; i < items.size(); ++i) {
+        keys[i] = lshindex::hash_trajectory(lsh_family, r, items[i].content, probes);
+        for (size_t t = 0; t < tables; ++t)
+            buckets[keys[i][t * keysPerTable]].push_back(i);
+    }
+    timeHash = chrono::duration<double>(chrono::steady_clock::now() - start_time).count();
+
+    // A trajectory a collides with the probing one on table t when its primary key is one of the probe keys
+    auto collides = [&](const vector<int64_t>& probe, size_t t, int64_t key) {
+        auto first = probe.begin() + t * keysPerTable;
+        return find(first, first + keysPerTable, key) != first + keysPerTable;
+    };
+
+    vector<pair<uint32_t, uint32_t>> pairs;
+    candidates = 0;
+    for (uint32_t b = 0; b < items.size(); ++b) {
+        const vector<int64_t>& probe = keys[b];
+        for (size_t k = 0; k < probe.size(); ++k) {
+            int64_t key = probe[k];
+            if (key < 0 || find(probe.begin(), probe.begin() + k, key) != probe.begin() + k)
+                continue;
+            auto bucket = buckets.find(key);
+            if (bucket == buckets.end())
+                continue;
+            size_t t = k / keysPerTable;
+            for (uint32_t a : bucket->second) {
+                if (items[a].dataset >= items[b].dataset)
+                    continue;
+                size_t tt = 0;
+                while (tt < tables && !collides(probe, tt, keys[a][tt * keysPerTable])) ++tt;
+                if (tt != t || keys[a][t * keysPerTable] != key)
+                    continue;
+                ++candidates;
+                if (similarity_test(items[a].content, items[b].content))
+                    pairs.push_back(minmax(a, b));
+            }
+        }
+    }
+    sort(pairs.begin(), pairs.end());
+    return pairs;
+}
+
+/**
+* @brief Main function: computes (or loads) the ground truth and evaluates an LSH setup against it.
+* @param argc Argument count
+* @param argv Argument values (options and input dataset)
+* @return int Exit status
+*/
+int main(int argc, char** argv) {
+
+    // Usage description
+    auto usage_and_exit = [argv]() {
+        printf("   use: %s [-n threads] [-w resolution] [-r functions] [-L tables] [-p probes] [-g truthFile] inputFile\n", argv[0]);
+        printf("   -n threads     -> threads of the ground truth join (default: hardware concurrency) \n");
+        printf("   -w resolution  -> LSH grid resolution (default: %d) \n", LSH_RESOLUTION);
+        printf("   -r functions   -> LSH functions concatenated (AND) in each key (default: 1) \n");
+        printf("   -L tables      -> LSH tables (default: %d) \n", LSH_FAMILY_SIZE);
+        printf("   -p probes      -> multi-probe: perturbed hashes of each function (default: 0) \n");
+        printf("   -g truthFile   -> ground truth pairs (ids): read if it exists, otherwise computed and written \n\n");
+        exit(EXIT_FAILURE);
+    };
+
+    // Optional arguments
+    size_t threads = max(1u, thread::hardware_concurrency()), r = 1, tables = LSH_FAMILY_SIZE, probes = 0;
+    double resolution = LSH_RESOLUTION;
+    const char* truthFilename = nullptr;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:w:r:L:p:g:")) != -1) {
+        if (opt == 'n') threads = max(1ul, stoul(optarg));
+        else if (opt == 'w') resolution = stod(optarg);
+        else if (opt == 'r') r = max(1ul, stoul(optarg));
+        else if (opt == 'L') tables = max(1ul, stoul(optarg));
+        else if (opt == 'p') probes = stoul(optarg);
+        else if (opt == 'g') truthFilename = optarg;
+        else usage_and_exit();
+    }
+    if (argc - optind < 1 || resolution <= 0) usage_and_exit();
+
+    // Read the sample dataset
+    ifstream file(argv[optind]);
+    if (!file.is_open()) {
+        cerr << "Error opening dataset file!" << endl;
+        return EXIT_FAILURE;
+    }
+    vector<item> items;
+    unordered_map<size_t, uint32_t> positions;
+    string line;
+    while (getline(file, line)) {
+        if (line.empty()) continue;
+        item it = parseLine(line);
+        if (!it.content.size()) continue;
+        positions[it.id] = items.size();
+        items.push_back(move(it));
+    }
+    file.close();
+
+    auto elapsed = [](chrono::steady_clock::time_point since) {
+        return chrono::duration<double>(chrono::steady_clock::now() - since).count();
+    };
+
+    // Ground truth: from the truth file if any, otherwise the exact join
+    auto start_time = chrono::steady_clock::now();
+    vector<pair<uint32_t, uint32_t>> truth;
+    ifstream truthIn;
+    if (truthFilename)
+        truthIn.open(truthFilename);
+    if (truthIn.is_open()) {
+        size_t a, b;
+        while (truthIn >> a >> b) {
+            if (!positions.count(a) || !positions.count(b)) {
+                cerr << "Ground truth of a different dataset!" << endl;
+                return EXIT_FAILURE;
+            }
+            truth.push_back(minmax(positions[a], positions[b]));
+        }
+        sort(truth.begin(), truth.end());
+    }
+    else {
+        truth = groundTruth(items, threads);
+        if (truthFilename) {
+            ofstream truthOut(truthFilename);
+            for (auto& [a, b] : truth)
+                truthOut << items[a].id << "\t" << items[b].id << "\n";
+        }
+    }
+    double timeTruth = elapsed(start_time);
+
+    // LSH join under evaluation
+    vector<FrechetLSH> lsh_family = lshindex::make_family(tables, r, LSH_SEED, resolution);
+    decisions = 0;
+    size_t candidates;
+    double timeHash;
+    start_time = chrono::steady_clock::now();
+    vector<pair<uint32_t, uint32_t>> found = lshJoin(items, lsh_family, r, probes, candidates, timeHash);
+    double timeJoin = elapsed(start_time);
+
+    vector<pair<uint32_t, uint32_t>> hits;
+    set_intersection(found.begin(), found.end(), truth.begin(), truth.end(), back_inserter(hits));
+    double recall = truth.empty() ? 1 : static_cast<double>(hits.size()) / truth.size();
+    // Every found pair is verified, so precision is measured on the candidates (true pairs per candidate)
+    double precision = candidates ? static_cast<double>(hits.size()) / candidates : 1;
+
+    // Collect results (LSH setup, true pairs, found pairs, recall, candidates, precision of the candidates,
+    // Frechet decisions of the LSH join and times of the ground truth, the hashing and the LSH join)
+    cout <<
+        argv[0] << "\t" <<
+        argv[optind] << "\t" <<
+        resolution << "\t" <<
+        r << "\t" <<
+        tables << "\t" <<
+        probes << "\t" <<
+        truth.size() << "\t" <<
+        found.size() << "\t" <<
+        recall << "\t" <<
+        candidates << "\t" <<
+        precision << "\t" <<
+        decisions << "\t" <<
+        timeTruth << "\t" <<
+        timeHash << "\t" <<
+        timeJoin <<
+    endl;
+
+    return 0;
+}
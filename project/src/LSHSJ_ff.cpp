@@ -31,6 +31,9 @@
 #include "hash.hpp"             // Hashing functions
 #include "geometry_basics.hpp"  // Basic geometric operations
 #include "frechet_distance.hpp" // Frechet distance computations
+#include "join_spec.hpp"        // Join specification (cross, self, all)
+#include "metrics.hpp"          // Per-phase metrics (LSHSJ_METRICS)
+#include "trace.hpp"            // Timeline of threads (LSHSJ_TRACE)
 
 // LSH function parameters: family size, seed, resolution
 #define LSH_FAMILY_SIZE 8       
@@ -47,6 +50,7 @@ using namespace std;
 // Globals 
 size_t similar{0};
 ostream* resultsStream = &cout;
+joinspec::join_spec spec;
 
 struct membuf : public streambuf {
     membuf(char* start, size_t size) {
@@ -140,6 +144,7 @@ struct Mapper: ff_monode_t<element_t, element_t>{
 
         // Get num reducers and go starting line of the chunk
         num_outChannel = get_num_outchannels();
+        trace::thread_name("mapper");
         GotoLine(in, startChunk+1);
 
         return 0;
@@ -147,21 +152,35 @@ struct Mapper: ff_monode_t<element_t, element_t>{
 
     element_t* svc(element_t* ){
         
-        // Read lines of the chunk
+        // Read lines of the chunk (counters of the mapper include sending elements out)
+        metrics::counters mapping(metrics::HW_MAP);
+        trace::span tracing("map chunk", "map");
+        int64_t numLines = 0;
         string line;
         for(int i = 0; i < endChunk; i++){
+            metrics::scope reading(metrics::READ);
             getline(in, line);
             if (in.eof()) break;
+            reading.stop();
             
             // Parse a line as item e prepare out pointer
+            metrics::scope parsing(metrics::PARSE);
+            metrics::count(metrics::LINES);
+            ++numLines;
             item it = parseLine(line);
+            parsing.stop();
+            if (!spec.accepts(it.dataset)) continue;
 
             // Apply LSH function over item
+            metrics::scope hashing(metrics::HASH);
             array<long, LSH_FAMILY_SIZE> rel_LSHs; 
             for(int index = 0; index < LSH_FAMILY_SIZE; index++)
                 rel_LSHs[index] = familyLSH[index].hash(it.content);
+            hashing.stop();
             
             // Iterate over LSH values to create out element
+            metrics::scope shuffling(metrics::SHUFFLE);
+            metrics::count(metrics::ELEMENTS, LSH_FAMILY_SIZE);
             element_t* out;
             for (long h : rel_LSHs){
                 
@@ -178,6 +197,8 @@ struct Mapper: ff_monode_t<element_t, element_t>{
                 ff_send_out_to(out, outChannel);
             }
         }
+        tracing.set_count(numLines);
+
         // End-of-stream special message 
         return EOS; 
     }
@@ -194,13 +215,23 @@ struct Mapper: ff_monode_t<element_t, element_t>{
 
 struct Reducer: ff_minode_t<element_t, element_t>{
     
+    int svc_init(){
+        
+        // Counters from the first element received to the end of the stream
+        receiving.start();
+        trace::thread_name("reducer");
+        return 0;
+    }
     
     element_t* svc(element_t* in){
         // Group elements by key 
+        metrics::scope grouping(metrics::GROUP);
+        receive.begin();
         auto& input = *in;
         elements[input.LSH].push_back(move(input));
         
         delete in; 
+        receive.end();
         return GO_ON; 
     }
 
@@ -208,9 +239,13 @@ struct Reducer: ff_minode_t<element_t, element_t>{
         for(size_t ii = 0; ii < a.relativeLSHs.size(); ii++)
             if (a.relativeLSHs[ii] == b.relativeLSHs[ii]){
                 if (lsh == a.relativeLSHs[ii]){
+                    metrics::count(metrics::CANDIDATES);
                     if (similarity_test(a.trajectory, b.trajectory)){
                         ++foundSimilar;
                         similarPair.emplace_back(a.id, b.id); 
+#ifdef REPORT_DISTANCE
+                        similarDistance.push_back(get_frechet_distance_within(a.trajectory, b.trajectory, SIM_THRESHOLD));
+#endif
                         //*resultsStream << a.id << "\t" << b.id << endl;
                     }
                 }
@@ -221,24 +256,37 @@ struct Reducer: ff_minode_t<element_t, element_t>{
     void svc_end(){
         
         // Similarity Join procedure
+        receiving.stop();
+        receive.flush();
+        metrics::counters joins(metrics::HW_JOIN);
+        metrics::count(metrics::BUCKETS, elements.size());
         for (auto& [lsh, elements_v] : elements){
+            if (elements_v.size() < 2) continue;
+            trace::span tracing("join bucket", "join", elements_v.size());
             
-            // compute all possilbe combination of elements in elements_v vector
-            for(size_t i = 0; i < elements_v.size(); i++){
-                for(size_t j = i+1; j < elements_v.size(); j++){
-                    if (elements_v[i].dataSet != elements_v[j].dataSet)
+            // compute the combinations of elements in elements_v vector requested by the join specification
+            metrics::scope grouping(metrics::GROUP);
+            stable_sort(elements_v.begin(), elements_v.end(), [](const element_t& a, const element_t& b) { return a.dataSet < b.dataSet; });
+            grouping.stop();
+            metrics::scope joining(metrics::JOIN);
+            joinspec::for_each_row(spec, elements_v.size(), 0, elements_v.size(), [&](size_t i) { return elements_v[i].dataSet; },
+                [&](size_t i, size_t first, size_t last) {
+                    for(size_t j = first; j < last; j++)
                         similarity(lsh, elements_v[i], elements_v[j]);
-                        
-
-                }
-            }
+                });
         }
         similar += foundSimilar;
+        metrics::count(metrics::MATCHES, foundSimilar);
     }
 
     vector<pair<long, long>> similarPair;
+#ifdef REPORT_DISTANCE
+    vector<double> similarDistance;                  // Frechet distance of each similar pair
+#endif
     unordered_map<long, vector<element_t>> elements; // Local (key-values) elements 
     size_t foundSimilar = 0;                         // Local counter of similar pairs
+    metrics::counters receiving{metrics::HW_SHUFFLE, false};
+    trace::activity receive{"receive", "shuffle"};   // Busy intervals of the stream, holes are waits for mappers
 
 };
 
@@ -247,12 +295,13 @@ int main (int argc, char *argv[]) {
 
     // Usage description 
     auto usage_and_exit = [argv]() {
-        printf("   use: %s inputFile Lworkers Rworkers [outputFile]\n", argv[0]);
+        printf("   use: %s inputFile Lworkers Rworkers policy outputFile [joinSpec]\n", argv[0]);
         printf("   inputFile   -> input file path \n");
         printf("   Lworker     -> number of left-workers (mappers) \n");
         printf("   Rworker     -> number of right-workers (reducer) \n");
         printf("   policy      -> 0 (roundrobin) - 1 (on demand) \n");
-        printf("   outputFile  -> output file path \n\n");
+        printf("   outputFile  -> output file path \n");
+        printf("   joinSpec    -> cross (default), self, all, optionally restricted to datasets (e.g. self:0, cross:0,1,2) \n\n");
         exit(-1);
     };
 
@@ -262,6 +311,7 @@ int main (int argc, char *argv[]) {
     const size_t num_mappers = stol(argv[2]);
     const size_t num_reducers = stol(argv[3]);
     const size_t policy = stol(argv[4]); 
+    if (argc > 6 && !joinspec::parse(argv[6], spec)) usage_and_exit();
 
     // Start timer
     ffTime(ff::START_TIME); 
@@ -273,6 +323,7 @@ int main (int argc, char *argv[]) {
         resultsStream = &filestream;
 
     // Open input file and map it to memory 
+    metrics::scope reading(metrics::READ);
     int inFileDesc = open(inFilename.c_str(), O_RDONLY);
     struct stat inFileStat;
     fstat (inFileDesc, &inFileStat);
@@ -290,6 +341,7 @@ int main (int argc, char *argv[]) {
     ++numLines; 
     close(inFileDesc);
     linesPerMapper = numLines / num_mappers; 
+    reading.stop();
 
     // LSH family functions initilization 
     FrechetLSH lshFamily[LSH_FAMILY_SIZE];
@@ -333,13 +385,21 @@ int main (int argc, char *argv[]) {
     munmap(inFileMapped, inFileBytes);
 
     // Print results to output file
+    metrics::scope writing(metrics::OUTPUT);
+    trace::span tracing("output", "output", similar);
     for (size_t i=0; i <num_reducers; i++){
         Reducer* r = reinterpret_cast<Reducer*>(reducerSet[i]);
-        for (auto& p : r->similarPair){
+        for (size_t j = 0; j < r->similarPair.size(); j++){
+            auto& p = r->similarPair[j];
+#ifdef REPORT_DISTANCE
+            *resultsStream << p.first << " " << p.second << " " << r->similarDistance[j] <<endl; 
+#else
             *resultsStream << p.first << " " << p.second <<endl; 
+#endif
         }
     }
-    
+    writing.stop();
+    tracing.stop();
 
     // Stop timer
     ffTime(STOP_TIME);
@@ -353,6 +413,8 @@ int main (int argc, char *argv[]) {
         << ff::ffTime(ff::GET_TIME) / 1000
         << "\t" << a2a.ffTime()  / 1000 
         << endl;
+    metrics::report("ff", inFilename);
+    trace::write();
  
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,691 @@
+/**
+* @author   Irene Pisani
+* @note     University of Pisa, Computer Science department.
+*           M.Sc. Computer Science, Artificial Intelligence
+*           Parallel and Distributed Systems: Paradigms and models (23/24).
+*
+* @brief    Project track 3: Locality Sensitive Hashing based Similarity Join (LSHSJ)
+* @details  Parallel implementation of LSHSJ for clusters of Shared Memory Systems with FF and MPI.
+*           One MPI process per node runs a FF all-to-all network:
+*           - first set: mappers reading a line range of the node input partition, plus a receiver
+*             that injects the elements shipped by the other nodes;
+*           - second set: reducers owning the local buckets, plus a sender that packs the elements
+*             whose bucket lives on another node and ships them asynchronously.
+*           Bucket key h is owned by node (h % nodes) and, inside it, by reducer ((h / nodes) % reducers).
+*           The input file is memory-mapped by every process (shared file system).
+*
+*/
+
+// Streams
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <ostream>
+
+// Memory mapping utilities
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Others utilities
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <random>
+#include <utility>
+#include <thread>
+#include <unordered_map>
+#include <bit>
+
+// Message Passing Interface (MPI) lib
+#include <mpi.h>
+
+// FastFlow (FF) header libs
+#include <ff/ff.hpp>
+#include <ff/all2all.hpp>
+
+// Custom headers for geometric operations
+#include "hash.hpp"
+#include "geometry_basics.hpp"
+#include "frechet_distance.hpp"
+
+// Wire format of shuffled trajectories
+#include "trajectory_codec.hpp"
+
+// Per-phase metrics (LSHSJ_METRICS)
+#include "metrics.hpp"
+
+// Timeline of threads and ranks (LSHSJ_TRACE)
+#include "trace.hpp"
+
+using namespace ff;
+using namespace std;
+
+#define LSH_FAMILY_SIZE 8     // Number of LSH functions
+#define LSH_SEED 234          // Seed for LSH function
+#define LSH_RESOLUTION 80     // Resolution for LSH function
+
+// Bytes packed for a destination node before the sender ships them
+#ifndef SHUFFLE_BUFFER_BYTES
+#define SHUFFLE_BUFFER_BYTES (1 << 20)
+#endif
+
+// Tags of the cross-node shuffle messages
+#define TAG_DATA 1
+#define TAG_END 2
+
+// Words of a similar pair in the flattened pairs: ids [, bits of the Frechet distance] (make DISTANCE=1)
+#ifdef REPORT_DISTANCE
+#define PAIR_WORDS 3
+#else
+#define PAIR_WORDS 2
+#endif
+
+// Similarity threasholds
+const static double SIM_THRESHOLD = 10;
+const static double SIM_THRESHOLD_SQR = sqr(SIM_THRESHOLD);
+
+// Coordinates codec for shuffled trajectories: raw doubles, or fixed-point deltas (make DELTA=scale)
+#ifdef WIRE_DELTA_SCALE
+const static wire::codec_t WIRE_CODEC{wire::DELTA, WIRE_DELTA_SCALE};
+#else
+const static wire::codec_t WIRE_CODEC = wire::RAW_CODEC;
+#endif
+
+struct item {
+    size_t id;      // Unique identifier
+    int dataset;    // Dataset identifier
+    curve content;  // Curve representing the trajectory
+};
+
+struct element_t {
+
+    long LSH;           // Bucket key (elements sent to a local reducer)
+    int dataSet;        // Dataset identifier
+    curve trajectory;   // Curve representing the trajectory
+    array<long, LSH_FAMILY_SIZE> relativeLSHs; // LSH values for the LSH function
+    long id;            // Unique identifier
+    uint32_t bucketMask; // Positions of relativeLSHs whose bucket lives on the destination node (elements sent to the sender)
+
+    // Constructor
+    element_t() = default;
+    element_t(long hash, int dataset, const curve& trajectory, decltype(relativeLSHs) relativeLSHs, long id, uint32_t bucketMask)
+        : LSH(hash), dataSet(dataset), trajectory(trajectory), relativeLSHs(relativeLSHs), id(id), bucketMask(bucketMask) {}
+};
+
+static_assert(LSH_FAMILY_SIZE <= 32, "bucketMask holds one bit per LSH function");
+
+// Upper bound on the bytes written by packElement
+constexpr size_t MAX_ELEMENT_BYTES = wire::MAX_TRAJECTORY_BYTES + (LSH_FAMILY_SIZE + 1) * wire::MAX_VARINT_BYTES;
+
+void packElement(vector<char>& buffer, const element_t& elem) {
+
+    // Only the points of the trajectory are sent, prefix lengths are rebuilt on unpack
+    wire::put_trajectory(buffer, elem.id, elem.dataSet, elem.trajectory, WIRE_CODEC);
+    for (long h : elem.relativeLSHs) {
+        wire::put_varint(buffer, h);
+    }
+    wire::put_varint(buffer, elem.bucketMask);
+}
+
+const char* unpackElement(const char* p, element_t& elem) {
+
+    uint64_t id;
+    wire::get_trajectory(p, id, elem.dataSet, elem.trajectory, WIRE_CODEC);
+    elem.id = static_cast<long>(id);
+    for (long& h : elem.relativeLSHs) {
+        h = static_cast<long>(wire::get_varint(p));
+    }
+    elem.bucketMask = static_cast<uint32_t>(wire::get_varint(p));
+    return p;
+}
+
+item parseLine(const string& line) {
+
+    // Parse a line of the input dataset as an item
+    istringstream ss(line);
+    item output;
+
+    ss >> output.id;        // Extract id
+    ss >> output.dataset;   // Extract dataset
+
+    // extract trajectory
+    string tmp;
+    ss >> tmp;
+    if (!(tmp.find_first_of("[") == string::npos)) {
+        tmp.replace(0, 1, "");
+        tmp.replace(tmp.length() - 1, tmp.length(), "");
+        bool ext = false;
+
+        while (!ext) {
+            string extrait = tmp.substr(tmp.find("["), tmp.find("]") + 1);
+            string extrait1 = extrait.substr(1, extrait.find(",") - 1);
+            string extrait2 = extrait.substr(extrait.find(",") + 1);
+            extrait2 = extrait2.substr(0, extrait2.length() - 1);
+            double e1 = stod(extrait1);
+            double e2 = stod(extrait2);
+            output.content.push_back(move(point(e1, e2)));
+            ext = (tmp.length() == extrait.length());
+            if (!ext)
+                tmp = tmp.substr(tmp.find_first_of("]") + 2, tmp.length());
+        }
+    }
+    return output;
+}
+
+bool similarity_test(const curve& c1, const curve& c2) {
+
+    // Perform similarity test based on Frechet distance
+    if (euclideanSqr(c1[0], c2[0]) > SIM_THRESHOLD_SQR || euclideanSqr(c1.back(), c2.back()) > SIM_THRESHOLD_SQR)
+        return false;
+    if (equalTime(c1, c2, SIM_THRESHOLD_SQR) || get_frechet_distance_upper_bound(c1, c2) <= SIM_THRESHOLD)
+        return true;
+    if (negfilter(c1, c2, SIM_THRESHOLD))
+        return false;
+    if (is_frechet_distance_at_most(c1, c2, SIM_THRESHOLD))
+        return true;
+    return false;
+}
+
+size_t lineBoundary(const char* data, size_t bytes, size_t pos) {
+
+    // First line starting at or after byte pos
+    if (pos == 0 || pos >= bytes) return min(pos, bytes);
+    const char* nl = static_cast<const char*>(memchr(data + pos - 1, '\n', bytes - pos + 1));
+    return nl ? static_cast<size_t>(nl - data) + 1 : bytes;
+}
+
+struct Mapper: ff_monode_t<element_t, element_t> {
+
+    Mapper(const char* data, size_t begin, size_t end, FrechetLSH* familyLSH, int rank, int size, size_t num_reducers)
+        : data(data), begin(begin), end(end), familyLSH(familyLSH), rank(rank), size(size), num_reducers(num_reducers) {}
+
+    element_t* svc(element_t*) {
+
+        // Read lines of the byte range (counters of the mapper include sending elements out)
+        metrics::counters mapping(metrics::HW_MAP);
+        trace::thread_name("mapper");
+        trace::span tracing("map chunk", "map");
+        int64_t numLines = 0;
+        string line;
+        size_t pos = begin;
+        while (pos < end) {
+            const char* nl = static_cast<const char*>(memchr(data + pos, '\n', end - pos));
+            size_t next = nl ? static_cast<size_t>(nl - data) : end;
+            line.assign(data + pos, next - pos);
+            pos = next + 1;
+            if (line.empty()) continue;
+
+            // Parse a line as item and apply LSH functions over it
+            metrics::scope parsing(metrics::PARSE);
+            metrics::count(metrics::LINES);
+            ++numLines;
+            item it = parseLine(line);
+            parsing.stop();
+            metrics::scope hashing(metrics::HASH);
+            array<long, LSH_FAMILY_SIZE> rel_LSHs;
+            for (size_t j = 0; j < LSH_FAMILY_SIZE; j++) {
+                rel_LSHs[j] = familyLSH[j].hash(it.content);
+            }
+            metrics::count(metrics::ELEMENTS, LSH_FAMILY_SIZE);
+            hashing.stop();
+
+            // Local buckets go straight to their reducer, remote ones are grouped by destination node
+            metrics::scope shuffling(metrics::SHUFFLE);
+            uint32_t remoteMask = 0;
+            for (size_t j = 0; j < LSH_FAMILY_SIZE; j++) {
+                long h = rel_LSHs[j];
+                if (h % size == rank) {
+                    ff_send_out_to(new element_t(h, it.dataset, it.content, rel_LSHs, it.id, 0), (h / size) % num_reducers);
+                } else {
+                    remoteMask |= 1u << j;
+                }
+            }
+            while (remoteMask) {
+                int dest = rel_LSHs[__builtin_ctz(remoteMask)] % size;
+                uint32_t mask = 0;
+                for (size_t j = 0; j < LSH_FAMILY_SIZE; j++) {
+                    if ((remoteMask & (1u << j)) && rel_LSHs[j] % size == dest) mask |= 1u << j;
+                }
+                remoteMask &= ~mask;
+                ff_send_out_to(new element_t(0, it.dataset, it.content, rel_LSHs, it.id, mask), num_reducers);
+            }
+        }
+        tracing.set_count(numLines);
+        tracing.stop();
+
+        // Tell the sender that this mapper is done (an element without remote buckets)
+        ff_send_out_to(new element_t(0, 0, curve(), {}, 0, 0), num_reducers);
+
+        // End-of-stream special message
+        return EOS;
+    }
+
+    const char* data;       // Memory-mapped input file
+    size_t begin, end;      // Byte range of the lines to read
+    FrechetLSH* familyLSH;
+    int rank, size;
+    size_t num_reducers;
+};
+
+struct Receiver: ff_monode_t<element_t, element_t> {
+
+    Receiver(MPI_Comm comm, int rank, int size, size_t num_reducers)
+        : comm(comm), rank(rank), size(size), num_reducers(num_reducers) {}
+
+    element_t* svc(element_t*) {
+
+        // Forward elements shipped by the other nodes until every sender is done
+        metrics::counters receiving(metrics::HW_SHUFFLE);
+        trace::thread_name("receiver");
+        int ends = 0;
+        vector<char> recvBuffer;
+        while (ends < size - 1) {
+            int flag;
+            MPI_Status status;
+            MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, comm, &flag, &status);
+            if (!flag) {
+                this_thread::yield();
+                continue;
+            }
+            metrics::scope shuffling(metrics::SHUFFLE);
+            int count;
+            MPI_Get_count(&status, MPI_CHAR, &count);
+            recvBuffer.resize(count);
+            MPI_Recv(recvBuffer.data(), count, MPI_CHAR, status.MPI_SOURCE, status.MPI_TAG, comm, MPI_STATUS_IGNORE);
+            if (status.MPI_TAG == TAG_END) {
+                ++ends;
+                continue;
+            }
+            trace::span tracing("receive batch", "shuffle", count);
+
+            // One copy per local bucket of the trajectory
+            const char* recvPtr = recvBuffer.data();
+            const char* recvEnd = recvPtr + count;
+            element_t elem;
+            while (recvPtr < recvEnd) {
+                recvPtr = unpackElement(recvPtr, elem);
+                for (size_t j = 0; j < LSH_FAMILY_SIZE; j++) {
+                    if (elem.bucketMask & (1u << j)) {
+                        long h = elem.relativeLSHs[j];
+                        ff_send_out_to(new element_t(h, elem.dataSet, elem.trajectory, elem.relativeLSHs, elem.id, 0), (h / size) % num_reducers);
+                    }
+                }
+            }
+        }
+
+        // End-of-stream special message
+        return EOS;
+    }
+
+    MPI_Comm comm;
+    int rank, size;
+    size_t num_reducers;
+};
+
+struct Sender: ff_minode_t<element_t, element_t> {
+
+    Sender(MPI_Comm comm, int rank, int size, size_t num_mappers)
+        : comm(comm), rank(rank), size(size), num_mappers(num_mappers), buffers(size) {}
+
+    int svc_init() {
+
+        // Counters from the first element packed to the end of the stream
+        sending.start();
+        trace::thread_name("sender");
+        return 0;
+    }
+
+    void svc_end() {
+        sending.stop();
+    }
+
+    element_t* svc(element_t* in) {
+
+        // Once every mapper is done, flush and close the stream towards the other nodes:
+        // waiting for the end-of-stream would also wait for the local receiver, hence for the other nodes
+        metrics::scope shuffling(metrics::SHUFFLE);
+        if (!in->bucketMask) {
+            delete in;
+            if (++mappersDone == num_mappers) finish();
+            return GO_ON;
+        }
+
+        // Pack the element for its destination node, ship the buffer when full
+        int dest = in->relativeLSHs[__builtin_ctz(in->bucketMask)] % size;
+        packElement(buffers[dest], *in);
+        delete in;
+        if (buffers[dest].size() >= SHUFFLE_BUFFER_BYTES) post(dest);
+        return GO_ON;
+    }
+
+    void post(int dest) {
+
+        // Release buffers already delivered, then send the full one
+        trace::span tracing("batch send", "shuffle", buffers[dest].size());
+        size_t kept = 0;
+        for (size_t i = 0; i < requests.size(); ++i) {
+            int done;
+            MPI_Test(&requests[i], &done, MPI_STATUS_IGNORE);
+            if (!done) {
+                requests[kept] = requests[i];
+                swap(inflight[kept++], inflight[i]);
+            }
+        }
+        requests.resize(kept);
+        inflight.resize(kept);
+
+        inflight.push_back(move(buffers[dest]));
+        buffers[dest] = vector<char>();
+        buffers[dest].reserve(SHUFFLE_BUFFER_BYTES + MAX_ELEMENT_BYTES);
+        requests.emplace_back();
+        MPI_Isend(inflight.back().data(), inflight.back().size(), MPI_CHAR, dest, TAG_DATA, comm, &requests.back());
+        ++messages;
+    }
+
+    void finish() {
+
+        // Flush partial buffers and notify the end of the stream to every other node
+        trace::span tracing("flush stream", "shuffle");
+        for (int dest = 0; dest < size; ++dest) {
+            if (dest != rank && !buffers[dest].empty()) post(dest);
+        }
+        for (int dest = 0; dest < size; ++dest) {
+            if (dest != rank) MPI_Send(nullptr, 0, MPI_CHAR, dest, TAG_END, comm);
+        }
+        MPI_Waitall(requests.size(), requests.data(), MPI_STATUSES_IGNORE);
+        requests.clear();
+        inflight.clear();
+    }
+
+    MPI_Comm comm;
+    int rank, size;
+    size_t num_mappers;
+    size_t mappersDone = 0;
+    vector<vector<char>> buffers;   // Pending bytes per destination node
+    vector<vector<char>> inflight;  // Buffers of the sends not completed yet
+    vector<MPI_Request> requests;
+    size_t messages = 0;
+    metrics::counters sending{metrics::HW_SHUFFLE, false};
+};
+
+struct Reducer: ff_minode_t<element_t, element_t> {
+
+    int svc_init() {
+
+        // Counters from the first element received to the end of the stream
+        receiving.start();
+        trace::thread_name("reducer");
+        return 0;
+    }
+
+    element_t* svc(element_t* in) {
+
+        // Group elements by key
+        metrics::scope grouping(metrics::GROUP);
+        receive.begin();
+        auto& input = *in;
+        elements[input.LSH].push_back(move(input));
+        delete in;
+        receive.end();
+        return GO_ON;
+    }
+
+    inline void similarity(const long lsh, const element_t& a, const element_t& b) {
+        for (size_t ii = 0; ii < a.relativeLSHs.size(); ii++) {
+            if (a.relativeLSHs[ii] == b.relativeLSHs[ii]) {
+                if (lsh == a.relativeLSHs[ii]) {
+                    metrics::count(metrics::CANDIDATES);
+                    if (similarity_test(a.trajectory, b.trajectory)) {
+                        similarPairs.push_back(a.id);
+                        similarPairs.push_back(b.id);
+#ifdef REPORT_DISTANCE
+                        similarPairs.push_back(bit_cast<long>(get_frechet_distance_within(a.trajectory, b.trajectory, SIM_THRESHOLD)));
+#endif
+                    }
+                }
+                return;
+            }
+        }
+    }
+
+    void svc_end() {
+
+        // Similarity Join procedure
+        receiving.stop();
+        receive.flush();
+        metrics::counters joins(metrics::HW_JOIN);
+        metrics::count(metrics::BUCKETS, elements.size());
+        metrics::scope joining(metrics::JOIN);
+        for (auto& [lsh, elements_v] : elements) {
+            if (elements_v.size() < 2) continue;
+            trace::span tracing("join bucket", "join", elements_v.size());
+            for (size_t i = 0; i < elements_v.size(); i++) {
+                for (size_t j = i + 1; j < elements_v.size(); j++) {
+                    if (elements_v[i].dataSet != elements_v[j].dataSet)
+                        similarity(lsh, elements_v[i], elements_v[j]);
+                }
+            }
+        }
+        metrics::count(metrics::MATCHES, similarPairs.size() / PAIR_WORDS);
+    }
+
+    vector<long> similarPairs;                       // Local similar pairs (flattened, PAIR_WORDS each)
+    unordered_map<long, vector<element_t>> elements; // Local (key-values) elements
+    metrics::counters receiving{metrics::HW_SHUFFLE, false};
+    trace::activity receive{"receive", "shuffle"};   // Busy intervals of the stream, holes are waits for mappers and receiver
+};
+
+void outputPairs(MPI_Comm comm, int size, int rank, vector<long>& simPairs, ostream* resultsStream) {
+
+    // Aggregate counts in root process
+    vector<int> recv_counts(size);
+    vector<int> displs(size, 0);
+    int count = static_cast<int>(simPairs.size());
+    MPI_Gather(&count, 1, MPI_INT, recv_counts.data(), 1, MPI_INT, 0, comm);
+
+    // Compute displacements
+    size_t tot_recvSize = 0;
+    for (int i = 0; i < size; ++i) {
+        displs[i] = (i==0) ? 0 : displs[i - 1] + recv_counts[i - 1];
+        tot_recvSize += recv_counts[i];
+    }
+
+    // Gather pairs on the root process and output them
+    vector<long> simPairsTot(tot_recvSize);
+    trace::span gatherv("MPI_Gatherv", "mpi", count);
+    MPI_Gatherv(
+        simPairs.data(), count, MPI_LONG,
+        simPairsTot.data(), recv_counts.data(), displs.data(), MPI_LONG,
+        0, comm
+    );
+    gatherv.stop();
+    if (!rank) {
+        for (size_t i = 0; i < simPairsTot.size(); i += PAIR_WORDS) {
+#ifdef REPORT_DISTANCE
+            *resultsStream << simPairsTot[i] << "\t" << simPairsTot[i+1] << "\t" << bit_cast<double>(simPairsTot[i+2]) << endl;
+#else
+            *resultsStream << simPairsTot[i] << "\t" << simPairsTot[i+1] << endl;
+#endif
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+
+    // Lambda function for usage description message
+    auto usage_and_exit = [argv]() {
+        printf("   use: %s inputFile Lworkers Rworkers policy [outputFile]\n", argv[0]);
+        printf("   inputFile   -> input file path \n");
+        printf("   Lworker     -> number of left-workers (mappers) per node \n");
+        printf("   Rworker     -> number of right-workers (reducer) per node \n");
+        printf("   policy      -> 0 (roundrobin) - 1 (on demand) \n");
+        printf("   outputFile  -> output file path (optional) \n\n");
+        exit(-1);
+    };
+
+    // Argument checking
+    if (argc < 5) {
+        usage_and_exit();
+    }
+    const char* inFilename = argv[1];
+    const size_t num_mappers = stol(argv[2]);
+    const size_t num_reducers = stol(argv[3]);
+    const size_t policy = stol(argv[4]);
+    if (!num_mappers || !num_reducers) {
+        usage_and_exit();
+    }
+
+    // Receiver and sender threads communicate concurrently
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_MULTIPLE, &provided);
+    if (provided < MPI_THREAD_MULTIPLE) {
+        printf("MPI_THREAD_MULTIPLE not provided\n");
+        MPI_Abort(MPI_COMM_WORLD, -1);
+    }
+
+    // Get process ID and total num. of process
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    trace::sync(MPI_COMM_WORLD);
+
+    // Get number of nodes used
+    char processor_name[MPI_MAX_PROCESSOR_NAME] = {};
+    int name_len;
+    MPI_Get_processor_name(processor_name, &name_len);
+    vector<char> all_names(size * MPI_MAX_PROCESSOR_NAME);
+    MPI_Gather(
+        processor_name, MPI_MAX_PROCESSOR_NAME, MPI_CHAR,
+        all_names.data(), MPI_MAX_PROCESSOR_NAME, MPI_CHAR,
+        0, MPI_COMM_WORLD
+    );
+    set<string> unique_nodes;
+    for (int i = 0; i < size; ++i) {
+        unique_nodes.insert(string(&all_names[i * MPI_MAX_PROCESSOR_NAME]));
+    }
+
+    // Dedicated communicator for the cross-node shuffle
+    MPI_Comm shuffleComm;
+    MPI_Comm_dup(MPI_COMM_WORLD, &shuffleComm);
+
+    // Start measuring total elapsed time
+    MPI_Barrier(MPI_COMM_WORLD);
+    double start_time = MPI_Wtime();
+
+    // Set output stream
+    ostream* resultsStream = &cout;
+    ofstream filestream;
+    if (argc > 5 && !rank) {
+        filestream = ofstream(argv[5]);
+        if (filestream.is_open())
+            resultsStream = &filestream;
+    }
+
+    // Map the input file to memory (every process)
+    metrics::scope reading(metrics::READ);
+    int inFileDesc = open(inFilename, O_RDONLY);
+    if (inFileDesc < 0) {
+        printf("Cannot open %s\n", inFilename);
+        MPI_Abort(MPI_COMM_WORLD, -1);
+    }
+    struct stat inFileStat;
+    fstat(inFileDesc, &inFileStat);
+    size_t inFileBytes = inFileStat.st_size;
+    char* inFileMapped = reinterpret_cast<char*>(mmap(0, inFileBytes, PROT_READ, MAP_PRIVATE, inFileDesc, 0));
+    close(inFileDesc);
+
+    // Byte range of the node, split among mappers without breaking lines
+    size_t nodeBegin = lineBoundary(inFileMapped, inFileBytes, inFileBytes * rank / size);
+    size_t nodeEnd = lineBoundary(inFileMapped, inFileBytes, inFileBytes * (rank + 1) / size);
+    size_t nodeBytes = nodeEnd - nodeBegin;
+    reading.stop();
+
+    // LSH family functions initilization
+    FrechetLSH lshFamily[LSH_FAMILY_SIZE];
+    for (size_t i = 0; i < LSH_FAMILY_SIZE; i++) {
+        lshFamily[i].init(LSH_RESOLUTION, LSH_SEED * i, i);
+    }
+
+    // Populate vectors of workers: mappers and receiver, reducers and sender
+    vector<ff_node*> firstSet;
+    vector<ff_node*> secondSet;
+    for (size_t i = 0; i < num_mappers; i++) {
+        size_t begin = lineBoundary(inFileMapped, nodeEnd, nodeBegin + nodeBytes * i / num_mappers);
+        size_t end = lineBoundary(inFileMapped, nodeEnd, nodeBegin + nodeBytes * (i + 1) / num_mappers);
+        firstSet.push_back(new Mapper(inFileMapped, begin, end, lshFamily, rank, size, num_reducers));
+    }
+    if (size > 1) {
+        firstSet.push_back(new Receiver(shuffleComm, rank, size, num_reducers));
+    }
+    for (size_t i = 0; i < num_reducers; i++) {
+        secondSet.push_back(new Reducer());
+    }
+    Sender* sender = new Sender(shuffleComm, rank, size, num_mappers);
+    secondSet.push_back(sender);
+
+    // Build and run all-to-all network
+    ff_a2a a2a;
+    a2a.add_firstset(firstSet, policy ? 1 : 0); // Round robin or on-demand
+    a2a.add_secondset(secondSet);
+    if (a2a.run_and_wait_end() < 0) {
+        error("running a2a\n");
+        MPI_Abort(MPI_COMM_WORLD, -1);
+    }
+
+    // Free memory
+    munmap(inFileMapped, inFileBytes);
+
+    // Collect similar pairs of local reducers
+    vector<long> simPairs;
+    for (size_t i = 0; i < num_reducers; i++) {
+        Reducer* r = reinterpret_cast<Reducer*>(secondSet[i]);
+        simPairs.insert(simPairs.end(), r->similarPairs.begin(), r->similarPairs.end());
+    }
+    size_t foundSimilar = simPairs.size() / PAIR_WORDS, foundSimilarTot = 0;
+    MPI_Reduce(&foundSimilar, &foundSimilarTot, 1, MPI_UNSIGNED_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+
+    // Write similar pairs to output file
+    MPI_Barrier(MPI_COMM_WORLD);
+    double start_time_out = MPI_Wtime();
+    metrics::scope writing(metrics::OUTPUT);
+    outputPairs(MPI_COMM_WORLD, size, rank, simPairs, resultsStream);
+    writing.stop();
+    MPI_Barrier(MPI_COMM_WORLD);
+    double end_time = MPI_Wtime();
+
+    // Network time of the slowest node
+    double time_a2a = a2a.ffTime() / 1000, elapsed_time_a2a;
+    MPI_Reduce(&time_a2a, &elapsed_time_a2a, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+
+    // Results for metrics computation
+    if (!rank) {
+        cout <<
+            argv[0] << "\t" <<              // executables name
+            inFilename << "\t" <<           // dataset name
+            unique_nodes.size() << "\t" <<  // num of nodes
+            size << "\t" <<                 // total num of process
+            num_mappers << "\t" <<          // mappers per process
+            num_reducers << "\t" <<         // reducers per process
+            policy << "\t" <<               // mappers scheduling policy
+            foundSimilarTot << "\t" <<      // num of similar pair
+            end_time - start_time_out << "\t" << // time for outputting pairs
+            elapsed_time_a2a << "\t" <<     // time of the FF network
+            end_time - start_time << "\t" << // total elapsed time
+        endl;
+    }
+    metrics::report("ff_mpi", inFilename, MPI_COMM_WORLD);
+    trace::write(MPI_COMM_WORLD);
+
+    // MPI environment finalization
+    MPI_Comm_free(&shuffleComm);
+    MPI_Finalize();
+
+    return 0;
+}
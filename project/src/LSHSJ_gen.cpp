@@ -0,0 +1,301 @@
+/**
+* @author   Irene Pisani
+* @note     University of Pisa, Computer Science department.
+*           M.Sc. Computer Science, Artificial Intelligence
+*           Parallel and Distributed Systems: Paradigms and models (23/24).
+*
+* @brief    Project track 3: Locality Sensitive Hashing based Similarity Join (LSHSJ)
+* @details  Deterministic multi-threaded generator of synthetic datasets (lsh1GB/5GB/10GB-style workloads).
+*           Trajectories are random walks, written as "id dataset [[x,y],...]" lines or in the binary format
+*           of trajectory_codec.hpp (read by LSHSJ_index). Trajectory i is drawn from its own generator seeded by (seed, i), so that
+*           the output only depends on the options, not on the num of threads:
+*           - even trajectories are random walks starting uniformly in the area or around a hotspot;
+*           - odd trajectories are, with the requested probability, a near-duplicate (every point jittered)
+*             of an earlier even one, put in another dataset; otherwise random walks as well.
+*/
+
+#include <iostream>
+#include <fstream>
+#include <ostream>
+#include <vector>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <getopt.h>
+
+#include "rand.h"
+#include "geometry_basics.hpp"
+
+// Binary format of trajectories
+#include "trajectory_codec.hpp"
+
+using namespace std;
+
+// Trajectories generated by a thread before the chunks are written in order
+#define GEN_CHUNK 4096
+// Trajectories generated to estimate the bytes of a trajectory (size target)
+#define GEN_SIZE_SAMPLES 1024
+
+/**
+ * @brief Parameters of the generated dataset.
+ */
+struct params_t {
+    uint64_t seed = 1;              // Seed of the whole dataset
+    int datasets = 2;               // Num of datasets (identifiers 0 ... datasets - 1)
+    size_t min_length = 5;          // Trajectory length: min num of points
+    size_t max_length = 70;         // Trajectory length: max num of points
+    double length_shape = 1;        // Trajectory length: min + (max - min) * u^shape (1: uniform, > 1: shorter)
+    double area = 10000;            // Side of the square area of the starting points
+    double step = 8;                // Standard deviation of a step of the random walk (per coordinate)
+    size_t hotspots = 0;            // Num of hotspots (spatial skew)
+    double hotspot_share = 0.8;     // Share of random walks starting around a hotspot
+    double hotspot_radius = 200;    // Standard deviation of a starting point around its hotspot
+    double duplicates = 0.25;       // Share of trajectories that are near-duplicates of another dataset
+    double jitter = 2;              // Standard deviation of the jitter of a near-duplicate (per coordinate)
+};
+
+/**
+ * @brief Draws a standard normal value (Box-Muller).
+ * @param rnd The generator
+ * @return double The value
+ */
+double gaussian(Xorshift1024star& rnd) {
+    double u = 1 - rnd.next_double();
+    return sqrt(-2 * log(u)) * cos(2 * M_PI * rnd.next_double());
+}
+
+/**
+ * @brief Generator of trajectory i of the dataset.
+ * @param p The parameters
+ * @param i Position of the trajectory
+ * @return Xorshift1024star The generator
+ */
+Xorshift1024star trajectoryRandom(const params_t& p, size_t i) {
+    return Xorshift1024star(Splitmix64(p.seed).next() + i * UINT64_C(0x9E3779B97F4A7C15));
+}
+
+/**
+ * @brief Generates a random walk.
+ * @param p The parameters
+ * @param centres Hotspots
+ * @param rnd The generator of the trajectory
+ * @param c The trajectory
+ */
+void randomWalk(const params_t& p, const vector<point>& centres, Xorshift1024star& rnd, curve& c) {
+    c = curve();
+    size_t length = p.min_length + static_cast<size_t>((p.max_length - p.min_length + 1) * pow(rnd.next_double(), p.length_shape));
+    length = min(length, p.max_length);
+    double x, y;
+    if (!centres.empty() && rnd.next_double() < p.hotspot_share) {
+        const point& centre = centres[rnd.next() % centres.size()];
+        x = centre.x + p.hotspot_radius * gaussian(rnd);
+        y = centre.y + p.hotspot_radius * gaussian(rnd);
+    }
+    else {
+        x = rnd.next_double(p.area);
+        y = rnd.next_double(p.area);
+    }
+    for (size_t k = 0; k < length; ++k) {
+        c.push_back(point(x, y));
+        x += p.step * gaussian(rnd);
+        y += p.step * gaussian(rnd);
+    }
+}
+
+/**
+ * @brief Generates trajectory i of the dataset.
+ * @param p The parameters
+ * @param centres Hotspots
+ * @param i Position of the trajectory
+ * @param dataset Dataset of the trajectory
+ * @param c The trajectory
+ */
+void generate(const params_t& p, const vector<point>& centres, size_t i, int& dataset, curve& c) {
+    Xorshift1024star rnd = trajectoryRandom(p, i);
+
+    // Near-duplicate of an earlier even (never duplicated) trajectory, in another dataset
+    if (i % 2 == 1 && p.datasets > 1 && rnd.next_double() < 2 * p.duplicates) {
+        size_t source = 2 * (rnd.next() % (i / 2 + 1));
+        int sourceDataset;
+        curve original;
+        generate(p, centres, source, sourceDataset, original);
+        dataset = (sourceDataset + 1 + rnd.next() % (p.datasets - 1)) % p.datasets;
+        c = curve();
+        for (const point& pt : original)
+            c.push_back(point(pt.x + p.jitter * gaussian(rnd), pt.y + p.jitter * gaussian(rnd)));
+        return;
+    }
+    if (i % 2 == 1)
+        rnd.next();
+    dataset = rnd.next() % p.datasets;
+    randomWalk(p, centres, rnd, c);
+}
+
+/**
+ * @brief Appends a trajectory to the output buffer.
+ * @param buf The buffer
+ * @param id Unique identifier
+ * @param dataset Dataset identifier
+ * @param c The trajectory
+ * @param binary Binary format (otherwise text lines)
+ * @param codec Codec of the binary format
+ */
+void writeTrajectory(vector<char>& buf, size_t id, int dataset, const curve& c, bool binary, const wire::codec_t& codec) {
+    if (binary) {
+        wire::put_trajectory(buf, id, dataset, c, codec);
+        return;
+    }
+    char text[64];
+    buf.insert(buf.end(), text, text + snprintf(text, sizeof(text), "%zu %d [", id, dataset));
+    bool first = true;
+    for (const point& pt : c) {
+        int n = snprintf(text, sizeof(text), "%s[%.6f,%.6f]", first ? "" : ",", pt.x, pt.y);
+        buf.insert(buf.end(), text, text + n);
+        first = false;
+    }
+    buf.push_back(']');
+    buf.push_back('\n');
+}
+
+/**
+ * @brief Parses a size with an optional K, M or G suffix.
+ * @param text The size
+ * @return double The num of bytes
+ */
+double parseSize(const string& text) {
+    size_t end;
+    double value = stod(text, &end);
+    char unit = (end < text.size()) ? toupper(text[end]) : 0;
+    return value * (unit == 'K' ? 1e3 : unit == 'M' ? 1e6 : unit == 'G' ? 1e9 : 1);
+}
+
+/**
+* @brief Main function: generates the dataset.
+* @param argc Argument count
+* @param argv Argument values (options and output file)
+* @return int Exit status
+*/
+int main(int argc, char** argv) {
+
+    // Usage description
+    auto usage_and_exit = [argv]() {
+        printf("   use: %s [-s seed] (-n trajectories | -S size) [-t threads] [-D datasets] [-l min:max[:shape]] [-a area] [-w step] \n", argv[0]);
+        printf("          [-H hotspots[:share[:radius]]] [-d duplicates[:jitter]] [-B raw|delta] outputFile\n");
+        printf("   -s seed           -> seed of the dataset (default: 1) \n");
+        printf("   -n trajectories   -> num of trajectories \n");
+        printf("   -S size           -> approximate size of the output, e.g. 1G, 5G, 10G (num of trajectories from a sample) \n");
+        printf("   -t threads        -> generator threads (default: hardware concurrency; the output does not depend on it) \n");
+        printf("   -D datasets       -> num of datasets (default: 2) \n");
+        printf("   -l min:max:shape  -> num of points: min + (max - min) * u^shape (default: 5:%d:1, uniform) \n", TRAJ_MAX_SIZE);
+        printf("   -a area           -> side of the area of the starting points (default: 10000) \n");
+        printf("   -w step           -> standard deviation of a random walk step (default: 8) \n");
+        printf("   -H hotspots:share:radius -> spatial skew: share of walks starting around one of the hotspots (default: 0 hotspots, 0.8, 200) \n");
+        printf("   -d share:jitter   -> share of near-duplicates of a trajectory of another dataset and their jitter (default: 0.25:2) \n");
+        printf("   -B raw|delta      -> binary output (trajectory_codec.hpp), raw doubles or fixed-point deltas at 1e-6, \n");
+        printf("                        read by LSHSJ_index build/probe \n\n");
+        exit(EXIT_FAILURE);
+    };
+
+    // Optional arguments
+    params_t p;
+    size_t trajectories = 0, threads = max(1u, thread::hardware_concurrency());
+    double size = 0;
+    bool binary = false;
+    wire::codec_t codec = wire::RAW_CODEC;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:n:S:t:D:l:a:w:H:d:B:")) != -1) {
+        if (opt == 's') p.seed = stoull(optarg);
+        else if (opt == 'n') trajectories = stoul(optarg);
+        else if (opt == 'S') size = parseSize(optarg);
+        else if (opt == 't') threads = max(1ul, stoul(optarg));
+        else if (opt == 'D') p.datasets = max(1, atoi(optarg));
+        else if (opt == 'l') sscanf(optarg, "%zu:%zu:%lf", &p.min_length, &p.max_length, &p.length_shape);
+        else if (opt == 'a') p.area = stod(optarg);
+        else if (opt == 'w') p.step = stod(optarg);
+        else if (opt == 'H') sscanf(optarg, "%zu:%lf:%lf", &p.hotspots, &p.hotspot_share, &p.hotspot_radius);
+        else if (opt == 'd') sscanf(optarg, "%lf:%lf", &p.duplicates, &p.jitter);
+        else if (opt == 'B' && !strcmp(optarg, "raw")) binary = true;
+        else if (opt == 'B' && !strcmp(optarg, "delta")) {
+            binary = true;
+            codec = {wire::DELTA, 1e6};
+        }
+        else usage_and_exit();
+    }
+    p.max_length = min<size_t>(p.max_length, TRAJ_MAX_SIZE);
+    p.min_length = max<size_t>(1, min(p.min_length, p.max_length));
+    if (argc - optind < 1 || (!trajectories && size <= 0) || p.length_shape <= 0) usage_and_exit();
+
+    auto start_time = chrono::steady_clock::now();
+
+    // Hotspots
+    vector<point> centres;
+    Xorshift1024star rnd(p.seed);
+    for (size_t h = 0; h < p.hotspots; ++h) {
+        double x = rnd.next_double(p.area);
+        centres.push_back(point(x, rnd.next_double(p.area)));
+    }
+
+    // Num of trajectories for a size target: mean bytes of the first trajectories
+    if (!trajectories) {
+        vector<char> sample;
+        int dataset;
+        curve c;
+        for (size_t i = 0; i < GEN_SIZE_SAMPLES; ++i) {
+            generate(p, centres, i, dataset, c);
+            writeTrajectory(sample, i + 1, dataset, c, binary, codec);
+        }
+        trajectories = max<size_t>(1, llround(size * GEN_SIZE_SAMPLES / sample.size()));
+    }
+
+    ofstream out(argv[optind], ios::binary);
+    if (!out.is_open()) {
+        cerr << "Error opening output file!" << endl;
+        return EXIT_FAILURE;
+    }
+    if (binary)
+        wire::write_header(out, codec);
+
+    // Rounds of one chunk per thread, written in order
+    vector<vector<char>> buffers(threads);
+    size_t bytes = 0;
+    for (size_t round = 0; round < trajectories; round += threads * GEN_CHUNK) {
+        vector<thread> workers;
+        for (size_t t = 0; t < threads; ++t) {
+            workers.emplace_back([&, t] {
+                vector<char>& buf = buffers[t];
+                buf.clear();
+                int dataset;
+                curve c;
+                size_t first = round + t * GEN_CHUNK, last = min(trajectories, first + GEN_CHUNK);
+                for (size_t i = first; i < last; ++i) {
+                    generate(p, centres, i, dataset, c);
+                    writeTrajectory(buf, i + 1, dataset, c, binary, codec);
+                }
+            });
+        }
+        for (size_t t = 0; t < threads; ++t) {
+            workers[t].join();
+            out.write(buffers[t].data(), buffers[t].size());
+            bytes += buffers[t].size();
+        }
+    }
+    out.close();
+    if (!out) {
+        cerr << "Error writing output file!" << endl;
+        return EXIT_FAILURE;
+    }
+
+    // Collect results (output file, trajectories, bytes and execution time)
+    cout <<
+        argv[0] << "\t" <<
+        argv[optind] << "\t" <<
+        trajectories << "\t" <<
+        bytes << "\t" <<
+        chrono::duration<double>(chrono::steady_clock::now() - start_time).count() <<
+    endl;
+
+    return 0;
+}
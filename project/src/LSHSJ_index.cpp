@@ -0,0 +1,556 @@
+/**
+* @author   Irene Pisani
+* @note     University of Pisa, Computer Science department.
+*           M.Sc. Computer Science, Artificial Intelligence
+*           Parallel and Distributed Systems: Paradigms and models (23/24).
+*
+* @brief    Project track 3: Locality Sensitive Hashing based Similarity Join (LSHSJ)
+* @details  Build-once, probe-many LSHSJ on a persistent LSH index.
+*           - build: hash a reference dataset and write its bucket index (see lsh_index.hpp);
+*           - probe: memory-map the index and join a query dataset against it,
+*             with the same pair deduplication of checkHelper in the batch executables.
+*/
+
+#include <iostream>
+#include <fstream>
+#include <ostream>
+#include <sstream>
+#include <vector>
+#include <chrono>
+#include <queue>
+#include <random>
+#include <unordered_map>
+#include <cmath>
+#include <cstring>
+#include <getopt.h>
+
+#include "hash.hpp"
+#include "geometry_basics.hpp"
+#include "frechet_distance.hpp"
+
+// Persistent LSH index format
+#include "lsh_index.hpp"
+
+// Binary datasets (LSHSJ_gen -B)
+#include "trajectory_codec.hpp"
+
+using namespace std;
+
+#define LSH_FAMILY_SIZE 8      // Number of LSH functions
+#define LSH_SEED 234           // Seed for LSH function
+#define LSH_RESOLUTION 80      // Resolution for LSH function
+
+// Automatic choice of the amplification (build -R): candidates and limits
+#define AMPLIFICATION_MAX_R 4        // Max num of functions concatenated in a key
+#define AMPLIFICATION_MAX_L 64       // Max num of tables
+#define AMPLIFICATION_SAMPLES 256    // Trajectories sampled to estimate the collision probability
+#define AMPLIFICATION_JITTERS 4      // Similar curves generated for each sampled trajectory
+
+// Bytes read at once from a binary dataset
+#define READ_CHUNK (1 << 20)
+
+// Similarity threasholds
+const static double SIM_THRESHOLD = 10;
+const static double SIM_THRESHOLD_SQR = sqr(SIM_THRESHOLD);
+
+size_t foundSimilar = 0;          // Counter for similar trajectories
+size_t knnCandidates = 0;         // Counter for candidates ranked by the kNN join
+size_t knnExact = 0;              // Counter for exact Frechet distances computed by the kNN join
+ostream* resultsStream = &cout;   // Output streams
+
+/**
+ * @brief Structure to represent an item in the dataset.
+ */
+struct item {
+    size_t id;         // Unique identifier
+    int dataset;       // Dataset identifier
+    curve content;     // Curve representing the trajectory
+};
+
+/**
+ * @brief Structure to represent a neighbour of a query trajectory.
+ */
+struct neighbour_t {
+    double distance;   // Frechet distance from the query
+    int64_t id;        // Unique identifier of the indexed trajectory
+
+    bool operator<(const neighbour_t& other) const {
+        return distance < other.distance || (distance == other.distance && id < other.id);
+    }
+};
+
+/**
+ * @brief Parses a line of data into an item object.
+ *
+ * @param line The input line as a string
+ * @return item The parsed item containing id, dataset, and trajectory
+ */
+item parseLine(string& line) {
+    istringstream ss(line);
+    item output;
+    ss >> output.id;
+    ss >> output.dataset;
+    string tmp;
+    ss >> tmp;
+
+    // Parse trajectory
+    if (!(tmp.find_first_of("[") == string::npos)) {
+        tmp.replace(0, 1, "");
+        tmp.replace(tmp.length() - 1, tmp.length(), "");
+        bool ext = false;
+        while (!ext) {
+            string extrait = tmp.substr(tmp.find("["), tmp.find("]") + 1);
+            string extrait1 = extrait.substr(1, extrait.find(",") - 1);
+            string extrait2 = extrait.substr(extrait.find(",") + 1);
+            extrait2 = extrait2.substr(0, extrait2.length() - 1);
+            double e1 = stod(extrait1);
+            double e2 = stod(extrait2);
+            output.content.push_back(move(point(e1, e2)));
+            ext = (tmp.length() == extrait.length());
+            if (!ext)
+                tmp = tmp.substr(tmp.find_first_of("]") + 2, tmp.length());
+        }
+    }
+    return output;
+}
+
+/**
+ * @brief Reader of a dataset file, either text lines or the binary format of trajectory_codec.hpp
+ *        (e.g. written by LSHSJ_gen -B), recognised by its header.
+ */
+struct datasetReader {
+    ifstream file;
+    bool binary = false;
+    wire::codec_t codec = wire::RAW_CODEC;
+    vector<char> buf;   // Binary: bytes read, decoded up to pos
+    size_t pos = 0;
+    string line;
+
+    bool open(const char* filename) {
+        file.open(filename, ios::binary);
+        if (!file.is_open()) return false;
+        binary = wire::read_header(file, codec);
+        if (!binary) {
+            file.clear();
+            file.seekg(0);
+        }
+        return true;
+    }
+
+    /**
+     * @brief Reads the next trajectory of the dataset.
+     * @param it The trajectory read
+     * @return bool False at the end of the file
+     */
+    bool next(item& it) {
+        if (!binary) {
+            while (getline(file, line)) {
+                if (line.empty()) continue;
+                it = parseLine(line);
+                return true;
+            }
+            return false;
+        }
+
+        // Keep at least a whole encoded trajectory in the buffer
+        if (buf.size() - pos < wire::MAX_TRAJECTORY_BYTES && file) {
+            buf.erase(buf.begin(), buf.begin() + pos);
+            pos = 0;
+            size_t kept = buf.size();
+            buf.resize(kept + READ_CHUNK);
+            file.read(buf.data() + kept, READ_CHUNK);
+            buf.resize(kept + file.gcount());
+        }
+        if (pos == buf.size()) return false;
+        const char* p = buf.data() + pos;
+        uint64_t id;
+        if (!wire::get_trajectory(p, buf.data() + buf.size(), id, it.dataset, it.content, codec)) {
+            cerr << "Truncated binary dataset file!" << endl;
+            exit(EXIT_FAILURE);
+        }
+        it.id = id;
+        pos = p - buf.data();
+        return true;
+    }
+};
+
+/**
+ * @brief Checks if two curves (trajectories) are similar based on various distance metrics.
+ *
+ * @param c1 The first trajectory
+ * @param c2 The second trajectory
+ * @return bool True if the curves are similar, false otherwise
+ */
+bool similarity_test(const curve& c1, const curve& c2) {
+
+    // Check euclidean distance
+    if (euclideanSqr(c1[0], c2[0]) > SIM_THRESHOLD_SQR || euclideanSqr(c1.back(), c2.back()) > SIM_THRESHOLD_SQR)
+        return false;
+
+    // Check equal time
+    if (equalTime(c1, c2, SIM_THRESHOLD_SQR) || get_frechet_distance_upper_bound(c1, c2) <= SIM_THRESHOLD)
+        return true;
+
+    // Check using negative filter
+    if (negfilter(c1, c2, SIM_THRESHOLD))
+        return false;
+
+    // Full check using Frechet distance
+    if (is_frechet_distance_at_most(c1, c2, SIM_THRESHOLD))
+        return true;
+
+    return false;
+}
+
+/**
+ * @brief Chooses the num of concatenated functions (r) and tables (L) for a target recall.
+ * @details The probability p that a function hashes two similar curves together is estimated on
+ *          sampled trajectories and copies of them with every point moved by up to SIM_THRESHOLD
+ *          (Frechet distance at most SIM_THRESHOLD). A pair then collides in some table with
+ *          probability 1 - (1 - p^r)^L: for each r the smallest L reaching the target is taken, and
+ *          the (r, L) with the fewest candidate pairs, L times the pairs of a table of the dataset, wins.
+ * @param trajectories The trajectories to index
+ * @param recall Target recall
+ * @param r Chosen num of concatenated functions
+ * @param tables Chosen num of tables
+ * @return double The estimated collision probability of a function
+ */
+double chooseAmplification(const vector<lshindex::input_trajectory>& trajectories, double recall, size_t& r, size_t& tables) {
+
+    vector<FrechetLSH> lsh_family(AMPLIFICATION_MAX_R);
+    for (size_t i = 0; i < AMPLIFICATION_MAX_R; i++)
+        lsh_family[i].init(LSH_RESOLUTION, LSH_SEED * i, i);
+
+    // Collision probability of a function for curves at distance up to SIM_THRESHOLD
+    mt19937 rnd(LSH_SEED);
+    uniform_real_distribution<double> unit(0, 1);
+    size_t step = max<size_t>(1, trajectories.size() / AMPLIFICATION_SAMPLES), collisions = 0, trials = 0;
+    for (size_t s = 0; s < trajectories.size(); s += step) {
+        const curve& c = trajectories[s].content;
+        for (size_t j = 0; j < AMPLIFICATION_JITTERS; j++) {
+            curve similar;
+            for (const point& pt : c) {
+                double radius = SIM_THRESHOLD * sqrt(unit(rnd)), angle = 2 * M_PI * unit(rnd);
+                similar.push_back(point(pt.x + radius * cos(angle), pt.y + radius * sin(angle)));
+            }
+            for (FrechetLSH& lsh : lsh_family) {
+                collisions += (lsh.hash(c) == lsh.hash(similar));
+                ++trials;
+            }
+        }
+    }
+    double p = trials ? static_cast<double>(collisions) / trials : 0;
+
+    // Candidate pairs of a table of the dataset with 1 ... AMPLIFICATION_MAX_R concatenated functions
+    vector<unordered_map<int64_t, uint64_t>> buckets(AMPLIFICATION_MAX_R);
+    vector<uint64_t> hashes(AMPLIFICATION_MAX_R);
+    for (const lshindex::input_trajectory& t : trajectories) {
+        for (size_t i = 0; i < AMPLIFICATION_MAX_R; i++) {
+            hashes[i] = lsh_family[i].hash(t.content);
+            ++buckets[i][lshindex::concatenate_key(0, hashes.data(), i + 1)];
+        }
+    }
+
+    double best = INFINITY;
+    r = 1;
+    tables = AMPLIFICATION_MAX_L;
+    for (size_t i = 1; i <= AMPLIFICATION_MAX_R; i++) {
+        double pr = pow(p, i);
+        if (pr <= 0) break;
+        double l = (pr >= 1) ? 1 : ceil(log(1 - recall) / log(1 - pr));
+        if (l > AMPLIFICATION_MAX_L) continue;
+        uint64_t pairs = 0;
+        for (auto& [key, count] : buckets[i - 1])
+            pairs += count * (count - 1) / 2;
+        double cost = l * (pairs + trajectories.size());
+        if (cost < best) {
+            best = cost;
+            r = i;
+            tables = static_cast<size_t>(l);
+        }
+    }
+    return p;
+}
+
+/**
+ * @brief Statistics of the buckets of an index.
+ */
+struct bucketStats {
+    size_t buckets = 0;       // Num of buckets
+    size_t maxSize = 0;       // Trajectories in the largest bucket
+    uint64_t pairs = 0;       // Candidate pairs within the buckets
+};
+
+/**
+ * @brief Builds the index of a reference dataset.
+ * @param inFilename Reference dataset
+ * @param indexFilename Output index file
+ * @param dataset Dataset to index (-1: all the lines)
+ * @param r Num of functions concatenated in each key
+ * @param tables Num of tables
+ * @param recall Target recall choosing r and tables (0: as given)
+ * @param stats Statistics of the buckets
+ * @return size_t Num of indexed trajectories
+ */
+size_t buildIndex(const char* inFilename, const char* indexFilename, int dataset, size_t& r, size_t& tables, double recall, bucketStats& stats) {
+
+    datasetReader reader;
+    if (!reader.open(inFilename)) {
+        cerr << "Error opening dataset file!" << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    // Read the reference dataset
+    vector<lshindex::input_trajectory> trajectories;
+    item it;
+    while (reader.next(it)) {
+        if (dataset >= 0 && it.dataset != dataset) continue;
+        trajectories.push_back({static_cast<int64_t>(it.id), it.dataset, it.content, {}});
+    }
+    if (recall > 0) {
+        double p = chooseAmplification(trajectories, recall, r, tables);
+        cerr << "collision probability " << p << ": r = " << r << ", L = " << tables << ", estimated recall "
+             << 1 - pow(1 - pow(p, r), tables) << endl;
+    }
+
+    // Hash each trajectory with r functions per table
+    vector<FrechetLSH> lsh_family = lshindex::make_family(tables, r, LSH_SEED, LSH_RESOLUTION);
+    unordered_map<int64_t, size_t> buckets;
+    for (lshindex::input_trajectory& t : trajectories) {
+        t.lshs = lshindex::hash_trajectory(lsh_family, r, t.content);
+        for (int64_t key : t.lshs)
+            ++buckets[key];
+    }
+    stats.buckets = buckets.size();
+    for (auto& [key, count] : buckets) {
+        stats.maxSize = max(stats.maxSize, count);
+        stats.pairs += static_cast<uint64_t>(count) * (count - 1) / 2;
+    }
+
+    if (!lshindex::write_index(indexFilename, trajectories, tables, LSH_SEED, LSH_RESOLUTION, r)) {
+        cerr << "Error writing index file!" << endl;
+        exit(EXIT_FAILURE);
+    }
+    return trajectories.size();
+}
+
+/**
+ * @brief Joins a query trajectory with the indexed ones sharing at least one LSH value.
+ * @details A pair is verified only in the bucket of the first LSH function on which
+ *          the two trajectories collide, as checkHelper does in the batch executables.
+ * @param index The memory-mapped index
+ * @param it The query trajectory
+ * @param lshs LSH values of the query trajectory (keysPerFunction for each function)
+ * @param keysPerFunction 1 + num of probes per function
+ * @param candidate Curve buffer for the indexed trajectories
+ */
+void probeIndex(const lshindex::mapped_index& index, const item& it, const vector<int64_t>& lshs, uint32_t keysPerFunction, curve& candidate) {
+
+    index.probe(lshs.data(), keysPerFunction, it.dataset, it.content.front(), it.content.back(), SIM_THRESHOLD_SQR, candidate,
+        [&](uint32_t ref, const curve& c) {
+            if (similarity_test(it.content, c)) {
+                ++foundSimilar;
+#ifdef REPORT_DISTANCE
+                *resultsStream << it.id << "\t" << index.records[ref].id << "\t" << get_frechet_distance_within(it.content, c, SIM_THRESHOLD) << endl;
+#else
+                *resultsStream << it.id << "\t" << index.records[ref].id << endl;
+#endif
+            }
+        });
+}
+
+/**
+ * @brief Ranks the indexed trajectories colliding with a query trajectory and writes the k nearest ones.
+ * @details The k best neighbours are kept in a max-heap: once it is full, its top (the k-th distance)
+ *          is the decision threshold. A candidate is pruned by the endpoints lower bound (also before
+ *          its curve is rebuilt), then by the upper bound or the decision procedure at the threshold;
+ *          the exact distance is computed only for the new neighbours, within the bracket
+ *          [lower bound, min(upper bound, k-th distance)].
+ * @param index The memory-mapped index
+ * @param it The query trajectory
+ * @param lshs LSH values of the query trajectory (keysPerFunction for each function)
+ * @param keysPerFunction 1 + num of probes per function
+ * @param k Num of neighbours
+ * @param candidate Curve buffer for the indexed trajectories
+ */
+void knnIndex(const lshindex::mapped_index& index, const item& it, const vector<int64_t>& lshs, uint32_t keysPerFunction, size_t k, curve& candidate) {
+
+    priority_queue<neighbour_t> best;
+    double kth = INFINITY, kth_sqr = INFINITY;
+    index.probe(lshs.data(), keysPerFunction, it.dataset, it.content.front(), it.content.back(), kth_sqr, candidate,
+        [&](uint32_t ref, const curve& c) {
+            ++knnCandidates;
+
+            // Lower bound: endpoints must be matched
+            double lower = sqrt(max(euclideanSqr(it.content.front(), c.front()), euclideanSqr(it.content.back(), c.back())));
+            if (lower >= kth)
+                return;
+
+            // Upper bound, or decision at the k-th distance when the bound cannot tell
+            double upper = get_frechet_distance_upper_bound(it.content, c);
+            if (upper >= kth) {
+                if (negfilter(it.content, c, kth) || !is_frechet_distance_at_most(it.content, c, kth))
+                    return;
+                upper = kth;
+            }
+
+            ++knnExact;
+            best.push({get_frechet_distance(it.content, c, lower, upper), index.records[ref].id});
+            if (best.size() > k)
+                best.pop();
+            if (best.size() == k) {
+                kth = best.top().distance;
+                kth_sqr = sqr(kth);
+            }
+        });
+
+    // Nearest first
+    vector<neighbour_t> neighbours;
+    for (; !best.empty(); best.pop())
+        neighbours.push_back(best.top());
+    for (auto n = neighbours.rbegin(); n != neighbours.rend(); ++n)
+        *resultsStream << it.id << "\t" << n->id << "\t" << n->distance << endl;
+    foundSimilar += neighbours.size();
+}
+
+/**
+* @brief Main function: builds an index or probes it with a query dataset.
+* @param argc Argument count
+* @param argv Argument values (mode, files)
+* @return int Exit status
+*/
+int main(int argc, char** argv) {
+
+    // Usage description
+    auto usage_and_exit = [argv]() {
+        printf("   use: %s build [-d dataset] [-L tables] [-r functions] [-R recall] inputFile indexFile\n", argv[0]);
+        printf("        %s probe [-k neighbours] [-p probes] indexFile queryFile [outputFile]\n", argv[0]);
+        printf("   inputFile, queryFile -> text lines or binary datasets (LSHSJ_gen -B) \n");
+        printf("   -d dataset    -> index only the trajectories of the given dataset (default: all) \n");
+        printf("   -L tables     -> num of LSH tables of the index (default: %d) \n", LSH_FAMILY_SIZE);
+        printf("   -r functions  -> LSH functions concatenated (AND) in the key of each table (default: 1) \n");
+        printf("   -R recall     -> choose r and L for the target recall (e.g. 0.95) with the fewest candidates \n");
+        printf("   -p probes     -> multi-probe: perturbed hashes of each query looked up in every table (default: 0), \n");
+        printf("                    recall of many tables with a smaller index \n");
+        printf("   -k neighbours -> kNN join: the k nearest indexed trajectories (among the LSH candidates) \n");
+        printf("                    of each query, with their distance, instead of the range join \n\n");
+        exit(EXIT_FAILURE);
+    };
+    if (argc < 2) usage_and_exit();
+
+    const bool build = !strcmp(argv[1], "build");
+    if (!build && strcmp(argv[1], "probe")) usage_and_exit();
+
+    // Optional arguments (after the mode)
+    int dataset = -1;
+    size_t k = 0, tables = LSH_FAMILY_SIZE, r = 1, probes = 0;
+    double recall = 0;
+    int opt;
+    optind = 2;
+    while ((opt = getopt(argc, argv, "d:k:L:r:R:p:")) != -1) {
+        if (opt == 'd') dataset = atoi(optarg);
+        else if (opt == 'k') k = stoul(optarg);
+        else if (opt == 'L') tables = max(1ul, stoul(optarg));
+        else if (opt == 'r') r = max(1ul, stoul(optarg));
+        else if (opt == 'R') recall = min(max(stod(optarg), 0.0), 0.999999);
+        else if (opt == 'p') probes = stoul(optarg);
+        else usage_and_exit();
+    }
+    if (argc - optind < 2) usage_and_exit();
+
+    auto start_time = chrono::steady_clock::now();
+    auto elapsed = [](chrono::steady_clock::time_point since) {
+        return chrono::duration<double>(chrono::steady_clock::now() - since).count();
+    };
+
+    if (build) {
+        bucketStats stats;
+        size_t indexed = buildIndex(argv[optind], argv[optind + 1], dataset, r, tables, recall, stats);
+
+        // Collect results (indexed trajectories, r, L, buckets, largest bucket, candidate pairs in the buckets
+        // and execution time)
+        cout <<
+            argv[0] << "\t" <<
+            "build" << "\t" <<
+            argv[optind] << "\t" <<
+            indexed << "\t" <<
+            r << "\t" <<
+            tables << "\t" <<
+            stats.buckets << "\t" <<
+            stats.maxSize << "\t" <<
+            stats.pairs << "\t" <<
+            elapsed(start_time) <<
+        endl;
+        return 0;
+    }
+
+    // Map the index
+    lshindex::mapped_index index;
+    if (!index.open(argv[optind])) {
+        cerr << "Error opening index file!" << endl;
+        return EXIT_FAILURE;
+    }
+    if (!index.matches(LSH_SEED, LSH_RESOLUTION)) {
+        cerr << "Index built with different LSH parameters!" << endl;
+        return EXIT_FAILURE;
+    }
+
+    // Build LSH function family (as many tables and concatenated functions as the index)
+    r = index.header->concatenation;
+    vector<FrechetLSH> lsh_family = lshindex::make_family(index.header->family_size, r, LSH_SEED, LSH_RESOLUTION);
+    double time_open = elapsed(start_time);
+
+    ofstream filestream;
+    // If output file is provided, open it for writing results
+    if (argc - optind > 2) {
+        filestream = ofstream(argv[optind + 2]);
+        if (filestream.is_open())
+            resultsStream = &filestream;
+    }
+
+    // Open query file
+    datasetReader reader;
+    if (!reader.open(argv[optind + 1])) {
+        cerr << "Error opening dataset file!" << endl;
+        return EXIT_FAILURE;
+    }
+
+    // Probe the index with each query trajectory
+    auto start_time_probe = chrono::steady_clock::now();
+    size_t queries = 0;
+    item it;
+    curve candidate;
+    while (reader.next(it)) {
+        vector<int64_t> lshs = lshindex::hash_trajectory(lsh_family, r, it.content, probes);
+        if (k) knnIndex(index, it, lshs, 1 + r * probes, k, candidate);
+        else probeIndex(index, it, lshs, 1 + r * probes, candidate);
+        ++queries;
+    }
+    double time_probe = elapsed(start_time_probe);
+
+    // Collect outputs (similar pairs or neighbours) and results (index size, queries, similar pairs or neighbours,
+    // [kNN: k, ranked candidates, exact distances], [multi-probe: tables, probes] and execution times)
+    cout <<
+        argv[0] << "\t" <<
+        (k ? "knn" : "probe") << "\t" <<
+        argv[optind + 1] << "\t" <<
+        index.size() << "\t" <<
+        queries << "\t" <<
+        foundSimilar << "\t";
+    if (k)
+        cout <<
+            k << "\t" <<
+            knnCandidates << "\t" <<
+            knnExact << "\t";
+    if (probes)
+        cout <<
+            index.header->family_size << "\t" <<
+            probes << "\t";
+    cout <<
+        time_open << "\t" <<     // time to map the index
+        time_probe << "\t" <<    // time to join the queries
+        elapsed(start_time) <<
+    endl;
+
+    return 0;
+}
@@ -20,6 +20,7 @@
 #include <sys/mman.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <getopt.h>
 
 // Others utilities 
 #include <cstdio>
@@ -35,6 +36,7 @@
 #include <utility>
 #include <algorithm>
 #include <unordered_map>
+#include <bit>
 
 // Message Passing Interface (MPI) lib
 #include <mpi.h>
@@ -44,6 +46,18 @@
 #include "geometry_basics.hpp"
 #include "frechet_distance.hpp"
 
+// Wire format of shuffled trajectories
+#include "trajectory_codec.hpp"
+
+// Join specification (cross, self, all)
+#include "join_spec.hpp"
+
+// Per-phase metrics (LSHSJ_METRICS)
+#include "metrics.hpp"
+
+// Timeline of threads and ranks (LSHSJ_TRACE)
+#include "trace.hpp"
+
 using namespace std;
 
 #define LSH_FAMILY_SIZE 8     // Number of LSH functions
@@ -54,11 +68,59 @@ using namespace std;
 const static double SIM_THRESHOLD = 10;
 const static double SIM_THRESHOLD_SQR = sqr(SIM_THRESHOLD);
 
+// Coordinates codec for shuffled trajectories: raw doubles, or fixed-point deltas (make DELTA=scale)
+#ifdef WIRE_DELTA_SCALE
+const static wire::codec_t WIRE_CODEC{wire::DELTA, WIRE_DELTA_SCALE};
+#else
+const static wire::codec_t WIRE_CODEC = wire::RAW_CODEC;
+#endif
+
+// Shuffle engines (selected at runtime with -s)
+enum shuffle_t { SHUFFLE_ALLTOALLV = 0, SHUFFLE_RMA = 1, SHUFFLE_NODE = 2 };
+const static char* SHUFFLE_NAMES[] = {"alltoallv", "rma", "node"};
+
+// Max bytes moved by a single MPI_Put of the RMA shuffle
+#define RMA_PUT_BYTES (1 << 30)
+
+// Max bytes of a single message between node leaders in the node-aware shuffle
+#define NODE_MSG_BYTES (1 << 30)
+
+// Join strategy: hash-partition both datasets, or replicate the small one and probe it locally 
+enum join_t { JOIN_AUTO = 0, JOIN_SHUFFLE = 1, JOIN_BROADCAST = 2 };
+const static char* JOIN_NAMES[] = {"auto", "shuffle", "broadcast"};
+
+// Auto join mode replicates only datasets at least BROADCAST_MIN_RATIO times smaller than the other one
+#define BROADCAST_MIN_RATIO 4
+
+// Dynamic join: buckets are split in tasks of about 1/JOIN_TASKS_PER_RANK of the average rank cost
+#define JOIN_TASKS_PER_RANK 64
+#define TAG_STEAL_REQ 1
+#define TAG_STEAL_REPLY 2
+#define TAG_JOIN_DONE 3
+#define TAG_JOIN_TERMINATE 4
+
+// Words of a similar pair in the flattened pairs: ids [, bits of the Frechet distance] (make DISTANCE=1)
+#ifdef REPORT_DISTANCE
+#define PAIR_WORDS 3
+#else
+#define PAIR_WORDS 2
+#endif
+
 size_t foundSimilar = 0; 
 size_t foundSimilarTot; 
 vector<long> simPairs; 
 vector<long> simPairsTot; 
 
+// Multi-threshold join (-t): sorted thresholds, bucketed once at the resolution of the largest one;
+// each similar pair is tagged with the smallest threshold it satisfies (an extra word when more than one)
+vector<double> thresholds{SIM_THRESHOLD}; 
+double lshResolution = LSH_RESOLUTION; 
+size_t pairWords = PAIR_WORDS; 
+vector<unsigned long> foundSimilarLevel(1, 0); 
+
+// Pairs of a bucket to verify (-j): cross (default), self or all, optionally restricted to some datasets
+joinspec::join_spec spec; 
+
 struct item {
     size_t id;      // Unique identifier 
     int dataset;    // Dataset identifier
@@ -67,19 +129,65 @@ struct item {
 
 struct element_t {
     
-    long LSH;           // LSH values           
     int dataSet;        // Dataset identifier
     curve trajectory;   // Curve representing the trajectory
     array<long, LSH_FAMILY_SIZE> relativeLSHs; // LSH values for the LSH function 
     long id;            // Unique identifier 
+    uint32_t bucketMask; // Positions of relativeLSHs whose bucket lives on the destination rank
     
     // Constructor
     element_t() = default;
-    element_t(long hash, int dataset, curve trajectory, decltype(relativeLSHs) relativeLSHs, long id)
-        : LSH(hash), dataSet(dataset), trajectory(trajectory), relativeLSHs(relativeLSHs), id(id) {}
+    element_t(int dataset, curve trajectory, decltype(relativeLSHs) relativeLSHs, long id, uint32_t bucketMask)
+        : dataSet(dataset), trajectory(trajectory), relativeLSHs(relativeLSHs), id(id), bucketMask(bucketMask) {}
     
 };
 
+static_assert(LSH_FAMILY_SIZE <= 32, "bucketMask holds one bit per LSH function");
+
+// Elements received by a process: each trajectory is stored once and 
+// every LSH bucket references it by its position in the elements vector
+struct bucketIndex {
+    vector<element_t> elements; 
+    unordered_map<long, vector<uint32_t>> buckets; 
+};
+
+void insertElement(bucketIndex& index, const element_t& elem) {
+
+    // Rebuild bucket membership of a received trajectory
+    uint32_t ref = static_cast<uint32_t>(index.elements.size()); 
+    index.elements.push_back(elem); 
+    for (size_t i = 0; i < LSH_FAMILY_SIZE; ++i) {
+        if (elem.bucketMask & (1u << i)) {
+            index.buckets[elem.relativeLSHs[i]].push_back(ref); 
+        }
+    }
+}
+
+// Upper bound on the bytes written by packElement
+constexpr size_t MAX_ELEMENT_BYTES = wire::MAX_TRAJECTORY_BYTES + (LSH_FAMILY_SIZE + 1) * wire::MAX_VARINT_BYTES; 
+
+void packElement(vector<char>& buffer, const element_t& elem) {
+
+    // Only the points of the trajectory are sent, prefix lengths are rebuilt on unpack
+    wire::put_trajectory(buffer, elem.id, elem.dataSet, elem.trajectory, WIRE_CODEC); 
+    for (long h : elem.relativeLSHs) {
+        wire::put_varint(buffer, h); 
+    }
+    wire::put_varint(buffer, elem.bucketMask); 
+}
+
+const char* unpackElement(const char* p, element_t& elem) {
+
+    uint64_t id; 
+    wire::get_trajectory(p, id, elem.dataSet, elem.trajectory, WIRE_CODEC); 
+    elem.id = static_cast<long>(id); 
+    for (long& h : elem.relativeLSHs) {
+        h = static_cast<long>(wire::get_varint(p)); 
+    }
+    elem.bucketMask = static_cast<uint32_t>(wire::get_varint(p)); 
+    return p; 
+}
+
 item parseLine(string& line) {
 
     // Parse a line of the input dataset as an item 
@@ -113,29 +221,62 @@ item parseLine(string& line) {
     return output;
 }
 
-bool similarity_test(const curve& c1, const curve& c2) {
+bool similarity_test(const curve& c1, const curve& c2, double threshold) {
 
     // Similarity test heuristsic 
 
-    if (euclideanSqr(c1[0], c2[0]) > SIM_THRESHOLD_SQR || euclideanSqr(c1.back(), c2.back()) > SIM_THRESHOLD_SQR) 
-        return false;
-    if (equalTime(c1, c2, SIM_THRESHOLD_SQR) || get_frechet_distance_upper_bound(c1, c2) <= SIM_THRESHOLD)
+    if (equalTime(c1, c2, sqr(threshold)))
         return true;
-    if (negfilter(c1, c2, SIM_THRESHOLD))
+    if (negfilter(c1, c2, threshold))
         return false;
-    if (is_frechet_distance_at_most(c1, c2, SIM_THRESHOLD))
+    if (is_frechet_distance_at_most(c1, c2, threshold))
         return true;
     return false;
 }
 
+size_t similarity_level(const curve& c1, const curve& c2) {
+
+    // Thresholds below the endpoints distance (lower bound) are not satisfied
+    double endpointsSqr = max(euclideanSqr(c1[0], c2[0]), euclideanSqr(c1.back(), c2.back())); 
+    size_t lo = 0, hi = thresholds.size(); 
+    while (lo < hi && endpointsSqr > sqr(thresholds[lo])) ++lo; 
+    if (lo == hi) 
+        return hi; 
+
+    // Thresholds above the upper bound are satisfied
+    double upper = get_frechet_distance_upper_bound(c1, c2); 
+    while (hi > lo && upper <= thresholds[hi - 1]) --hi; 
+
+    // Satisfied thresholds are a suffix: binary search the undecided ones with the full test
+    size_t first = thresholds.size(); 
+    if (hi < thresholds.size()) first = hi; 
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2; 
+        if (similarity_test(c1, c2, thresholds[mid])) {
+            first = mid; 
+            hi = mid; 
+        } else {
+            lo = mid + 1; 
+        }
+    }
+    return first; 
+}
+
 void checkHelper(const long lsh, const element_t& a, const element_t& b) {
 
     for (size_t ii = 0; ii < a.relativeLSHs.size(); ii++) {
         if (a.relativeLSHs[ii] == b.relativeLSHs[ii]) {
             if (lsh == a.relativeLSHs[ii]) {
-                if (similarity_test(a.trajectory, b.trajectory)) {
+                metrics::count(metrics::CANDIDATES);
+                size_t level = similarity_level(a.trajectory, b.trajectory); 
+                if (level < thresholds.size()) {
                     simPairs.push_back(a.id);
-                    simPairs.push_back(b.id); 
+                    simPairs.push_back(b.id);
+#ifdef REPORT_DISTANCE
+                    simPairs.push_back(bit_cast<long>(get_frechet_distance_within(a.trajectory, b.trajectory, thresholds[level])));
+#endif
+                    if (thresholds.size() > 1) simPairs.push_back(level); 
+                    ++foundSimilarLevel[level]; 
                     ++foundSimilar;
                 }
             }
@@ -144,10 +285,45 @@ void checkHelper(const long lsh, const element_t& a, const element_t& b) {
     }
 }
 
+int datasetOfLine(const char* line, size_t bytes) {
+
+    // Dataset identifier is the second field of a line 
+    size_t i = 0; 
+    while (i < bytes && !isspace(line[i])) ++i; 
+    while (i < bytes && isspace(line[i])) ++i; 
+    int dataset = 0; 
+    bool negative = i < bytes && line[i] == '-'; 
+    if (negative) ++i; 
+    while (i < bytes && isdigit(line[i])) dataset = dataset * 10 + (line[i++] - '0'); 
+    return negative ? -dataset : dataset; 
+}
+
+int chooseBroadcastDataset(int size, join_t join, const map<int, pair<uint64_t, uint64_t>>& datasets) {
+
+    // Replication needs exactly two datasets: pairs within the large one are never joined
+    if (join == JOIN_SHUFFLE || spec.mode != joinspec::CROSS || datasets.size() != 2) return -1; 
+    auto small = datasets.begin(), large = next(small); 
+    if (large->second.first < small->second.first) swap(small, large); 
+
+    // Replicated bytes must fit in a single collective 
+    uint64_t small_lines = small->second.first, small_bytes = small->second.second; 
+    if (small_bytes > static_cast<uint64_t>(numeric_limits<int>::max()) / 2) return -1; 
+    if (join == JOIN_BROADCAST) return small->first; 
+
+    // Shuffle ships every trajectory to up to LSH_FAMILY_SIZE ranks, broadcast ships the small side to all ranks: 
+    // replicate only strongly asymmetric inputs (balanced ones keep the shuffle at any num of ranks), and only if 
+    // the small side is not larger than the share of input of a rank, so that it also costs less traffic and 
+    // at most doubles the memory of a rank 
+    uint64_t large_lines = large->second.first, tot_lines = small_lines + large_lines; 
+    if (small_lines * BROADCAST_MIN_RATIO > large_lines) return -1; 
+    return small_lines * size <= tot_lines ? small->first : -1; 
+}
+
 void init_infile_batch (
     MPI_Comm comm, int size, int rank, 
     const char* inFileMapped, const size_t& inFileBytes, 
-    vector<int>& charsPerLines, vector<int>& lines_counts, vector<int>& chars_counts, int& reps ){
+    vector<int>& charsPerLines, vector<int>& lines_counts, vector<int>& chars_counts, int& reps, 
+    join_t join, int& broadcastDataset ){
 
     // Use only root-process 
     if (!rank) {
@@ -188,6 +364,19 @@ void init_infile_batch (
 
         // Final number of input file partition required
         reps = chars_counts.size(); 
+
+        // Lines and bytes per dataset, to choose the join strategy 
+        map<int, pair<uint64_t, uint64_t>> datasets; 
+        size_t offset = 0; 
+        for (int chars : charsPerLines) {
+            int dataset = datasetOfLine(inFileMapped + offset, chars); 
+            offset += chars; 
+            if (!spec.accepts(dataset)) continue; 
+            auto& [lines, bytes] = datasets[dataset]; 
+            ++lines; 
+            bytes += chars; 
+        }
+        broadcastDataset = chooseBroadcastDataset(size, join, datasets); 
     }
 
     // Broadcast to other process the computed informations
@@ -197,6 +386,7 @@ void init_infile_batch (
     chars_counts.resize(reps); 
     MPI_Bcast(lines_counts.data(), reps, MPI_INT, 0, comm); 
     MPI_Bcast(chars_counts.data(), reps, MPI_INT, 0, comm);
+    MPI_Bcast(&broadcastDataset, 1, MPI_INT, 0, comm); 
     
     return; 
 }
@@ -230,11 +420,13 @@ stringstream distributeChunks(MPI_Comm comm, int size, int rank, size_t start_li
     }
 
     // Scatter to each process the num of chars they will receive
+    trace::span scatter("MPI_Scatter", "mpi"); 
     MPI_Scatter(
         counts_send.data(), 1, MPI_INT,
         &counts_recv, 1, MPI_INT, 
         0, comm
     );
+    scatter.stop(); 
     
     // Get InFileMapped displacement (for the current input file partition) 
     const char* inFileMapped_displ = &inFileMapped[start_byte];
@@ -243,11 +435,13 @@ stringstream distributeChunks(MPI_Comm comm, int size, int rank, size_t start_li
     vector<char> chunkBuffer (counts_recv); 
     
     // Scatter chunk of input file (chars) to other process 
+    trace::span scatterv("MPI_Scatterv", "mpi", counts_recv); 
     MPI_Scatterv(
         inFileMapped_displ, counts_send.data(), displs_send.data(), MPI_CHAR,
         chunkBuffer.data(), counts_recv, MPI_CHAR, 
         0, comm
     );
+    scatterv.stop(); 
 
     // write to stringstream 
     chunk.write(chunkBuffer.data(), counts_recv); 
@@ -257,10 +451,12 @@ stringstream distributeChunks(MPI_Comm comm, int size, int rank, size_t start_li
 
 vector<vector<element_t>> mapPhase (int size, int rank, stringstream& chunk, int& numLines){
 
+    trace::span tracing("map chunk", "map", numLines); 
+
     // Build LSH function family
     FrechetLSH lsh_family[LSH_FAMILY_SIZE];
     for (size_t i = 0; i < LSH_FAMILY_SIZE; i++){
-        lsh_family[i].init(LSH_RESOLUTION, LSH_SEED * i, i);
+        lsh_family[i].init(lshResolution, LSH_SEED * i, i);
     }
     
     // Final vector of elements aggregated by destination rank
@@ -276,19 +472,39 @@ vector<vector<element_t>> mapPhase (int size, int rank, stringstream& chunk, int
     string line; 
     while(getline(chunk, line)){
 
-        // Parse a line 
+        // Parse a line (only datasets of the join specification)
+        metrics::scope parsing(metrics::PARSE); 
+        metrics::count(metrics::LINES); 
         item it = parseLine(line); 
+        parsing.stop(); 
+        if (!spec.accepts(it.dataset)) continue; 
         
         // Compute LSH values for each LSH function
+        metrics::scope hashing(metrics::HASH); 
         array<long, LSH_FAMILY_SIZE> relative_lshs;
         for (size_t i = 0; i < LSH_FAMILY_SIZE; i++){
             relative_lshs[i] = lsh_family[i].hash(it.content);
         }
+        metrics::count(metrics::ELEMENTS, LSH_FAMILY_SIZE); 
+
+        // Group LSH values by destination rank 
+        int out_ranks[LSH_FAMILY_SIZE]; 
+        uint32_t out_masks[LSH_FAMILY_SIZE]; 
+        int num_out = 0; 
+        for (size_t i = 0; i < LSH_FAMILY_SIZE; i++){
+            int out_rank = relative_lshs[i] % size; 
+            int j = 0; 
+            while (j < num_out && out_ranks[j] != out_rank) ++j; 
+            if (j == num_out) {
+                out_ranks[num_out] = out_rank; 
+                out_masks[num_out++] = 0; 
+            }
+            out_masks[j] |= 1u << i; 
+        }
 
-        // Populate vector of elements 
-        for (long h : relative_lshs){
-            int out_rank = h % size; 
-            elements[out_rank].emplace_back(h, it.dataset, it.content, relative_lshs, it.id);
+        // Populate vector of elements: one copy of the trajectory per destination rank
+        for (int j = 0; j < num_out; j++){
+            elements[out_ranks[j]].emplace_back(it.dataset, it.content, relative_lshs, it.id, out_masks[j]);
         }
     }
 
@@ -299,14 +515,55 @@ vector<vector<element_t>> mapPhase (int size, int rank, stringstream& chunk, int
     return elements; 
 }
 
-void shufflePhase(MPI_Comm comm, int size, int rank, vector<vector<element_t>>& elements, unordered_map<long, vector<element_t>>& umap) {
+void mapPhaseBroadcast (stringstream& chunk, int broadcastDataset, vector<char>& buildBuffer, vector<element_t>& probeSide){
+
+    trace::span tracing("map chunk", "map"); 
+
+    // Build LSH function family
+    FrechetLSH lsh_family[LSH_FAMILY_SIZE];
+    for (size_t i = 0; i < LSH_FAMILY_SIZE; i++){
+        lsh_family[i].init(lshResolution, LSH_SEED * i, i);
+    }
+    const uint32_t allBuckets = (LSH_FAMILY_SIZE == 32) ? ~0u : (1u << LSH_FAMILY_SIZE) - 1; 
+
+    // Iterate chunk line-by-line
+    string line; 
+    while(getline(chunk, line)){
+
+        // Parse a line and compute LSH values for each LSH function
+        metrics::scope parsing(metrics::PARSE); 
+        metrics::count(metrics::LINES); 
+        item it = parseLine(line); 
+        parsing.stop(); 
+        if (!spec.accepts(it.dataset)) continue; 
+        metrics::scope hashing(metrics::HASH); 
+        array<long, LSH_FAMILY_SIZE> relative_lshs;
+        for (size_t i = 0; i < LSH_FAMILY_SIZE; i++){
+            relative_lshs[i] = lsh_family[i].hash(it.content);
+        }
+        metrics::count(metrics::ELEMENTS, LSH_FAMILY_SIZE); 
+
+        // Small side is packed for replication, large side stays on this rank 
+        if (it.dataset == broadcastDataset) {
+            packElement(buildBuffer, element_t(it.dataset, it.content, relative_lshs, it.id, allBuckets)); 
+        } else {
+            probeSide.emplace_back(it.dataset, it.content, relative_lshs, it.id, allBuckets); 
+        }
+    }
+
+    // Free memory of chunk
+    chunk.str(""); 
+    chunk.clear(); 
+}
+
+void shufflePhase(MPI_Comm comm, int size, int rank, vector<vector<element_t>>& elements, bucketIndex& umap) {
     
     vector<size_t> start_idx(size, 0);
     vector<size_t> end_idx(size);
 
     int byte_limit = numeric_limits<int>::max();
     int byte_limit_per_rank = byte_limit / size;
-    int num_elem_per_rank = byte_limit_per_rank / static_cast<int>(sizeof(element_t));
+    size_t pack_limit_per_rank = byte_limit_per_rank - MAX_ELEMENT_BYTES;
 
     while (true) {
         int local_rep = 0, global_rep;
@@ -318,10 +575,13 @@ void shufflePhase(MPI_Comm comm, int size, int rank, vector<vector<element_t>>&
                 break;
             }
         }
+        trace::span allreduce("MPI_Allreduce", "mpi"); 
         MPI_Allreduce(&local_rep, &global_rep, 1, MPI_INT, MPI_LOR, comm);
+        allreduce.stop(); 
 
         // Stop if no more data to process
         if (!global_rep) break;
+        trace::span batch("shuffle batch", "shuffle"); 
 
         vector<char> sendBuffer;
         sendBuffer.reserve(byte_limit);
@@ -332,12 +592,11 @@ void shufflePhase(MPI_Comm comm, int size, int rank, vector<vector<element_t>>&
         // Pack data into sendBuffer
         for (size_t i = 0; i < size; ++i) {
             int prev_size = sendBuffer.size();
-            size_t num_elements_to_send = min(elements[i].size(), static_cast<size_t>(num_elem_per_rank));
+            size_t num_elements_to_send = 0;
 
-            for (size_t j = 0; j < num_elements_to_send; ++j) {
-                element_t& elem = elements[i][j];
-                sendBuffer.resize(sendBuffer.size() + sizeof(element_t));
-                memcpy(sendBuffer.data() + sendBuffer.size() - sizeof(element_t), &elem, sizeof(element_t));
+            // Pack elements until the per-rank byte limit could be exceeded
+            while (num_elements_to_send < elements[i].size() && sendBuffer.size() - prev_size <= pack_limit_per_rank) {
+                packElement(sendBuffer, elements[i][num_elements_to_send++]);
             }
             start_idx[i] += num_elements_to_send;
             sendCounts[i] = sendBuffer.size() - prev_size;
@@ -349,7 +608,9 @@ void shufflePhase(MPI_Comm comm, int size, int rank, vector<vector<element_t>>&
         }
  
         // Exchange counts
+        trace::span alltoall("MPI_Alltoall", "mpi"); 
         MPI_Alltoall(sendCounts.data(), 1, MPI_INT, recvCounts.data(), 1, MPI_INT, comm);
+        alltoall.stop(); 
 
         // Calculate recv displacements and total receive size
         int recv_size = 0;
@@ -360,18 +621,21 @@ void shufflePhase(MPI_Comm comm, int size, int rank, vector<vector<element_t>>&
 
         // Exchange data
         vector<char> recvBuffer(recv_size);
+        trace::span alltoallv("MPI_Alltoallv", "mpi", sendBuffer.size()); 
         MPI_Alltoallv(
             sendBuffer.data(), sendCounts.data(), sendDispls.data(), MPI_CHAR,
             recvBuffer.data(), recvCounts.data(), recvDispls.data(), MPI_CHAR,
             comm
         );
+        alltoallv.stop(); 
 
         // Unpack received data into umap
-        int num_elements = recv_size / static_cast<int>(sizeof(element_t));
-        for (int j = 0; j < num_elements; ++j) {
+        const char* recvPtr = recvBuffer.data();
+        const char* recvEnd = recvPtr + recv_size;
+        while (recvPtr < recvEnd) {
             element_t elem;
-            memcpy(&elem, recvBuffer.data() + j * sizeof(element_t), sizeof(element_t));
-            umap[elem.LSH].push_back(elem);
+            recvPtr = unpackElement(recvPtr, elem);
+            insertElement(umap, elem);
         }
     }
 
@@ -384,10 +648,298 @@ void shufflePhase(MPI_Comm comm, int size, int rank, vector<vector<element_t>>&
     elements.shrink_to_fit();
 }
 
-unordered_map<long, vector<element_t>> process_in_batch(MPI_Comm comm, int size, int rank, const char* inFileMapped, const size_t& inFileBytes, double& time_distr){
+void shufflePhaseRMA(MPI_Comm comm, int size, int rank, vector<vector<element_t>>& elements, bucketIndex& umap) {
+
+    // Pack elements for each destination rank and free their memory
+    vector<vector<char>> sendBuffers(size); 
+    vector<uint64_t> sendBytes(size), recvBytes(size); 
+    for (int i = 0; i < size; ++i) {
+        for (const element_t& elem : elements[i]) {
+            packElement(sendBuffers[i], elem); 
+        }
+        sendBytes[i] = sendBuffers[i].size(); 
+        elements[i].clear(); 
+        elements[i].shrink_to_fit(); 
+    }
+
+    // Exchange per-destination byte counts
+    MPI_Alltoall(sendBytes.data(), 1, MPI_UINT64_T, recvBytes.data(), 1, MPI_UINT64_T, comm); 
+    uint64_t recv_size = 0; 
+    for (int i = 0; i < size; ++i) {
+        recv_size += recvBytes[i]; 
+    }
+
+    // Expose a receive window sized for all incoming records and 
+    // a counter of the bytes already reserved in it by the senders 
+    char* recvWindow; 
+    uint64_t* reserved; 
+    MPI_Win win, counterWin; 
+    MPI_Win_allocate(recv_size, 1, MPI_INFO_NULL, comm, &recvWindow, &win); 
+    MPI_Win_allocate(sizeof(uint64_t), sizeof(uint64_t), MPI_INFO_NULL, comm, &reserved, &counterWin); 
+    *reserved = 0; 
+    MPI_Barrier(comm); 
+
+    MPI_Win_lock_all(0, counterWin); 
+    MPI_Win_lock_all(0, win); 
+
+    // Reserve a region in each target window and put packed records there, 
+    // starting from the next rank to spread the traffic over targets
+    for (int k = 1; k <= size; ++k) {
+        int dest = (rank + k) % size; 
+        uint64_t bytes = sendBytes[dest]; 
+        if (!bytes) continue; 
+
+        uint64_t offset; 
+        MPI_Fetch_and_op(&bytes, &offset, MPI_UINT64_T, dest, 0, MPI_SUM, counterWin); 
+        MPI_Win_flush(dest, counterWin); 
+
+        for (uint64_t done = 0; done < bytes; done += RMA_PUT_BYTES) {
+            int count = static_cast<int>(min<uint64_t>(bytes - done, RMA_PUT_BYTES)); 
+            MPI_Put(
+                sendBuffers[dest].data() + done, count, MPI_CHAR, 
+                dest, offset + done, count, MPI_CHAR, win
+            ); 
+        }
+    }
+
+    // Complete all puts, then wait for every other rank to complete theirs
+    MPI_Win_flush_all(win); 
+    MPI_Win_unlock_all(counterWin); 
+    sendBuffers.clear(); 
+    MPI_Barrier(comm); 
+    MPI_Win_sync(win); 
+
+    // Unpack received data into umap
+    const char* recvPtr = recvWindow; 
+    const char* recvEnd = recvPtr + recv_size; 
+    while (recvPtr < recvEnd) {
+        element_t elem; 
+        recvPtr = unpackElement(recvPtr, elem); 
+        insertElement(umap, elem); 
+    }
+
+    MPI_Win_unlock_all(win); 
+    MPI_Win_free(&win); 
+    MPI_Win_free(&counterWin); 
+}
+
+void unpackRange(const char* recvPtr, uint64_t bytes, bucketIndex& umap) {
+
+    // Unpack a contiguous range of packed records into umap
+    const char* recvEnd = recvPtr + bytes; 
+    while (recvPtr < recvEnd) {
+        element_t elem; 
+        recvPtr = unpackElement(recvPtr, elem); 
+        insertElement(umap, elem); 
+    }
+}
+
+void broadcastPhase(MPI_Comm comm, int size, int rank, vector<char>& buildBuffer, bucketIndex& umap) {
+
+    // Exchange counts
+    int sendCount = buildBuffer.size(); 
+    vector<int> recvCounts(size), recvDispls(size, 0); 
+    MPI_Allgather(&sendCount, 1, MPI_INT, recvCounts.data(), 1, MPI_INT, comm); 
+    size_t recv_size = 0; 
+    for (int i = 0; i < size; ++i) {
+        recvDispls[i] = (i == 0) ? 0 : recvDispls[i - 1] + recvCounts[i - 1]; 
+        recv_size += recvCounts[i]; 
+    }
+
+    // Replicate the small side on every rank and build its bucket index 
+    vector<char> recvBuffer(recv_size); 
+    trace::span allgatherv("MPI_Allgatherv", "mpi", sendCount); 
+    MPI_Allgatherv(
+        buildBuffer.data(), sendCount, MPI_CHAR, 
+        recvBuffer.data(), recvCounts.data(), recvDispls.data(), MPI_CHAR, 
+        comm
+    ); 
+    allgatherv.stop(); 
+    vector<char>().swap(buildBuffer); 
+    unpackRange(recvBuffer.data(), recv_size, umap); 
+}
+
+void shufflePhaseNode(MPI_Comm comm, int size, int rank, vector<vector<element_t>>& elements, bucketIndex& umap) {
+
+    // Processes sharing memory (same node) and one leader process per node
+    MPI_Comm nodeComm, leaderComm; 
+    int localRank, localSize; 
+    MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &nodeComm); 
+    MPI_Comm_rank(nodeComm, &localRank); 
+    MPI_Comm_size(nodeComm, &localSize); 
+    MPI_Comm_split(comm, localRank == 0 ? 0 : MPI_UNDEFINED, rank, &leaderComm); 
+
+    // Node index and local rank of every process
+    int node, numNodes; 
+    if (!localRank) {
+        MPI_Comm_rank(leaderComm, &node); 
+        MPI_Comm_size(leaderComm, &numNodes); 
+    }
+    MPI_Bcast(&node, 1, MPI_INT, 0, nodeComm); 
+    MPI_Bcast(&numNodes, 1, MPI_INT, 0, nodeComm); 
+    int location[2] = {node, localRank}; 
+    vector<int> locations(2 * size); 
+    MPI_Allgather(location, 2, MPI_INT, locations.data(), 2, MPI_INT, comm); 
+    vector<vector<int>> nodeRanks(numNodes); 
+    for (int r = 0; r < size; ++r) {
+        vector<int>& ranks = nodeRanks[locations[2 * r]]; 
+        if (ranks.size() <= static_cast<size_t>(locations[2 * r + 1])) ranks.resize(locations[2 * r + 1] + 1); 
+        ranks[locations[2 * r + 1]] = r; 
+    }
+
+    // Pack elements for each destination rank and free their memory
+    vector<vector<char>> sendBuffers(size); 
+    vector<uint64_t> sendBytes(size); 
+    uint64_t send_size = 0; 
+    for (int i = 0; i < size; ++i) {
+        for (const element_t& elem : elements[i]) {
+            packElement(sendBuffers[i], elem); 
+        }
+        sendBytes[i] = sendBuffers[i].size(); 
+        send_size += sendBytes[i]; 
+        elements[i].clear(); 
+        elements[i].shrink_to_fit(); 
+    }
+
+    // Merge outgoing data of the node in a shared-memory window, ordered by destination rank
+    char* sendSegment; 
+    MPI_Win sendWin; 
+    MPI_Win_allocate_shared(send_size, 1, MPI_INFO_NULL, nodeComm, &sendSegment, &sendWin); 
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, sendWin); 
+    uint64_t offset = 0; 
+    for (int i = 0; i < size; ++i) {
+        memcpy(sendSegment + offset, sendBuffers[i].data(), sendBytes[i]); 
+        offset += sendBytes[i]; 
+    }
+    sendBuffers.clear(); 
+
+    // Per-destination byte counts of every local process
+    vector<uint64_t> localBytes(localSize * size); 
+    MPI_Allgather(sendBytes.data(), size, MPI_UINT64_T, localBytes.data(), size, MPI_UINT64_T, nodeComm); 
+    MPI_Win_sync(sendWin); 
+    MPI_Barrier(nodeComm); 
+    MPI_Win_sync(sendWin); 
+
+    // Address of the data sent by local process s to rank d 
+    vector<const char*> localSegments(localSize); 
+    for (int s = 0; s < localSize; ++s) {
+        MPI_Aint segment_size; 
+        int disp_unit; 
+        char* base; 
+        MPI_Win_shared_query(sendWin, s, &segment_size, &disp_unit, &base); 
+        localSegments[s] = base; 
+    }
+    auto sentData = [&](int s, int d) {
+        const uint64_t* bytes = &localBytes[s * size]; 
+        uint64_t displ = 0; 
+        for (int i = 0; i < d; ++i) displ += bytes[i]; 
+        return localSegments[s] + displ; 
+    }; 
+
+    // Inter-node exchange between leaders: a node sends to each other node, for each of its 
+    // ranks in local order, the data of all local processes; received data is written in a 
+    // shared-memory window of the leader, ordered by source node and then by destination rank
+    char* recvSegment; 
+    MPI_Win recvWin; 
+    vector<uint64_t> recvTable(numNodes * localSize, 0);  // Bytes from each node to each local rank
+    uint64_t recv_size = 0; 
+    vector<uint64_t> sendTable; 
+    if (!localRank) {
+        for (int n = 0; n < numNodes; ++n) {
+            for (int d : nodeRanks[n]) {
+                uint64_t bytes = 0; 
+                for (int s = 0; s < localSize; ++s) bytes += (n == node) ? 0 : localBytes[s * size + d]; 
+                sendTable.push_back(bytes); 
+            }
+        }
+        vector<int> tableCounts(numNodes), tableDispls(numNodes), recvCounts(numNodes, localSize), recvDispls(numNodes); 
+        for (int n = 0; n < numNodes; ++n) {
+            tableCounts[n] = nodeRanks[n].size(); 
+            tableDispls[n] = (n == 0) ? 0 : tableDispls[n - 1] + tableCounts[n - 1]; 
+            recvDispls[n] = n * localSize; 
+        }
+        MPI_Alltoallv(
+            sendTable.data(), tableCounts.data(), tableDispls.data(), MPI_UINT64_T, 
+            recvTable.data(), recvCounts.data(), recvDispls.data(), MPI_UINT64_T, 
+            leaderComm
+        ); 
+        for (uint64_t bytes : recvTable) recv_size += bytes; 
+    }
+    MPI_Win_allocate_shared(recv_size, 1, MPI_INFO_NULL, nodeComm, &recvSegment, &recvWin); 
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, recvWin); 
+
+    if (!localRank) {
+        vector<MPI_Request> requests; 
+        vector<vector<char>> payloads(numNodes); 
+        uint64_t recv_offset = 0; 
+        for (int n = 0; n < numNodes; ++n) {
+            uint64_t recv_bytes = 0; 
+            for (int d = 0; d < localSize; ++d) recv_bytes += recvTable[n * localSize + d]; 
+            if (n == node) continue; 
+
+            // Gather straight from the shared outgoing data of the local processes
+            for (int d : nodeRanks[n]) {
+                for (int s = 0; s < localSize; ++s) {
+                    payloads[n].insert(payloads[n].end(), sentData(s, d), sentData(s, d) + localBytes[s * size + d]); 
+                }
+            }
+            for (uint64_t done = 0; done < payloads[n].size(); done += NODE_MSG_BYTES) {
+                requests.emplace_back(); 
+                int count = static_cast<int>(min<uint64_t>(payloads[n].size() - done, NODE_MSG_BYTES)); 
+                MPI_Isend(payloads[n].data() + done, count, MPI_CHAR, n, 0, leaderComm, &requests.back()); 
+            }
+            for (uint64_t done = 0; done < recv_bytes; done += NODE_MSG_BYTES) {
+                requests.emplace_back(); 
+                int count = static_cast<int>(min<uint64_t>(recv_bytes - done, NODE_MSG_BYTES)); 
+                MPI_Irecv(recvSegment + recv_offset + done, count, MPI_CHAR, n, 0, leaderComm, &requests.back()); 
+            }
+            recv_offset += recv_bytes; 
+        }
+        MPI_Waitall(requests.size(), requests.data(), MPI_STATUSES_IGNORE); 
+    }
+
+    // Local peers read what they received straight from the shared windows
+    MPI_Bcast(recvTable.data(), recvTable.size(), MPI_UINT64_T, 0, nodeComm); 
+    MPI_Win_sync(recvWin); 
+    MPI_Barrier(nodeComm); 
+    MPI_Win_sync(recvWin); 
+
+    for (int s = 0; s < localSize; ++s) {
+        unpackRange(sentData(s, rank), localBytes[s * size + rank], umap); 
+    }
+    const char* leaderSegment; 
+    {
+        MPI_Aint segment_size; 
+        int disp_unit; 
+        char* base; 
+        MPI_Win_shared_query(recvWin, 0, &segment_size, &disp_unit, &base); 
+        leaderSegment = base; 
+    }
+    uint64_t recv_offset = 0; 
+    for (int n = 0; n < numNodes; ++n) {
+        for (int d = 0; d < localSize; ++d) {
+            if (d == localRank) {
+                unpackRange(leaderSegment + recv_offset, recvTable[n * localSize + d], umap); 
+            }
+            recv_offset += recvTable[n * localSize + d]; 
+        }
+    }
+
+    // Free shared windows and communicators
+    MPI_Win_unlock_all(sendWin); 
+    MPI_Win_unlock_all(recvWin); 
+    MPI_Win_free(&sendWin); 
+    MPI_Win_free(&recvWin); 
+    if (leaderComm != MPI_COMM_NULL) {
+        MPI_Comm_free(&leaderComm); 
+    }
+    MPI_Comm_free(&nodeComm); 
+}
+
+bucketIndex process_in_batch(MPI_Comm comm, int size, int rank, const char* inFileMapped, const size_t& inFileBytes, shuffle_t shuffle, join_t join, int& broadcastDataset, vector<element_t>& probeSide, double& time_distr, double& time_shuffle){
 
     // Final map of elements for each process 
-    unordered_map<long, vector<element_t>> umap; 
+    bucketIndex umap; 
 
     MPI_Barrier(comm); 
     double start_time_batch = MPI_Wtime(); 
@@ -404,8 +956,10 @@ unordered_map<long, vector<element_t>> process_in_batch(MPI_Comm comm, int size,
     init_infile_batch(
         comm, size, rank, 
         inFileMapped, inFileBytes, 
-        charsPerLines, lines_counts, chars_counts, reps
+        charsPerLines, lines_counts, chars_counts, reps, 
+        join, broadcastDataset
     ); 
+    vector<char> buildBuffer;   // Packed elements of the small dataset (broadcast join)
 
     MPI_Barrier(comm); 
     double end_time_batch = MPI_Wtime(); 
@@ -423,39 +977,357 @@ unordered_map<long, vector<element_t>> process_in_batch(MPI_Comm comm, int size,
         double end_time_distr_r = MPI_Wtime(); 
         double time_distr_r = end_time_distr_r - start_time_distr_r; 
 
+        // Broadcast join: no shuffle, the small side is replicated after the last partition 
+        if (broadcastDataset >= 0) {
+            metrics::counters mapping(metrics::HW_MAP); 
+            mapPhaseBroadcast(chunk, broadcastDataset, buildBuffer, probeSide); 
+            mapping.stop(); 
+            start_byte += static_cast<size_t>(chars_counts[r]);
+            start_line += numLines; 
+            time_distr += time_distr_r; 
+            continue; 
+        }
+
         // Map phase: compute LSH values 
+        metrics::counters mapping(metrics::HW_MAP); 
         vector<vector<element_t>> elements = mapPhase(size, rank, chunk, numLines); 
+        mapping.stop(); 
 
         // Shuffle phase: 
-        shufflePhase(comm, size, rank, elements, umap); 
+        metrics::counters shuffling(metrics::HW_SHUFFLE); 
+        trace::span tracing(SHUFFLE_NAMES[shuffle], "shuffle"); 
+        double start_time_shuffle_r = MPI_Wtime(); 
+        if (shuffle == SHUFFLE_RMA) {
+            shufflePhaseRMA(comm, size, rank, elements, umap); 
+        } else if (shuffle == SHUFFLE_NODE) {
+            shufflePhaseNode(comm, size, rank, elements, umap); 
+        } else {
+            shufflePhase(comm, size, rank, elements, umap); 
+        }
+        time_shuffle += MPI_Wtime() - start_time_shuffle_r; 
+        metrics::add(metrics::SHUFFLE, MPI_Wtime() - start_time_shuffle_r); 
 
         // Update index of input file to process next batch
         start_byte += static_cast<size_t>(chars_counts[r]);
         start_line += numLines; 
         time_distr += time_distr_r; 
     }
+
+    // Replicate the small dataset 
+    if (broadcastDataset >= 0) {
+        metrics::counters shuffling(metrics::HW_SHUFFLE); 
+        double start_time_broadcast = MPI_Wtime(); 
+        broadcastPhase(comm, size, rank, buildBuffer, umap); 
+        time_shuffle += MPI_Wtime() - start_time_broadcast; 
+        metrics::add(metrics::SHUFFLE, MPI_Wtime() - start_time_broadcast); 
+    }
     
     return umap; 
 
 }
 
 
-void reducePhase( MPI_Comm comm, int size, int rank, unordered_map<long, vector<element_t>>& elementsReceived){
+// A range of rows of the pairs matrix of a bucket: rows [rowBegin, rowEnd) are joined with all following elements
+struct joinTask {
+    long lsh;                       // Bucket key
+    const vector<uint32_t>* refs;   // Bucket elements
+    uint32_t rowBegin, rowEnd; 
+    uint64_t cost;                  // Estimated num of pairs to check 
+};
+
+// Per-rank statistics of the join phase 
+struct joinStats {
+    double busy = 0;        // Time spent joining pairs
+    double idle = 0;        // Time spent stealing work or waiting for other ranks 
+    uint64_t tasks = 0;     // Tasks joined 
+    uint64_t stolen = 0;    // Tasks stolen from other ranks
+    uint64_t given = 0;     // Tasks given to other ranks
+};
+
+template<typename Elements, typename Serve>
+void joinRows(long lsh, const Elements& elements, size_t n, size_t rowBegin, size_t rowEnd, Serve serve) {
+
+    // Join rows of a bucket (sorted by dataset) with the partners of the join specification, 
+    // serving requests of other ranks after each row 
+    joinspec::for_each_row(spec, n, rowBegin, rowEnd, [&](size_t i) { return elements(i).dataSet; }, 
+        [&](size_t i, size_t first, size_t last) {
+            const element_t& a = elements(i); 
+            for (size_t j = first; j < last; j++) {
+                checkHelper(lsh, a, elements(j));
+            }
+            serve(); 
+        }); 
+}
+
+void groupByDataset(bucketIndex& elementsReceived) {
+
+    // Elements of each bucket sorted by dataset: the partners of a row are a contiguous range
+    const vector<element_t>& elements = elementsReceived.elements; 
+    for (auto& [lsh, refs] : elementsReceived.buckets) {
+        stable_sort(refs.begin(), refs.end(), [&](uint32_t a, uint32_t b) { return elements[a].dataSet < elements[b].dataSet; }); 
+    }
+}
+
+vector<joinTask> buildJoinTasks(MPI_Comm comm, bucketIndex& elementsReceived, vector<uint64_t>& rankCosts) {
 
-    for (auto& [lsh, elements_v] : elementsReceived) {
-        for (size_t i = 0; i < elements_v.size(); i++) {
-            for (size_t j = i + 1; j < elements_v.size(); j++) {
-                if (elements_v[i].dataSet != elements_v[j].dataSet) {
-                    checkHelper(lsh, elements_v[i], elements_v[j]);
+    // Estimate the cost of each bucket as the num of pairs of the join specification
+    uint64_t local_cost = 0, tot_cost; 
+    for (auto& [lsh, refs] : elementsReceived.buckets) {
+        map<int, uint64_t> perDataset; 
+        for (uint32_t ref : refs) ++perDataset[elementsReceived.elements[ref].dataSet]; 
+        local_cost += spec.pairs(perDataset); 
+    }
+
+    // Publish the cost of each rank 
+    int size; 
+    MPI_Comm_size(comm, &size); 
+    rankCosts.resize(size); 
+    MPI_Allgather(&local_cost, 1, MPI_UINT64_T, rankCosts.data(), 1, MPI_UINT64_T, comm); 
+    tot_cost = 0; 
+    for (uint64_t cost : rankCosts) tot_cost += cost; 
+    uint64_t task_cost = max<uint64_t>(tot_cost / (size * JOIN_TASKS_PER_RANK), 1); 
+
+    // Split heavy buckets in ranges of rows with about task_cost pairs each
+    vector<joinTask> tasks; 
+    const vector<element_t>& elements = elementsReceived.elements; 
+    for (auto& [lsh, refs] : elementsReceived.buckets) {
+        uint32_t n = refs.size(); 
+        uint32_t rowBegin = 0; 
+        uint64_t cost = 0; 
+        joinspec::for_each_row(spec, n, 0, n, [&](size_t i) { return elements[refs[i]].dataSet; }, 
+            [&](size_t i, size_t first, size_t last) {
+                cost += last - first; 
+                if (cost >= task_cost || i == n - 1) {
+                    if (cost > 0) tasks.push_back({lsh, &refs, rowBegin, static_cast<uint32_t>(i + 1), cost}); 
+                    rowBegin = i + 1; 
+                    cost = 0; 
+                }
+            }); 
+    }
+
+    // Heaviest tasks first
+    sort(tasks.begin(), tasks.end(), [](const joinTask& a, const joinTask& b) { return a.cost > b.cost; }); 
+    return tasks; 
+}
+
+joinStats dynamicReducePhase(MPI_Comm comm, int size, int rank, bucketIndex& elementsReceived) {
+
+    // Dedicated communicator for the work-stealing protocol
+    MPI_Comm joinComm; 
+    MPI_Comm_dup(comm, &joinComm); 
+
+    joinStats stats; 
+    double start_time = MPI_Wtime(); 
+    vector<uint64_t> rankCosts; 
+    vector<joinTask> tasks = buildJoinTasks(joinComm, elementsReceived, rankCosts); 
+    size_t front = 0, back = tasks.size();  // Tasks not yet started: [front, back)
+    const vector<element_t>& elements = elementsReceived.elements; 
+
+    vector<vector<char>> replies;           // Send buffers of pending steal replies
+    vector<MPI_Request> replyRequests; 
+    int done = 0;                           // Num of ranks done (root only)
+    bool terminate = false; 
+
+    // Answer steal requests with the lightest task not yet started, 
+    // shipped with the elements of its rows and of the following ones
+    auto serve = [&]() {
+        int flag = 1; 
+        while (flag) {
+            MPI_Status status; 
+            MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, joinComm, &flag, &status); 
+            if (!flag || status.MPI_TAG == TAG_STEAL_REPLY) break; 
+            MPI_Recv(nullptr, 0, MPI_CHAR, status.MPI_SOURCE, status.MPI_TAG, joinComm, MPI_STATUS_IGNORE); 
+
+            if (status.MPI_TAG == TAG_JOIN_DONE) {
+                ++done; 
+            } else if (status.MPI_TAG == TAG_JOIN_TERMINATE) {
+                terminate = true; 
+            } else {
+                replies.emplace_back(); 
+                vector<char>& reply = replies.back(); 
+                if (front < back) {
+                    const joinTask& task = tasks[--back]; 
+                    wire::put_varint(reply, task.lsh); 
+                    wire::put_varint(reply, task.rowEnd - task.rowBegin); 
+                    wire::put_varint(reply, task.refs->size() - task.rowBegin); 
+                    for (size_t j = task.rowBegin; j < task.refs->size(); ++j) {
+                        packElement(reply, elements[(*task.refs)[j]]); 
+                    }
+                    ++stats.given; 
                 }
+                replyRequests.emplace_back(); 
+                MPI_Isend(reply.data(), reply.size(), MPI_CHAR, status.MPI_SOURCE, TAG_STEAL_REPLY, joinComm, &replyRequests.back()); 
+            }
+        }
+    }; 
+
+    // Join local tasks, heaviest first
+    while (front < back) {
+        const joinTask& task = tasks[front++]; 
+        trace::span tracing("join task", "join", task.cost); 
+        double start_task = MPI_Wtime(); 
+        joinRows(task.lsh, [&](size_t i) -> const element_t& { return elements[(*task.refs)[i]]; }, task.refs->size(), task.rowBegin, task.rowEnd, serve); 
+        stats.busy += MPI_Wtime() - start_task; 
+        ++stats.tasks; 
+    }
+
+    // Steal tasks from the other ranks, starting from the most loaded ones
+    vector<int> victims; 
+    for (int r = 0; r < size; ++r) {
+        if (r != rank) victims.push_back(r); 
+    }
+    sort(victims.begin(), victims.end(), [&](int a, int b) { return rankCosts[a] > rankCosts[b]; }); 
+    vector<char> recvBuffer; 
+    for (int victim : victims) {
+        while (true) {
+            MPI_Send(nullptr, 0, MPI_CHAR, victim, TAG_STEAL_REQ, joinComm); 
+
+            // Wait for the reply while serving other thieves
+            int flag = 0; 
+            MPI_Status status; 
+            while (!flag) {
+                serve(); 
+                MPI_Iprobe(victim, TAG_STEAL_REPLY, joinComm, &flag, &status); 
+            }
+            int count; 
+            MPI_Get_count(&status, MPI_CHAR, &count); 
+            recvBuffer.resize(count); 
+            MPI_Recv(recvBuffer.data(), count, MPI_CHAR, victim, TAG_STEAL_REPLY, joinComm, MPI_STATUS_IGNORE); 
+            if (!count) break; 
+
+            // Join the stolen task on the shipped elements
+            trace::span tracing("join stolen task", "join"); 
+            double start_task = MPI_Wtime(); 
+            const char* p = recvBuffer.data(); 
+            long lsh = static_cast<long>(wire::get_varint(p)); 
+            size_t rows = wire::get_varint(p); 
+            vector<element_t> stolen(wire::get_varint(p)); 
+            for (element_t& elem : stolen) {
+                p = unpackElement(p, elem); 
             }
+            joinRows(lsh, [&](size_t i) -> const element_t& { return stolen[i]; }, stolen.size(), 0, rows, serve); 
+            stats.busy += MPI_Wtime() - start_task; 
+            ++stats.tasks; 
+            ++stats.stolen; 
         }
     }
 
+    // Notify the root and serve requests until every rank is done
+    if (rank) {
+        MPI_Send(nullptr, 0, MPI_CHAR, 0, TAG_JOIN_DONE, joinComm); 
+        while (!terminate) serve(); 
+    } else {
+        ++done; 
+        while (done < size) serve(); 
+        for (int r = 1; r < size; ++r) {
+            MPI_Send(nullptr, 0, MPI_CHAR, r, TAG_JOIN_TERMINATE, joinComm); 
+        }
+    }
+    MPI_Waitall(replyRequests.size(), replyRequests.data(), MPI_STATUSES_IGNORE); 
+    MPI_Comm_free(&joinComm); 
+
+    stats.idle = MPI_Wtime() - start_time - stats.busy; 
+    return stats; 
+}
+
+joinStats reducePhase( MPI_Comm comm, int size, int rank, bucketIndex& elementsReceived, bool dynamic){
+
+    joinStats stats; 
+    metrics::count(metrics::BUCKETS, elementsReceived.buckets.size()); 
+    metrics::scope grouping(metrics::GROUP); 
+    groupByDataset(elementsReceived); 
+    grouping.stop(); 
+    metrics::scope joining(metrics::JOIN); 
+    metrics::counters joins(metrics::HW_JOIN); 
+    if (dynamic) {
+        stats = dynamicReducePhase(comm, size, rank, elementsReceived); 
+    } else {
+        double start_time = MPI_Wtime(); 
+        const vector<element_t>& elements = elementsReceived.elements; 
+        for (auto& [lsh, refs] : elementsReceived.buckets) {
+            if (refs.size() < 2) continue; 
+            trace::span tracing("join bucket", "join", refs.size()); 
+            joinRows(lsh, [&](size_t i) -> const element_t& { return elements[refs[i]]; }, refs.size(), 0, refs.size(), [] {}); 
+            ++stats.tasks; 
+        }
+        stats.busy = MPI_Wtime() - start_time; 
+    }
+
+    // Time spent waiting for the slowest rank
+    double start_wait = MPI_Wtime(); 
+    trace::span barrier("MPI_Barrier", "mpi"); 
+    MPI_Barrier(comm); 
+    barrier.stop(); 
+    stats.idle += MPI_Wtime() - start_wait; 
+
     // Aggregate total number of founded pairs in root process 
     MPI_Reduce(&foundSimilar, &foundSimilarTot, 1, MPI_UNSIGNED, MPI_SUM, 0, comm);    
     
-    return; 
+    return stats; 
+}
+
+joinStats probePhase(MPI_Comm comm, int size, int rank, bucketIndex& buildSide, vector<element_t>& probeSide) {
+
+    // Join each local trajectory of the large dataset with the replicated buckets of the small one 
+    joinStats stats; 
+    metrics::count(metrics::BUCKETS, buildSide.buckets.size()); 
+    metrics::scope joining(metrics::JOIN); 
+    metrics::counters joins(metrics::HW_JOIN); 
+    double start_time = MPI_Wtime(); 
+    const vector<element_t>& elements = buildSide.elements; 
+    trace::span tracing("probe", "join", probeSide.size()); 
+    for (const element_t& a : probeSide) {
+        for (size_t i = 0; i < LSH_FAMILY_SIZE; i++) {
+            long lsh = a.relativeLSHs[i]; 
+
+            // Probe each distinct bucket once
+            if (find(a.relativeLSHs.begin(), a.relativeLSHs.begin() + i, lsh) != a.relativeLSHs.begin() + i) continue; 
+            auto bucket = buildSide.buckets.find(lsh); 
+            if (bucket == buildSide.buckets.end()) continue; 
+            for (uint32_t ref : bucket->second) {
+                checkHelper(lsh, a, elements[ref]); 
+            }
+        }
+        ++stats.tasks; 
+    }
+    stats.busy = MPI_Wtime() - start_time; 
+    tracing.stop(); 
+
+    // Time spent waiting for the slowest rank
+    double start_wait = MPI_Wtime(); 
+    trace::span barrier("MPI_Barrier", "mpi"); 
+    MPI_Barrier(comm); 
+    barrier.stop(); 
+    stats.idle = MPI_Wtime() - start_wait; 
+
+    // Aggregate total number of founded pairs in root process 
+    MPI_Reduce(&foundSimilar, &foundSimilarTot, 1, MPI_UNSIGNED, MPI_SUM, 0, comm);    
+
+    return stats; 
+}
+
+void outputJoinStats(MPI_Comm comm, int size, int rank, const joinStats& stats) {
+
+    // Gather statistics of every rank and report them on standard error
+    double times[2] = {stats.busy, stats.idle}; 
+    uint64_t counts[3] = {stats.tasks, stats.stolen, stats.given}; 
+    vector<double> allTimes(2 * size); 
+    vector<uint64_t> allCounts(3 * size); 
+    MPI_Gather(times, 2, MPI_DOUBLE, allTimes.data(), 2, MPI_DOUBLE, 0, comm); 
+    MPI_Gather(counts, 3, MPI_UINT64_T, allCounts.data(), 3, MPI_UINT64_T, 0, comm); 
+    if (!rank) {
+        cerr << "rank\tbusy\tidle\ttasks\tstolen\tgiven" << endl; 
+        for (int r = 0; r < size; ++r) {
+            cerr << 
+                r << "\t" << 
+                allTimes[2 * r] << "\t" <<         // time joining pairs
+                allTimes[2 * r + 1] << "\t" <<     // time stealing or waiting
+                allCounts[3 * r] << "\t" <<        // tasks joined
+                allCounts[3 * r + 1] << "\t" <<    // tasks stolen
+                allCounts[3 * r + 2] <<             // tasks given
+            endl; 
+        }
+    }
 }
 
 void outputPairs(MPI_Comm comm, int size, int rank, ostream* resultsStream){
@@ -481,16 +1353,23 @@ void outputPairs(MPI_Comm comm, int size, int rank, ostream* resultsStream){
     
     // Perform MPI_Gatherv to gather data on the root process (rank 0)
     simPairsTot.resize(tot_recvSize); 
+    trace::span gatherv("MPI_Gatherv", "mpi", count); 
     MPI_Gatherv(
         simPairs.data(), count, MPI_LONG,
         simPairsTot.data(), recv_counts.data(), displs.data(), MPI_LONG,
         0, comm
     );
+    gatherv.stop(); 
  
     // Output pairs in outstream with root process
     if (!rank) {
-        for (size_t i = 0; i < simPairsTot.size(); i += 2) {
-            *resultsStream << simPairsTot[i] << "\t" << simPairsTot[i+1] << endl;
+        for (size_t i = 0; i < simPairsTot.size(); i += pairWords) {
+            *resultsStream << simPairsTot[i] << "\t" << simPairsTot[i+1];
+#ifdef REPORT_DISTANCE
+            *resultsStream << "\t" << bit_cast<double>(simPairsTot[i+2]);
+#endif
+            if (pairWords > PAIR_WORDS) *resultsStream << "\t" << thresholds[simPairsTot[i+PAIR_WORDS]];
+            *resultsStream << endl;
         }
     }
     return; 
@@ -500,16 +1379,57 @@ int main(int argc, char* argv[]) {
 
     // Lambda function for usage description message 
     auto usage_and_exit = [argv]() {
-        printf("   use: %s inputFile [outputFile]\n", argv[0]);
+        printf("   use: %s [-s shuffle] [-d dynamic] [-J mode] [-t thresholds] [-j spec] inputFile [outputFile]\n", argv[0]);
         printf("   inputFile -> path to input file (required) \n");
-        printf("   outputFile -> path to ouput file (optional) \n\n");
+        printf("   outputFile -> path to ouput file (optional) \n");
+        printf("   -s shuffle -> shuffle engine: alltoallv (default), rma, node \n");
+        printf("   -d dynamic -> join scheduling: 1 (default, work stealing) - 0 (static) \n");
+        printf("   -J mode -> join mode: auto (default), shuffle, broadcast (replicate the smaller of two datasets) \n");
+        printf("   -t thresholds -> comma-separated thresholds joined in a single pass (default: %g); \n", SIM_THRESHOLD);
+        printf("                    each pair is tagged with the smallest threshold it satisfies \n");
+        printf("   -j spec -> pairs joined: cross (default, different datasets), self (same dataset), all, \n");
+        printf("              optionally restricted to datasets (e.g. self:0, cross:0,1,2) \n\n");
         exit(-1);
     };
 
+    // Optional arguments
+    shuffle_t shuffle = SHUFFLE_ALLTOALLV; 
+    bool dynamic = true; 
+    join_t join = JOIN_AUTO; 
+    int opt; 
+    while ((opt = getopt(argc, argv, "s:d:J:t:j:")) != -1) {
+        if (opt == 's' && !strcmp(optarg, SHUFFLE_NAMES[SHUFFLE_ALLTOALLV])) shuffle = SHUFFLE_ALLTOALLV; 
+        else if (opt == 's' && !strcmp(optarg, SHUFFLE_NAMES[SHUFFLE_RMA])) shuffle = SHUFFLE_RMA; 
+        else if (opt == 's' && !strcmp(optarg, SHUFFLE_NAMES[SHUFFLE_NODE])) shuffle = SHUFFLE_NODE; 
+        else if (opt == 'd') dynamic = atoi(optarg); 
+        else if (opt == 'J' && !strcmp(optarg, JOIN_NAMES[JOIN_AUTO])) join = JOIN_AUTO; 
+        else if (opt == 'J' && !strcmp(optarg, JOIN_NAMES[JOIN_SHUFFLE])) join = JOIN_SHUFFLE; 
+        else if (opt == 'J' && !strcmp(optarg, JOIN_NAMES[JOIN_BROADCAST])) join = JOIN_BROADCAST; 
+        else if (opt == 'j' && joinspec::parse(optarg, spec)) {} 
+        else if (opt == 't') {
+            thresholds.clear(); 
+            stringstream list(optarg); 
+            string value; 
+            while (getline(list, value, ',')) 
+                if (!value.empty()) thresholds.push_back(stod(value)); 
+            if (thresholds.empty()) usage_and_exit(); 
+        }
+        else usage_and_exit(); 
+    }
+
+    // Sorted thresholds, bucketed at the LSH resolution of the largest one
+    sort(thresholds.begin(), thresholds.end()); 
+    thresholds.erase(unique(thresholds.begin(), thresholds.end()), thresholds.end()); 
+    lshResolution = LSH_RESOLUTION * max(1.0, thresholds.back() / SIM_THRESHOLD); 
+    pairWords = PAIR_WORDS + (thresholds.size() > 1); 
+    foundSimilarLevel.assign(thresholds.size(), 0); 
+
     // Argument checking
-    if (argc < 2) {
+    if (argc - optind < 1) {
         usage_and_exit();
     }
+    const char* inFilename = argv[optind]; 
+    const char* outFilename = (argc - optind > 1) ? argv[optind + 1] : nullptr; 
 
     // MPI environment initialization
     MPI_Init(&argc, &argv);
@@ -518,6 +1438,7 @@ int main(int argc, char* argv[]) {
     int rank, size;
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
+    trace::sync(MPI_COMM_WORLD); 
 
     // Get processors/nodes names
     char processor_name[MPI_MAX_PROCESSOR_NAME];
@@ -541,7 +1462,8 @@ int main(int argc, char* argv[]) {
     double start_time, end_time;
     double start_time_read, end_time_read; 
     double start_time_out, end_time_out; 
-    double time_distr; 
+    double time_distr = 0; 
+    double time_shuffle = 0; 
 
     // Start measuring total elapsed time, and time for chunks distributions
     MPI_Barrier(MPI_COMM_WORLD); 
@@ -550,8 +1472,8 @@ int main(int argc, char* argv[]) {
     // Set output stream
     ostream* resultsStream = &cout;
     ofstream filestream;
-    if (argc > 2) {
-        filestream = ofstream(argv[2]);
+    if (outFilename) {
+        filestream = ofstream(outFilename);
         if (filestream.is_open())
             resultsStream = &filestream;
     }
@@ -567,8 +1489,7 @@ int main(int argc, char* argv[]) {
     if (!rank){
 
         // Open input file in read-only mode and store file descriptor
-        const string inFilename = argv[1];
-        int inFileDesc = open(inFilename.c_str(), O_RDONLY);
+        int inFileDesc = open(inFilename, O_RDONLY);
         
         // Get input file information using fstat 
         struct stat inFileStat;
@@ -592,7 +1513,9 @@ int main(int argc, char* argv[]) {
     double end_time_mapfile = MPI_Wtime(); 
     
     // Perform chunk distribution, map phase and shuffle-communication phase in batch 
-    unordered_map<long, vector<element_t>> elementsReceived = process_in_batch (MPI_COMM_WORLD, size, rank, inFileMapped, inFileBytes, time_distr);
+    int broadcastDataset = -1; 
+    vector<element_t> probeSide; 
+    bucketIndex elementsReceived = process_in_batch (MPI_COMM_WORLD, size, rank, inFileMapped, inFileBytes, shuffle, join, broadcastDataset, probeSide, time_distr, time_shuffle);
     
     // Unmap input file in root process 
     
@@ -605,14 +1528,23 @@ int main(int argc, char* argv[]) {
     double end_time_unmapfile = MPI_Wtime(); 
 
     // Perform reduce-phase (similarity join computation)
-    reducePhase(MPI_COMM_WORLD, size, rank, elementsReceived); 
+    joinStats stats = (broadcastDataset >= 0) ? 
+        probePhase(MPI_COMM_WORLD, size, rank, elementsReceived, probeSide) : 
+        reducePhase(MPI_COMM_WORLD, size, rank, elementsReceived, dynamic); 
+    outputJoinStats(MPI_COMM_WORLD, size, rank, stats); 
+
+    // Similar pairs tagged with each threshold
+    vector<unsigned long> foundSimilarLevelTot(thresholds.size()); 
+    MPI_Reduce(foundSimilarLevel.data(), foundSimilarLevelTot.data(), thresholds.size(), MPI_UNSIGNED_LONG, MPI_SUM, 0, MPI_COMM_WORLD); 
 
     // Write to outuput file similar pairs 
     MPI_Barrier(MPI_COMM_WORLD); 
     start_time_out = MPI_Wtime(); 
 
     // Write to similar pairs to output file
+    metrics::scope writing(metrics::OUTPUT); 
     outputPairs(MPI_COMM_WORLD, size, rank, resultsStream);
+    writing.stop(); 
     
     // Stop mesuring total elapsed time
     MPI_Barrier(MPI_COMM_WORLD);
@@ -624,23 +1556,44 @@ int main(int argc, char* argv[]) {
     double time_unmapfile = end_time_unmapfile - start_time_unmapfile; 
     double elapsed_time = end_time - start_time;                   
     double elapsed_time_distr = time_distr + time_mapfile + time_unmapfile;
+    metrics::add(metrics::READ, elapsed_time_distr); 
+    metrics::count(metrics::MATCHES, foundSimilar); 
     double elapsed_time_out = end_time_out - start_time_out;
 
+    // Shuffle time of the slowest process
+    double elapsed_time_shuffle; 
+    MPI_Reduce(&time_shuffle, &elapsed_time_shuffle, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD); 
+
     // Results for metrics computation
     if (!rank){
 
         cout << 
             argv[0] << "\t" <<              // executables name 
-            argv[1] << "\t" <<              // dataset name
+            inFilename << "\t" <<           // dataset name
             unique_nodes.size() << "\t" <<  // num of nodes
             size << "\t" <<                 // total num of process 
             foundSimilarTot << "\t" <<      // num of similar pair
             elapsed_time_distr << "\t" <<   // time for chunck distribution
             elapsed_time_out << "\t" <<     // time for outputting pairs
             elapsed_time << "\t" <<         // total elapsed time 
-        endl; 
+            elapsed_time_shuffle << "\t" << // time for shuffle phase
+            SHUFFLE_NAMES[shuffle] << "\t" << // shuffle engine
+            JOIN_NAMES[(broadcastDataset >= 0) ? JOIN_BROADCAST : JOIN_SHUFFLE] << "\t";  // join mode
+
+        // Multi-threshold join: similar pairs within each threshold (threshold:pairs) 
+        if (thresholds.size() > 1) {
+            unsigned long within = 0; 
+            for (size_t i = 0; i < thresholds.size(); ++i) {
+                within += foundSimilarLevelTot[i]; 
+                cout << (i ? "," : "") << thresholds[i] << ":" << within; 
+            }
+            cout << "\t"; 
+        }
+        cout << endl; 
 
     }
+    metrics::report("mpi", inFilename, MPI_COMM_WORLD); 
+    trace::write(MPI_COMM_WORLD); 
 
     // MPI environment finalization
     MPI_Finalize(); 
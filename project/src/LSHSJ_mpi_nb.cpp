@@ -5,7 +5,8 @@
 *           Parallel and Distributed Systems: Paradigms and models (23/24).
 *
 * @brief    Project track 3: Locality Sensitive Hashing based Similarity Join (LSHSJ)
-* @details  Parallel implementation of LSHSJ for Distributed Memory Systems with MPI.   
+* @details  Parallel implementation of LSHSJ for Distributed Memory Systems with MPI, 
+*           overlapping the map phase with a nonblocking streaming shuffle.   
 *
 */
 
@@ -35,6 +36,7 @@
 #include <utility>
 #include <algorithm>
 #include <unordered_map>
+#include <bit>
 
 // Message Passing Interface (MPI) lib
 #include <mpi.h>
@@ -44,6 +46,15 @@
 #include "geometry_basics.hpp"
 #include "frechet_distance.hpp"
 
+// Wire format of shuffled trajectories
+#include "trajectory_codec.hpp"
+
+// Per-phase metrics (LSHSJ_METRICS)
+#include "metrics.hpp"
+
+// Timeline of threads and ranks (LSHSJ_TRACE)
+#include "trace.hpp"
+
 using namespace std;
 
 #define LSH_FAMILY_SIZE 8     // Number of LSH functions
@@ -54,6 +65,30 @@ using namespace std;
 const static double SIM_THRESHOLD = 10;
 const static double SIM_THRESHOLD_SQR = sqr(SIM_THRESHOLD);
 
+// Streaming shuffle: capacity of each send buffer and num of buffers per destination rank
+#ifndef SHUFFLE_BUFFER_BYTES
+#define SHUFFLE_BUFFER_BYTES (1 << 20)
+#endif
+#ifndef SHUFFLE_BUFFERS
+#define SHUFFLE_BUFFERS 2
+#endif
+#define TAG_DATA 1
+#define TAG_END 2
+
+// Coordinates codec for shuffled trajectories: raw doubles, or fixed-point deltas (make DELTA=scale)
+#ifdef WIRE_DELTA_SCALE
+const static wire::codec_t WIRE_CODEC{wire::DELTA, WIRE_DELTA_SCALE};
+#else
+const static wire::codec_t WIRE_CODEC = wire::RAW_CODEC;
+#endif
+
+// Words of a similar pair in the flattened pairs: ids [, bits of the Frechet distance] (make DISTANCE=1)
+#ifdef REPORT_DISTANCE
+#define PAIR_WORDS 3
+#else
+#define PAIR_WORDS 2
+#endif
+
 size_t foundSimilar = 0; 
 size_t foundSimilarTot; 
 vector<long> simPairs; 
@@ -67,19 +102,65 @@ struct item {
 
 struct element_t {
     
-    long LSH;           // LSH values           
     int dataSet;        // Dataset identifier
     curve trajectory;   // Curve representing the trajectory
     array<long, LSH_FAMILY_SIZE> relativeLSHs; // LSH values for the LSH function 
     long id;            // Unique identifier 
+    uint32_t bucketMask; // Positions of relativeLSHs whose bucket lives on the destination rank
     
     // Constructor
     element_t() = default;
-    element_t(long hash, int dataset, curve trajectory, decltype(relativeLSHs) relativeLSHs, long id)
-        : LSH(hash), dataSet(dataset), trajectory(trajectory), relativeLSHs(relativeLSHs), id(id) {}
+    element_t(int dataset, curve trajectory, decltype(relativeLSHs) relativeLSHs, long id, uint32_t bucketMask)
+        : dataSet(dataset), trajectory(trajectory), relativeLSHs(relativeLSHs), id(id), bucketMask(bucketMask) {}
     
 };
 
+static_assert(LSH_FAMILY_SIZE <= 32, "bucketMask holds one bit per LSH function");
+
+// Elements received by a process: each trajectory is stored once and 
+// every LSH bucket references it by its position in the elements vector
+struct bucketIndex {
+    vector<element_t> elements; 
+    unordered_map<long, vector<uint32_t>> buckets; 
+};
+
+void insertElement(bucketIndex& index, const element_t& elem) {
+
+    // Rebuild bucket membership of a received trajectory
+    uint32_t ref = static_cast<uint32_t>(index.elements.size()); 
+    index.elements.push_back(elem); 
+    for (size_t i = 0; i < LSH_FAMILY_SIZE; ++i) {
+        if (elem.bucketMask & (1u << i)) {
+            index.buckets[elem.relativeLSHs[i]].push_back(ref); 
+        }
+    }
+}
+
+// Upper bound on the bytes written by packElement
+constexpr size_t MAX_ELEMENT_BYTES = wire::MAX_TRAJECTORY_BYTES + (LSH_FAMILY_SIZE + 1) * wire::MAX_VARINT_BYTES; 
+
+void packElement(vector<char>& buffer, const element_t& elem) {
+
+    // Only the points of the trajectory are sent, prefix lengths are rebuilt on unpack
+    wire::put_trajectory(buffer, elem.id, elem.dataSet, elem.trajectory, WIRE_CODEC); 
+    for (long h : elem.relativeLSHs) {
+        wire::put_varint(buffer, h); 
+    }
+    wire::put_varint(buffer, elem.bucketMask); 
+}
+
+const char* unpackElement(const char* p, element_t& elem) {
+
+    uint64_t id; 
+    wire::get_trajectory(p, id, elem.dataSet, elem.trajectory, WIRE_CODEC); 
+    elem.id = static_cast<long>(id); 
+    for (long& h : elem.relativeLSHs) {
+        h = static_cast<long>(wire::get_varint(p)); 
+    }
+    elem.bucketMask = static_cast<uint32_t>(wire::get_varint(p)); 
+    return p; 
+}
+
 item parseLine(string& line) {
 
     // Parse a line of the input dataset as an item 
@@ -133,9 +214,13 @@ void checkHelper(const long lsh, const element_t& a, const element_t& b) {
     for (size_t ii = 0; ii < a.relativeLSHs.size(); ii++) {
         if (a.relativeLSHs[ii] == b.relativeLSHs[ii]) {
             if (lsh == a.relativeLSHs[ii]) {
+                metrics::count(metrics::CANDIDATES);
                 if (similarity_test(a.trajectory, b.trajectory)) {
                     simPairs.push_back(a.id);
-                    simPairs.push_back(b.id); 
+                    simPairs.push_back(b.id);
+#ifdef REPORT_DISTANCE
+                    simPairs.push_back(bit_cast<long>(get_frechet_distance_within(a.trajectory, b.trajectory, SIM_THRESHOLD)));
+#endif
                     ++foundSimilar;
                 }
             }
@@ -230,11 +315,13 @@ stringstream distributeChunks(MPI_Comm comm, int size, int rank, size_t start_li
     }
 
     // Scatter to each process the num of chars they will receive
+    trace::span scatter("MPI_Scatter", "mpi"); 
     MPI_Scatter(
         counts_send.data(), 1, MPI_INT,
         &counts_recv, 1, MPI_INT, 
         0, comm
     );
+    scatter.stop(); 
     
     // Get InFileMapped displacement (for the current input file partition) 
     const char* inFileMapped_displ = &inFileMapped[start_byte];
@@ -243,11 +330,13 @@ stringstream distributeChunks(MPI_Comm comm, int size, int rank, size_t start_li
     vector<char> chunkBuffer (counts_recv); 
     
     // Scatter chunk of input file (chars) to other process 
+    trace::span scatterv("MPI_Scatterv", "mpi", counts_recv); 
     MPI_Scatterv(
         inFileMapped_displ, counts_send.data(), displs_send.data(), MPI_CHAR,
         chunkBuffer.data(), counts_recv, MPI_CHAR, 
         0, comm
     );
+    scatterv.stop(); 
 
     // write to stringstream 
     chunk.write(chunkBuffer.data(), counts_recv); 
@@ -255,156 +344,212 @@ stringstream distributeChunks(MPI_Comm comm, int size, int rank, size_t start_li
     return chunk; 
 }
 
-vector<vector<element_t>> mapPhase (int size, int rank, stringstream& chunk, int& numLines){
-
-    // Build LSH function family
-    FrechetLSH lsh_family[LSH_FAMILY_SIZE];
-    for (size_t i = 0; i < LSH_FAMILY_SIZE; i++){
-        lsh_family[i].init(LSH_RESOLUTION, LSH_SEED * i, i);
+/**
+ * Streaming shuffle: elements are packed into fixed-size per-destination send buffers while the 
+ * chunk is parsed. A full buffer is posted with a nonblocking send and the next buffer of the pool 
+ * is filled meanwhile; incoming buffers are received and unpacked into buckets as they arrive.
+ * Memory used by the shuffle is bounded by the buffer pool, not by the size of the chunk.
+ */
+struct shuffleStream {
+
+    shuffleStream(MPI_Comm comm, int size, int rank, bucketIndex& umap)
+        : comm(comm), size(size), rank(rank), umap(umap), 
+          buffers(size, vector<vector<char>>(SHUFFLE_BUFFERS)), 
+          requests(size, vector<MPI_Request>(SHUFFLE_BUFFERS, MPI_REQUEST_NULL)), 
+          filling(size, 0), ends(0) {
+        
+        for (auto& pool : buffers) {
+            for (auto& buffer : pool) {
+                buffer.reserve(SHUFFLE_BUFFER_BYTES); 
+            }
+        }
     }
-    
-    // Final vector of elements aggregated by destination rank
-    vector<vector<element_t>> elements(size);
-
-    // Iterate chunk line-by-line
-    string line; 
-    while(getline(chunk, line)){
 
-        // Parse a line 
-        item it = parseLine(line); 
-        
-        // Compute LSH values for each LSH function
-        array<long, LSH_FAMILY_SIZE> relative_lshs;
-        for (size_t i = 0; i < LSH_FAMILY_SIZE; i++){
-            relative_lshs[i] = lsh_family[i].hash(it.content);
+    void push(int dest, const element_t& elem) {
+
+        // Elements of the local rank are inserted directly; a lossy codec is applied anyway, 
+        // so that the verdict on a pair does not depend on the rank owning its bucket
+        if (dest == rank) {
+#ifdef WIRE_DELTA_SCALE
+            localBuffer.clear(); 
+            packElement(localBuffer, elem); 
+            element_t decoded; 
+            unpackElement(localBuffer.data(), decoded); 
+            insertElement(umap, decoded); 
+#else
+            insertElement(umap, elem); 
+#endif
+            return; 
         }
 
-        // Populate vector of elements 
-        for (long h : relative_lshs){
-            int out_rank = h % size; 
-            elements[out_rank].emplace_back(h, it.dataset, it.content, relative_lshs, it.id);
+        vector<char>& buffer = buffers[dest][filling[dest]]; 
+        packElement(buffer, elem); 
+        if (buffer.size() + MAX_ELEMENT_BYTES > SHUFFLE_BUFFER_BYTES) {
+            post(dest); 
         }
+        poll(); 
     }
 
-    // Free memory of chunk
-    chunk.str(""); 
-    chunk.clear(); 
-
-    return elements; 
-}
-
-
-void shufflePhase(MPI_Comm comm, int size, int rank, vector<vector<element_t>>& elements, unordered_map<long, vector<element_t>>& umap) {
-    
-    int byte_limit = numeric_limits<int>::max();
-    int byte_limit_per_rank = byte_limit / size;
-    int num_elem_per_rank = byte_limit_per_rank / static_cast<int>(sizeof(element_t));
-    size_t reps = 0; 
-
-    vector<vector<char>> sBuffer; 
-    vector<vector<int>> sCounts, sDispls; 
-
-    while(true){
-        
-        int local_rep = 0, global_rep;
+    void finish() {
 
-        // Check if another iteration is required
-        for (size_t i = 0; i < size; ++i) {
-            if (!elements[i].empty()) {
-                local_rep = 1;
-                break;
+        // Post partially filled buffers, then the end-of-stream marker to every rank
+        for (int dest = 0; dest < size; ++dest) {
+            if (dest != rank && !buffers[dest][filling[dest]].empty()) {
+                post(dest); 
+            }
+        }
+        vector<MPI_Request> endRequests; 
+        for (int dest = 0; dest < size; ++dest) {
+            if (dest != rank) {
+                endRequests.emplace_back(); 
+                MPI_Isend(nullptr, 0, MPI_CHAR, dest, TAG_END, comm, &endRequests.back()); 
             }
         }
-        MPI_Allreduce(&local_rep, &global_rep, 1, MPI_INT, MPI_LOR, comm);
 
-        // Stop if no more data to process
-        if (!global_rep) break;
+        // Keep receiving until every other rank has ended its stream
+        while (ends < size - 1) {
+            poll(); 
+        }
+        for (auto& pool : requests) {
+            MPI_Waitall(SHUFFLE_BUFFERS, pool.data(), MPI_STATUSES_IGNORE); 
+        }
+        MPI_Waitall(endRequests.size(), endRequests.data(), MPI_STATUSES_IGNORE); 
+    }
 
-        // increase number of rep 
-        ++reps; 
+private: 
+
+    void post(int dest) {
+
+        // Send the filling buffer and move to the next buffer of the pool 
+        int current = filling[dest]; 
+        trace::span tracing("batch send", "shuffle", buffers[dest][current].size()); 
+        MPI_Isend(
+            buffers[dest][current].data(), buffers[dest][current].size(), MPI_CHAR, 
+            dest, TAG_DATA, comm, &requests[dest][current]
+        ); 
+        int next = (current + 1) % SHUFFLE_BUFFERS; 
+        filling[dest] = next; 
+
+        // Wait for the previous send of the next buffer, still serving incoming buffers
+        int done = 0; 
+        MPI_Test(&requests[dest][next], &done, MPI_STATUS_IGNORE); 
+        while (!done) {
+            poll(); 
+            MPI_Test(&requests[dest][next], &done, MPI_STATUS_IGNORE); 
+        }
+        buffers[dest][next].clear(); 
+    }
 
-        vector<char> sendBuffer;
-        sendBuffer.reserve(byte_limit);
+    void poll() {
 
-        vector<int> sendCounts(size, 0), sendDispls(size, 0);
-        vector<int> recvCounts(size, 0), recvDispls(size, 0);
+        // Receive and unpack every buffer already arrived
+        int flag = 1; 
+        while (flag) {
+            MPI_Status status; 
+            MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, comm, &flag, &status); 
+            if (!flag) break; 
 
-        // Pack data into sendBuffer
-        for (size_t i = 0; i < size; ++i) {
-            int prev_size = sendBuffer.size();
-            size_t num_elements_to_send = min(elements[i].size(), static_cast<size_t>(num_elem_per_rank));
+            int count; 
+            MPI_Get_count(&status, MPI_CHAR, &count); 
+            recvBuffer.resize(count); 
+            MPI_Recv(recvBuffer.data(), count, MPI_CHAR, status.MPI_SOURCE, status.MPI_TAG, comm, MPI_STATUS_IGNORE); 
 
-            for (size_t j = 0; j < num_elements_to_send; ++j) {
-                element_t& elem = elements[i][j];
-                sendBuffer.resize(sendBuffer.size() + sizeof(element_t));
-                memcpy(sendBuffer.data() + sendBuffer.size() - sizeof(element_t), &elem, sizeof(element_t));
+            if (status.MPI_TAG == TAG_END) {
+                ++ends; 
+                continue; 
+            }
+            trace::span tracing("receive batch", "shuffle", count); 
+            const char* recvPtr = recvBuffer.data(); 
+            const char* recvEnd = recvPtr + count; 
+            while (recvPtr < recvEnd) {
+                element_t elem; 
+                recvPtr = unpackElement(recvPtr, elem); 
+                insertElement(umap, elem); 
             }
-            
-            sendCounts[i] = sendBuffer.size() - prev_size;
-            sendDispls[i] = prev_size;
-
-            // Clear and free memory for the sent elements
-            elements[i].erase(elements[i].begin(), elements[i].begin() + num_elements_to_send);
-            elements[i].shrink_to_fit();
         }
-
-        sBuffer.push_back(sendBuffer); 
-        sCounts.push_back(sendCounts); 
-        sDispls.push_back(sendDispls); 
     }
 
-    vector<vector<char>> rBuffer(reps); 
-    vector<vector<int>> rCounts(reps, vector<int>(size, 0)); 
-    vector<vector<int>> rDispls(reps, vector<int>(size, 0));
-    
-    MPI_Request requests[reps];
-    MPI_Status statuses[reps];
-
-    for (size_t r =0; r < reps; ++r){
-        
-        // Exchange counts 
-        MPI_Alltoall(
-            sCounts[r].data(), 1, MPI_INT,
-            rCounts[r].data(), 1, MPI_INT,
-            comm
-        );
+    MPI_Comm comm; 
+    int size, rank; 
+    bucketIndex& umap; 
+    vector<vector<vector<char>>> buffers;   // Send buffers pool for each destination rank
+    vector<vector<MPI_Request>> requests;   // Pending send of each buffer 
+    vector<int> filling;                    // Buffer being filled for each destination rank 
+    vector<char> recvBuffer;                // Receive buffer 
+    vector<char> localBuffer;               // Encoding of local elements (lossy codec only)
+    int ends;                               // Num of ranks whose stream is over
+};
 
-        // Calculate recv displacements and total receive size
-        int recv_size = 0;
-        for (size_t i = 0; i < size; ++i) {
-            rDispls[r][i] = (i == 0) ? 0 : rDispls[r][i - 1] + rCounts[r][i - 1];
-            recv_size += rCounts[r][i];
-        }
+void mapShufflePhase (MPI_Comm comm, int size, int rank, stringstream& chunk, bucketIndex& umap){
 
-        // Exchange data
-        rBuffer[r].resize(recv_size);
-        MPI_Ialltoallv(
-            sBuffer[r].data(), sCounts[r].data(), sDispls[r].data(), MPI_CHAR,
-            rBuffer[r].data(), rCounts[r].data(), rDispls[r].data(), MPI_CHAR,
-            comm, &requests[r]
-        );
+    // Build LSH function family
+    FrechetLSH lsh_family[LSH_FAMILY_SIZE];
+    for (size_t i = 0; i < LSH_FAMILY_SIZE; i++){
+        lsh_family[i].init(LSH_RESOLUTION, LSH_SEED * i, i);
     }
+    
+    shuffleStream stream(comm, size, rank, umap); 
 
-    MPI_Waitall(reps, requests, statuses);
+    // Iterate chunk line-by-line (counters of the map phase include streaming elements out)
+    metrics::counters mapping(metrics::HW_MAP); 
+    trace::span tracing("map chunk", "map"); 
+    string line; 
+    while(getline(chunk, line)){
 
-    for(size_t r =0; r < reps; ++r){
+        // Parse a line 
+        metrics::scope parsing(metrics::PARSE); 
+        metrics::count(metrics::LINES); 
+        item it = parseLine(line); 
+        parsing.stop(); 
         
-        // Unpack received data into umap
-        int num_elements = static_cast<int>(rBuffer[r].size()) / static_cast<int>(sizeof(element_t));
-        for (int j = 0; j < num_elements; ++j) {
-            element_t elem;
-            memcpy(&elem, rBuffer[r].data() + j * sizeof(element_t), sizeof(element_t));
-            umap[elem.LSH].push_back(elem);
+        // Compute LSH values for each LSH function
+        metrics::scope hashing(metrics::HASH); 
+        array<long, LSH_FAMILY_SIZE> relative_lshs;
+        for (size_t i = 0; i < LSH_FAMILY_SIZE; i++){
+            relative_lshs[i] = lsh_family[i].hash(it.content);
+        }
+        metrics::count(metrics::ELEMENTS, LSH_FAMILY_SIZE); 
+        hashing.stop(); 
+
+        // Group LSH values by destination rank 
+        int out_ranks[LSH_FAMILY_SIZE]; 
+        uint32_t out_masks[LSH_FAMILY_SIZE]; 
+        int num_out = 0; 
+        for (size_t i = 0; i < LSH_FAMILY_SIZE; i++){
+            int out_rank = relative_lshs[i] % size; 
+            int j = 0; 
+            while (j < num_out && out_ranks[j] != out_rank) ++j; 
+            if (j == num_out) {
+                out_ranks[num_out] = out_rank; 
+                out_masks[num_out++] = 0; 
+            }
+            out_masks[j] |= 1u << i; 
+        }
+
+        // Stream one copy of the trajectory to each destination rank
+        metrics::scope shuffling(metrics::SHUFFLE); 
+        for (int j = 0; j < num_out; j++){
+            stream.push(out_ranks[j], element_t(it.dataset, it.content, relative_lshs, it.id, out_masks[j]));
         }
     }
 
-    return; 
+    // Free memory of chunk
+    chunk.str(""); 
+    chunk.clear(); 
+
+    // Flush send buffers and drain incoming ones
+    mapping.stop(); 
+    tracing.stop(); 
+    metrics::scope shuffling(metrics::SHUFFLE); 
+    metrics::counters draining(metrics::HW_SHUFFLE); 
+    trace::span drain("drain stream", "shuffle"); 
+    stream.finish(); 
 }
 
-unordered_map<long, vector<element_t>> process_in_batch(MPI_Comm comm, int size, int rank, const char* inFileMapped, const size_t& inFileBytes, double& time_distr){
+bucketIndex process_in_batch(MPI_Comm comm, int size, int rank, const char* inFileMapped, const size_t& inFileBytes, double& time_distr){
 
     // Final map of elements for each process 
-    unordered_map<long, vector<element_t>> umap; 
+    bucketIndex umap; 
 
     MPI_Barrier(comm); 
     double start_time_batch = MPI_Wtime(); 
@@ -440,11 +585,8 @@ unordered_map<long, vector<element_t>> process_in_batch(MPI_Comm comm, int size,
         double end_time_distr_r = MPI_Wtime(); 
         double time_distr_r = end_time_distr_r - start_time_distr_r; 
 
-        // Map phase: compute LSH values 
-        vector<vector<element_t>> elements = mapPhase(size, rank, chunk, numLines); 
-
-        // Shuffle phase: 
-        shufflePhase(comm, size, rank, elements, umap); 
+        // Map and shuffle phases: compute LSH values and stream them to destination ranks
+        mapShufflePhase(comm, size, rank, chunk, umap); 
 
         // Update index of input file to process next batch
         start_byte += static_cast<size_t>(chars_counts[r]);
@@ -457,19 +599,28 @@ unordered_map<long, vector<element_t>> process_in_batch(MPI_Comm comm, int size,
 }
 
 
-void reducePhase(MPI_Comm comm, int size, int rank, unordered_map<long, vector<element_t>>& elementsReceived){
-
-    for (auto& [lsh, elements_v] : elementsReceived) {
-        for (size_t i = 0; i < elements_v.size(); i++) {
-            for (size_t j = i + 1; j < elements_v.size(); j++) {
-                if (elements_v[i].dataSet != elements_v[j].dataSet) {
-                    checkHelper(lsh, elements_v[i], elements_v[j]);
+void reducePhase(MPI_Comm comm, int size, int rank, bucketIndex& elementsReceived){
+
+    metrics::count(metrics::BUCKETS, elementsReceived.buckets.size()); 
+    metrics::scope joining(metrics::JOIN); 
+    metrics::counters joins(metrics::HW_JOIN); 
+    const vector<element_t>& elements = elementsReceived.elements; 
+    for (auto& [lsh, refs] : elementsReceived.buckets) {
+        if (refs.size() < 2) continue; 
+        trace::span tracing("join bucket", "join", refs.size()); 
+        for (size_t i = 0; i < refs.size(); i++) {
+            const element_t& a = elements[refs[i]]; 
+            for (size_t j = i + 1; j < refs.size(); j++) {
+                const element_t& b = elements[refs[j]]; 
+                if (a.dataSet != b.dataSet) {
+                    checkHelper(lsh, a, b);
                 }
             }
         }
     }
 
     // Aggregate total number of founded pairs in root process 
+    trace::span reduce("MPI_Reduce", "mpi"); 
     MPI_Reduce(&foundSimilar, &foundSimilarTot, 1, MPI_UNSIGNED, MPI_SUM, 0, comm);    
     
     return; 
@@ -498,16 +649,22 @@ void outputPairs(MPI_Comm comm, int size, int rank, ostream* resultsStream){
     
     // Perform MPI_Gatherv to gather data on the root process (rank 0)
     simPairsTot.resize(tot_recvSize); 
+    trace::span gatherv("MPI_Gatherv", "mpi", count); 
     MPI_Gatherv(
         simPairs.data(), count, MPI_LONG,
         simPairsTot.data(), recv_counts.data(), displs.data(), MPI_LONG,
         0, comm
     );
+    gatherv.stop(); 
  
     // Output pairs in outstream with root process
     if (!rank) {
-        for (size_t i = 0; i < simPairsTot.size(); i += 2) {
+        for (size_t i = 0; i < simPairsTot.size(); i += PAIR_WORDS) {
+#ifdef REPORT_DISTANCE
+            *resultsStream << simPairsTot[i] << "\t" << simPairsTot[i+1] << "\t" << bit_cast<double>(simPairsTot[i+2]) << endl;
+#else
             *resultsStream << simPairsTot[i] << "\t" << simPairsTot[i+1] << endl;
+#endif
         }
     }
     return; 
@@ -535,6 +692,7 @@ int main(int argc, char* argv[]) {
     int rank, size;
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
+    trace::sync(MPI_COMM_WORLD); 
 
     // Get processors/nodes names
     char processor_name[MPI_MAX_PROCESSOR_NAME];
@@ -609,7 +767,7 @@ int main(int argc, char* argv[]) {
     double end_time_mapfile = MPI_Wtime(); 
     
     // Perform chunk distribution, map phase and shuffle-communication phase in batch 
-    unordered_map<long, vector<element_t>> elementsReceived = process_in_batch (MPI_COMM_WORLD, size, rank, inFileMapped, inFileBytes, time_distr);
+    bucketIndex elementsReceived = process_in_batch (MPI_COMM_WORLD, size, rank, inFileMapped, inFileBytes, time_distr);
     
     // Unmap input file in root process 
     
@@ -629,7 +787,9 @@ int main(int argc, char* argv[]) {
     start_time_out = MPI_Wtime(); 
 
     // Write to similar pairs to output file
+    metrics::scope writing(metrics::OUTPUT); 
     outputPairs(MPI_COMM_WORLD, size, rank, resultsStream);
+    writing.stop(); 
     
     // Stop mesuring total elapsed time
     MPI_Barrier(MPI_COMM_WORLD);
@@ -641,6 +801,8 @@ int main(int argc, char* argv[]) {
     double time_unmapfile = end_time_unmapfile - start_time_unmapfile; 
     double elapsed_time = end_time - start_time;                   
     double elapsed_time_distr = time_distr + time_mapfile + time_unmapfile;
+    metrics::add(metrics::READ, elapsed_time_distr); 
+    metrics::count(metrics::MATCHES, foundSimilar); 
     double elapsed_time_out = end_time_out - start_time_out;
 
     // Results for metrics computation
@@ -658,6 +820,8 @@ int main(int argc, char* argv[]) {
         endl; 
 
     }
+    metrics::report("mpi_nb", argv[1], MPI_COMM_WORLD); 
+    trace::write(MPI_COMM_WORLD); 
 
     // MPI environment finalization
     MPI_Finalize(); 
@@ -20,6 +20,7 @@
 #include <sys/mman.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <getopt.h>
 
 // Others utilities 
 #include <cstdio>
@@ -35,15 +36,28 @@
 #include <utility>
 #include <algorithm>
 #include <unordered_map>
+#include <bit>
 
 // Message Passing Interface (MPI) lib
 #include <mpi.h>
 
+// OpenMP lib
+#include <omp.h>
+
 // Custom headers for geometric operations
 #include "hash.hpp"
 #include "geometry_basics.hpp"
 #include "frechet_distance.hpp"
 
+// Wire format of shuffled trajectories
+#include "trajectory_codec.hpp"
+
+// Per-phase metrics (LSHSJ_METRICS)
+#include "metrics.hpp"
+
+// Timeline of threads and ranks (LSHSJ_TRACE)
+#include "trace.hpp"
+
 using namespace std;
 
 #define LSH_FAMILY_SIZE 8     // Number of LSH functions
@@ -54,6 +68,20 @@ using namespace std;
 const static double SIM_THRESHOLD = 10;
 const static double SIM_THRESHOLD_SQR = sqr(SIM_THRESHOLD);
 
+// Coordinates codec for shuffled trajectories: raw doubles, or fixed-point deltas (make DELTA=scale)
+#ifdef WIRE_DELTA_SCALE
+const static wire::codec_t WIRE_CODEC{wire::DELTA, WIRE_DELTA_SCALE};
+#else
+const static wire::codec_t WIRE_CODEC = wire::RAW_CODEC;
+#endif
+
+// Words of a similar pair in the flattened pairs: ids [, bits of the Frechet distance] (make DISTANCE=1)
+#ifdef REPORT_DISTANCE
+#define PAIR_WORDS 3
+#else
+#define PAIR_WORDS 2
+#endif
+
 size_t foundSimilar = 0; 
 size_t foundSimilarTot; 
 vector<long> simPairs; 
@@ -67,20 +95,66 @@ struct item {
 
 struct element_t {
     
-    long LSH;           // LSH values           
     int dataSet;        // Dataset identifier
     curve trajectory;   // Curve representing the trajectory
     array<long, LSH_FAMILY_SIZE> relativeLSHs; // LSH values for the LSH function 
     long id;            // Unique identifier 
+    uint32_t bucketMask; // Positions of relativeLSHs whose bucket lives on the destination rank
     
     // Constructor
     element_t() = default;
-    element_t(long hash, int dataset, curve trajectory, decltype(relativeLSHs) relativeLSHs, long id)
-        : LSH(hash), dataSet(dataset), trajectory(trajectory), relativeLSHs(relativeLSHs), id(id) {}
+    element_t(int dataset, curve trajectory, decltype(relativeLSHs) relativeLSHs, long id, uint32_t bucketMask)
+        : dataSet(dataset), trajectory(trajectory), relativeLSHs(relativeLSHs), id(id), bucketMask(bucketMask) {}
     
 };
 
-item parseLine(string& line) {
+static_assert(LSH_FAMILY_SIZE <= 32, "bucketMask holds one bit per LSH function");
+
+// Elements received by a process: each trajectory is stored once and 
+// every LSH bucket references it by its position in the elements vector
+struct bucketIndex {
+    vector<element_t> elements; 
+    unordered_map<long, vector<uint32_t>> buckets; 
+};
+
+void insertElement(bucketIndex& index, const element_t& elem) {
+
+    // Rebuild bucket membership of a received trajectory
+    uint32_t ref = static_cast<uint32_t>(index.elements.size()); 
+    index.elements.push_back(elem); 
+    for (size_t i = 0; i < LSH_FAMILY_SIZE; ++i) {
+        if (elem.bucketMask & (1u << i)) {
+            index.buckets[elem.relativeLSHs[i]].push_back(ref); 
+        }
+    }
+}
+
+// Upper bound on the bytes written by packElement
+constexpr size_t MAX_ELEMENT_BYTES = wire::MAX_TRAJECTORY_BYTES + (LSH_FAMILY_SIZE + 1) * wire::MAX_VARINT_BYTES; 
+
+void packElement(vector<char>& buffer, const element_t& elem) {
+
+    // Only the points of the trajectory are sent, prefix lengths are rebuilt on unpack
+    wire::put_trajectory(buffer, elem.id, elem.dataSet, elem.trajectory, WIRE_CODEC); 
+    for (long h : elem.relativeLSHs) {
+        wire::put_varint(buffer, h); 
+    }
+    wire::put_varint(buffer, elem.bucketMask); 
+}
+
+const char* unpackElement(const char* p, element_t& elem) {
+
+    uint64_t id; 
+    wire::get_trajectory(p, id, elem.dataSet, elem.trajectory, WIRE_CODEC); 
+    elem.id = static_cast<long>(id); 
+    for (long& h : elem.relativeLSHs) {
+        h = static_cast<long>(wire::get_varint(p)); 
+    }
+    elem.bucketMask = static_cast<uint32_t>(wire::get_varint(p)); 
+    return p; 
+}
+
+item parseLine(const string& line) {
 
     // Parse a line of the input dataset as an item 
     istringstream ss(line);
@@ -128,19 +202,19 @@ bool similarity_test(const curve& c1, const curve& c2) {
     return false;
 }
 
-inline void checkHelper(const long lsh, const element_t& a, const element_t& b) {
+inline void checkHelper(const long lsh, const element_t& a, const element_t& b, vector<long>& pairs) {
 
     for (size_t ii = 0; ii < a.relativeLSHs.size(); ii++) {
         if (a.relativeLSHs[ii] == b.relativeLSHs[ii]) {
             if (lsh == a.relativeLSHs[ii]) {
+                metrics::count(metrics::CANDIDATES);
                 if (similarity_test(a.trajectory, b.trajectory)) {
-                    #pragma omp critical 
-                    {
-                        simPairs.push_back(a.id);
-                        simPairs.push_back(b.id); 
-                        ++foundSimilar;
-                    }
-                    
+                    // Pairs are accumulated in the calling thread's vector
+                    pairs.push_back(a.id);
+                    pairs.push_back(b.id);
+#ifdef REPORT_DISTANCE
+                    pairs.push_back(bit_cast<long>(get_frechet_distance_within(a.trajectory, b.trajectory, SIM_THRESHOLD)));
+#endif
                 }
             }
             return;
@@ -206,9 +280,7 @@ void init_infile_batch (
     return; 
 }
 
-stringstream distributeChunks(MPI_Comm comm, int size, int rank, size_t start_line, size_t start_byte, vector<int>& charsPerLines, int& numLines,  const char* inFileMapped ) {
-
-    stringstream chunk; 
+vector<char> distributeChunks(MPI_Comm comm, int size, int rank, size_t start_line, size_t start_byte, vector<int>& charsPerLines, int& numLines,  const char* inFileMapped ) {
 
     // Count and displacements for scatter ops
     vector<int> counts_send(size, 0); 
@@ -235,11 +307,13 @@ stringstream distributeChunks(MPI_Comm comm, int size, int rank, size_t start_li
     }
 
     // Scatter to each process the num of chars they will receive
+    trace::span scatter("MPI_Scatter", "mpi"); 
     MPI_Scatter(
         counts_send.data(), 1, MPI_INT,
         &counts_recv, 1, MPI_INT, 
         0, comm
     );
+    scatter.stop(); 
     
     // Get InFileMapped displacement (for the current input file partition) 
     const char* inFileMapped_displ = &inFileMapped[start_byte];
@@ -248,69 +322,120 @@ stringstream distributeChunks(MPI_Comm comm, int size, int rank, size_t start_li
     vector<char> chunkBuffer (counts_recv); 
     
     // Scatter chunk of input file (chars) to other process 
+    trace::span scatterv("MPI_Scatterv", "mpi", counts_recv); 
     MPI_Scatterv(
         inFileMapped_displ, counts_send.data(), displs_send.data(), MPI_CHAR,
         chunkBuffer.data(), counts_recv, MPI_CHAR, 
         0, comm
     );
+    scatterv.stop(); 
 
-    // write to stringstream 
-    chunk.write(chunkBuffer.data(), counts_recv); 
-
-    return chunk; 
+    return chunkBuffer; 
 }
 
-vector<vector<element_t>> mapPhase (int size, int rank, stringstream& chunk, int& numLines){
+vector<vector<element_t>> mapPhase (int size, int rank, vector<char>& chunk, int& numLines){
 
     // Build LSH function family
     FrechetLSH lsh_family[LSH_FAMILY_SIZE];
     for (size_t i = 0; i < LSH_FAMILY_SIZE; i++){
         lsh_family[i].init(LSH_RESOLUTION, LSH_SEED * i, i);
     }
-    
-    // Final vector of elements aggregated by destination rank
-    vector<vector<element_t>> elements(size);
 
-    vector<string> lines;
-    string line;
-    while (getline(chunk, line)) {
-        lines.push_back(line);
+    // Offsets of the lines in the receive buffer (last one is the end of the buffer)
+    vector<size_t> lineOffsets; 
+    lineOffsets.reserve(numLines / max(size, 1) + 2); 
+    lineOffsets.push_back(0); 
+    for (size_t i = 0; i < chunk.size(); ++i) {
+        if (chunk[i] == '\n') lineOffsets.push_back(i + 1); 
     }
+    if (lineOffsets.back() != chunk.size()) lineOffsets.push_back(chunk.size()); 
+    size_t numChunkLines = lineOffsets.size() - 1; 
+
+    // Elements aggregated by destination rank, one set of buffers per thread
+    int numThreads = omp_get_max_threads(); 
+    vector<vector<vector<element_t>>> localElements(numThreads, vector<vector<element_t>>(size)); 
 
     // Parallel processing of lines
-    #pragma omp parallel for
-    for (size_t i = 0; i < lines.size(); i++) {
-        // Parse a line
-        item it = parseLine(lines[i]);
-
-        // Compute LSH values for each LSH function
-        array<long, LSH_FAMILY_SIZE> relative_lshs;
-        for (size_t j = 0; j < LSH_FAMILY_SIZE; j++) {
-            relative_lshs[j] = lsh_family[j].hash(it.content);
-        }
+    #pragma omp parallel
+    {
+        vector<vector<element_t>>& elements = localElements[omp_get_thread_num()]; 
+        metrics::counters mapping(metrics::HW_MAP); 
+        if (omp_get_thread_num()) trace::thread_name("omp thread " + to_string(omp_get_thread_num())); 
+        trace::span tracing("map lines", "map"); 
+        int64_t linesMapped = 0; 
+        string line; 
+
+        #pragma omp for schedule(dynamic, 256)
+        for (size_t i = 0; i < numChunkLines; i++) {
+
+            // Parse a line directly from the receive buffer
+            size_t begin = lineOffsets[i], end = lineOffsets[i + 1]; 
+            if (end > begin && chunk[end - 1] == '\n') --end; 
+            if (end == begin) continue; 
+            metrics::scope parsing(metrics::PARSE); 
+            metrics::count(metrics::LINES); 
+            ++linesMapped; 
+            line.assign(chunk.data() + begin, end - begin); 
+            item it = parseLine(line);
+            parsing.stop(); 
+
+            // Compute LSH values for each LSH function
+            metrics::scope hashing(metrics::HASH); 
+            array<long, LSH_FAMILY_SIZE> relative_lshs;
+            for (size_t j = 0; j < LSH_FAMILY_SIZE; j++) {
+                relative_lshs[j] = lsh_family[j].hash(it.content);
+            }
+            metrics::count(metrics::ELEMENTS, LSH_FAMILY_SIZE); 
+
+            // Group LSH values by destination rank 
+            int out_ranks[LSH_FAMILY_SIZE];
+            uint32_t out_masks[LSH_FAMILY_SIZE];
+            int num_out = 0;
+            for (size_t j = 0; j < LSH_FAMILY_SIZE; j++) {
+                int out_rank = relative_lshs[j] % size;
+                int k = 0;
+                while (k < num_out && out_ranks[k] != out_rank) ++k;
+                if (k == num_out) {
+                    out_ranks[num_out] = out_rank;
+                    out_masks[num_out++] = 0;
+                }
+                out_masks[k] |= 1u << j;
+            }
 
-        // Use a critical section to avoid race conditions when updating the shared elements vector
-        for (long h : relative_lshs) {
-            int out_rank = h % size;
-            #pragma omp critical
-            {
-                elements[out_rank].emplace_back(h, it.dataset, it.content, relative_lshs, it.id);
+            // Append to the thread-local buffers, no synchronization needed
+            for (int k = 0; k < num_out; k++) {
+                elements[out_ranks[k]].emplace_back(it.dataset, it.content, relative_lshs, it.id, out_masks[k]);
             }
         }
+        tracing.set_count(linesMapped); 
     }
 
     // Free memory of chunk
-    chunk.str(""); 
     chunk.clear(); 
+    chunk.shrink_to_fit(); 
+
+    // Merge thread-local buffers once, one destination rank per iteration
+    vector<vector<element_t>> elements(size);
+    #pragma omp parallel for schedule(dynamic)
+    for (int r = 0; r < size; ++r) {
+        size_t count = 0; 
+        for (int t = 0; t < numThreads; ++t) count += localElements[t][r].size(); 
+        elements[r].reserve(count); 
+        for (int t = 0; t < numThreads; ++t) {
+            vector<element_t>& local = localElements[t][r]; 
+            elements[r].insert(elements[r].end(), make_move_iterator(local.begin()), make_move_iterator(local.end())); 
+            vector<element_t>().swap(local); 
+        }
+    }
 
     return elements; 
 }
 
-void shufflePhase(MPI_Comm comm, int size, int rank, vector<vector<element_t>>& elements, unordered_map<long, vector<element_t>>& umap) {
+template<typename Sink>
+void exchangeElements(MPI_Comm comm, int size, vector<vector<element_t>>& elements, int byte_limit, Sink sink) {
     
-    int byte_limit = numeric_limits<int>::max();
     int byte_limit_per_rank = byte_limit / size;
-    int num_elem_per_rank = byte_limit_per_rank / static_cast<int>(sizeof(element_t));
+    size_t pack_limit_per_rank = byte_limit_per_rank - MAX_ELEMENT_BYTES;
 
     while (true) {
         int local_rep = 0, global_rep;
@@ -322,10 +447,13 @@ void shufflePhase(MPI_Comm comm, int size, int rank, vector<vector<element_t>>&
                 break;
             }
         }
+        trace::span allreduce("MPI_Allreduce", "mpi"); 
         MPI_Allreduce(&local_rep, &global_rep, 1, MPI_INT, MPI_LOR, comm);
+        allreduce.stop(); 
 
         // Stop if no more data to process
         if (!global_rep) break;
+        trace::span batch("shuffle batch", "shuffle"); 
 
         vector<char> sendBuffer;
         sendBuffer.reserve(byte_limit);
@@ -336,12 +464,11 @@ void shufflePhase(MPI_Comm comm, int size, int rank, vector<vector<element_t>>&
         // Pack data into sendBuffer
         for (size_t i = 0; i < size; ++i) {
             int prev_size = sendBuffer.size();
-            size_t num_elements_to_send = min(elements[i].size(), static_cast<size_t>(num_elem_per_rank));
+            size_t num_elements_to_send = 0;
 
-            for (size_t j = 0; j < num_elements_to_send; ++j) {
-                element_t& elem = elements[i][j];
-                sendBuffer.resize(sendBuffer.size() + sizeof(element_t));
-                memcpy(sendBuffer.data() + sendBuffer.size() - sizeof(element_t), &elem, sizeof(element_t));
+            // Pack elements until the per-rank byte limit could be exceeded
+            while (num_elements_to_send < elements[i].size() && sendBuffer.size() - prev_size <= pack_limit_per_rank) {
+                packElement(sendBuffer, elements[i][num_elements_to_send++]);
             }
             
             sendCounts[i] = sendBuffer.size() - prev_size;
@@ -353,7 +480,9 @@ void shufflePhase(MPI_Comm comm, int size, int rank, vector<vector<element_t>>&
         }
  
         // Exchange counts
+        trace::span alltoall("MPI_Alltoall", "mpi"); 
         MPI_Alltoall(sendCounts.data(), 1, MPI_INT, recvCounts.data(), 1, MPI_INT, comm);
+        alltoall.stop(); 
 
         // Calculate recv displacements and total receive size
         int recv_size = 0;
@@ -364,18 +493,21 @@ void shufflePhase(MPI_Comm comm, int size, int rank, vector<vector<element_t>>&
 
         // Exchange data
         vector<char> recvBuffer(recv_size);
+        trace::span alltoallv("MPI_Alltoallv", "mpi", sendBuffer.size()); 
         MPI_Alltoallv(
             sendBuffer.data(), sendCounts.data(), sendDispls.data(), MPI_CHAR,
             recvBuffer.data(), recvCounts.data(), recvDispls.data(), MPI_CHAR,
             comm
         );
+        alltoallv.stop(); 
 
-        // Unpack received data into umap
-        int num_elements = recv_size / static_cast<int>(sizeof(element_t));
-        for (int j = 0; j < num_elements; ++j) {
+        // Unpack received data
+        const char* recvPtr = recvBuffer.data();
+        const char* recvEnd = recvPtr + recv_size;
+        while (recvPtr < recvEnd) {
             element_t elem;
-            memcpy(&elem, recvBuffer.data() + j * sizeof(element_t), sizeof(element_t));
-            umap[elem.LSH].push_back(elem);
+            recvPtr = unpackElement(recvPtr, elem);
+            sink(elem);
         }
     }
 
@@ -388,10 +520,86 @@ void shufflePhase(MPI_Comm comm, int size, int rank, vector<vector<element_t>>&
     elements.shrink_to_fit();
 }
 
-unordered_map<long, vector<element_t>> process_in_batch(MPI_Comm comm, int size, int rank, const char* inFileMapped, const size_t& inFileBytes, double& time_distr){
+void shufflePhase(MPI_Comm comm, int size, int rank, vector<vector<element_t>>& elements, bucketIndex& umap) {
+
+    // Master thread packs, exchanges and unpacks into umap
+    exchangeElements(comm, size, elements, numeric_limits<int>::max(), [&](element_t& elem) { 
+        insertElement(umap, elem); 
+    }); 
+}
+
+void shufflePhaseMultiple(vector<MPI_Comm>& threadComms, int size, int rank, vector<vector<element_t>>& elements, bucketIndex& umap) {
+
+    // Split the elements of each destination rank in one slice per thread 
+    int numThreads = threadComms.size(); 
+    vector<vector<vector<element_t>>> slices(numThreads, vector<vector<element_t>>(size)); 
+    for (int r = 0; r < size; ++r) {
+        size_t n = elements[r].size(); 
+        for (int t = 0; t < numThreads; ++t) {
+            auto first = elements[r].begin() + n * t / numThreads; 
+            auto last = elements[r].begin() + n * (t + 1) / numThreads; 
+            slices[t][r].assign(make_move_iterator(first), make_move_iterator(last)); 
+        }
+    }
+    elements.clear(); 
+    elements.shrink_to_fit(); 
+
+    // Each thread packs, exchanges and unpacks slices on their own communicator: slice s of every 
+    // process meets slice s of the other processes on threadComms[s]. If the runtime gives fewer 
+    // threads than requested, a thread takes several slices in increasing order, so that every 
+    // communicator is still used once per process and no exchange waits on a later one 
+    vector<vector<element_t>> received(numThreads); 
+    #pragma omp parallel num_threads(numThreads)
+    {
+        for (int s = omp_get_thread_num(); s < numThreads; s += omp_get_num_threads()) {
+            exchangeElements(threadComms[s], size, slices[s], numeric_limits<int>::max() / numThreads, [&](element_t& elem) { 
+                received[s].push_back(move(elem)); 
+            }); 
+        }
+    }
+
+    // Move the decoded elements to the index, each slice to its own range
+    size_t base = umap.elements.size(); 
+    vector<size_t> offsets(numThreads + 1, base); 
+    for (int s = 0; s < numThreads; ++s) {
+        offsets[s + 1] = offsets[s] + received[s].size(); 
+    }
+    umap.elements.resize(offsets[numThreads]); 
+    #pragma omp parallel for schedule(static, 1)
+    for (int s = 0; s < numThreads; ++s) {
+        move(received[s].begin(), received[s].end(), umap.elements.begin() + offsets[s]); 
+        vector<element_t>().swap(received[s]); 
+    }
+
+    // Link them to their buckets: one shard of keys per thread, then shards merged by key 
+    // (refs stay in increasing order within a bucket, as with insertElement)
+    int numShards = omp_get_max_threads(); 
+    vector<unordered_map<long, vector<uint32_t>>> shards(numShards); 
+    #pragma omp parallel for schedule(static, 1)
+    for (int k = 0; k < numShards; ++k) {
+        for (size_t ref = base; ref < umap.elements.size(); ++ref) {
+            const element_t& elem = umap.elements[ref]; 
+            for (size_t i = 0; i < LSH_FAMILY_SIZE; ++i) {
+                long lsh = elem.relativeLSHs[i]; 
+                if ((elem.bucketMask & (1u << i)) && static_cast<uint64_t>(lsh) % numShards == static_cast<uint64_t>(k)) {
+                    shards[k][lsh].push_back(static_cast<uint32_t>(ref)); 
+                }
+            }
+        }
+    }
+    for (auto& shard : shards) {
+        for (auto& [lsh, refs] : shard) {
+            vector<uint32_t>& bucket = umap.buckets[lsh]; 
+            if (bucket.empty()) bucket = move(refs); 
+            else bucket.insert(bucket.end(), refs.begin(), refs.end()); 
+        }
+    }
+}
+
+bucketIndex process_in_batch(MPI_Comm comm, int size, int rank, const char* inFileMapped, const size_t& inFileBytes, vector<MPI_Comm>& threadComms, double& time_distr, double& time_map, double& time_shuffle){
 
     // Final map of elements for each process 
-    unordered_map<long, vector<element_t>> umap; 
+    bucketIndex umap; 
 
     MPI_Barrier(comm); 
     double start_time_batch = MPI_Wtime(); 
@@ -422,16 +630,26 @@ unordered_map<long, vector<element_t>> process_in_batch(MPI_Comm comm, int size,
         MPI_Barrier(comm); 
         double start_time_distr_r = MPI_Wtime(); 
         int numLines = lines_counts[r]; 
-        stringstream chunk = distributeChunks(comm, size, rank, start_line, start_byte, charsPerLines, numLines, inFileMapped);
+        vector<char> chunk = distributeChunks(comm, size, rank, start_line, start_byte, charsPerLines, numLines, inFileMapped);
         MPI_Barrier(comm); 
         double end_time_distr_r = MPI_Wtime(); 
         double time_distr_r = end_time_distr_r - start_time_distr_r; 
 
         // Map phase: compute LSH values 
+        double start_time_map_r = MPI_Wtime(); 
         vector<vector<element_t>> elements = mapPhase(size, rank, chunk, numLines); 
-
-        // Shuffle phase: 
-        shufflePhase(comm, size, rank, elements, umap); 
+        time_map += MPI_Wtime() - start_time_map_r; 
+
+        // Shuffle phase: with one communicator per thread if MPI_THREAD_MULTIPLE is in use
+        metrics::counters shuffling(metrics::HW_SHUFFLE); 
+        double start_time_shuffle_r = MPI_Wtime(); 
+        if (threadComms.empty()) {
+            shufflePhase(comm, size, rank, elements, umap); 
+        } else {
+            shufflePhaseMultiple(threadComms, size, rank, elements, umap); 
+        }
+        time_shuffle += MPI_Wtime() - start_time_shuffle_r; 
+        metrics::add(metrics::SHUFFLE, MPI_Wtime() - start_time_shuffle_r); 
 
         // Update index of input file to process next batch
         start_byte += static_cast<size_t>(chars_counts[r]);
@@ -443,28 +661,44 @@ unordered_map<long, vector<element_t>> process_in_batch(MPI_Comm comm, int size,
 
 }
 
-void reducePhase( MPI_Comm comm, int size, int rank, unordered_map<long, vector<element_t>>& elementsReceived){
+void reducePhase( MPI_Comm comm, int size, int rank, bucketIndex& elementsReceived){
 
     // Store in a vector all keys 
     vector<long> keys;
-    keys.reserve(elementsReceived.size());
-    for (auto& pair : elementsReceived) {
+    keys.reserve(elementsReceived.buckets.size());
+    for (auto& pair : elementsReceived.buckets) {
         keys.push_back(pair.first);
     }
 
-    // Compute similarity join
-    #pragma omp parallel for reduction(+:foundSimilar)
-    for (size_t k = 0; k < keys.size(); ++k) {
-        long lsh = keys[k];
-        auto& elements_v = elementsReceived[lsh];
-        for (size_t i = 0; i < elements_v.size(); i++) {
-            for (size_t j = i + 1; j < elements_v.size(); j++) {
-                if (elements_v[i].dataSet != elements_v[j].dataSet) {
-                    checkHelper(lsh, elements_v[i], elements_v[j]);
+    // Compute similarity join, each thread collects its own pairs 
+    metrics::count(metrics::BUCKETS, keys.size()); 
+    const vector<element_t>& elements = elementsReceived.elements;
+    #pragma omp parallel
+    {
+        metrics::scope joining(metrics::JOIN); 
+        metrics::counters joins(metrics::HW_JOIN); 
+        vector<long> pairs; 
+
+        #pragma omp for schedule(dynamic) nowait
+        for (size_t k = 0; k < keys.size(); ++k) {
+            long lsh = keys[k];
+            const vector<uint32_t>& refs = elementsReceived.buckets.find(lsh)->second;
+            if (refs.size() < 2) continue; 
+            trace::span tracing("join bucket", "join", refs.size()); 
+            for (size_t i = 0; i < refs.size(); i++) {
+                for (size_t j = i + 1; j < refs.size(); j++) {
+                    if (elements[refs[i]].dataSet != elements[refs[j]].dataSet) {
+                        checkHelper(lsh, elements[refs[i]], elements[refs[j]], pairs);
+                    }
                 }
             }
         }
+
+        // Merge thread-local pairs once
+        #pragma omp critical
+        simPairs.insert(simPairs.end(), pairs.begin(), pairs.end()); 
     }
+    foundSimilar = simPairs.size() / PAIR_WORDS; 
 
     /*
     for (auto& [lsh, elements_v] : elementsReceived) {
@@ -480,6 +714,7 @@ void reducePhase( MPI_Comm comm, int size, int rank, unordered_map<long, vector<
     }
     */
     // Aggregate total number of founded pairs in root process 
+    trace::span reduce("MPI_Reduce", "mpi"); 
     MPI_Reduce(&foundSimilar, &foundSimilarTot, 1, MPI_UNSIGNED, MPI_SUM, 0, comm);    
     
     return; 
@@ -508,16 +743,22 @@ void outputPairs(MPI_Comm comm, int size, int rank, ostream* resultsStream){
     
     // Perform MPI_Gatherv to gather data on the root process (rank 0)
     simPairsTot.resize(tot_recvSize); 
+    trace::span gatherv("MPI_Gatherv", "mpi", count); 
     MPI_Gatherv(
         simPairs.data(), count, MPI_LONG,
         simPairsTot.data(), recv_counts.data(), displs.data(), MPI_LONG,
         0, comm
     );
+    gatherv.stop(); 
  
     // Output pairs in outstream with root process
     if (!rank) {
-        for (size_t i = 0; i < simPairsTot.size(); i += 2) {
+        for (size_t i = 0; i < simPairsTot.size(); i += PAIR_WORDS) {
+#ifdef REPORT_DISTANCE
+            *resultsStream << simPairsTot[i] << "\t" << simPairsTot[i+1] << "\t" << bit_cast<double>(simPairsTot[i+2]) << endl;
+#else
             *resultsStream << simPairsTot[i] << "\t" << simPairsTot[i+1] << endl;
+#endif
         }
     }
     return; 
@@ -527,20 +768,31 @@ int main(int argc, char* argv[]) {
 
     // Lambda function for usage description message 
     auto usage_and_exit = [argv]() {
-        printf("   use: %s inputFile [outputFile]\n", argv[0]);
+        printf("   use: %s [-m] inputFile [outputFile]\n", argv[0]);
         printf("   inputFile -> path to input file (required) \n");
-        printf("   outputFile -> path to ouput file (optional) \n\n");
+        printf("   outputFile -> path to ouput file (optional) \n");
+        printf("   -m -> multi-threaded shuffle, requires MPI_THREAD_MULTIPLE (default: funneled shuffle) \n\n");
         exit(-1);
     };
 
+    // Optional arguments
+    bool multiple = false; 
+    int opt; 
+    while ((opt = getopt(argc, argv, "m")) != -1) {
+        if (opt == 'm') multiple = true; 
+        else usage_and_exit(); 
+    }
+
     // Argument checking
-    if (argc < 2) {
+    if (argc - optind < 1) {
         usage_and_exit();
     }
+    const char* inFilename = argv[optind]; 
+    const char* outFilename = (argc - optind > 1) ? argv[optind + 1] : nullptr; 
 
     // MPI environment initialization
     int provided, flag, claimed; 
-    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+    MPI_Init_thread(&argc, &argv, multiple ? MPI_THREAD_MULTIPLE : MPI_THREAD_FUNNELED, &provided);
     
     // Check correct initialization 
     MPI_Is_thread_main(&flag);
@@ -549,7 +801,7 @@ int main(int argc, char* argv[]) {
         MPI_Abort(MPI_COMM_WORLD, -1);
     }
     MPI_Query_thread(&claimed);
-    if (claimed != provided) {
+    if (claimed != provided || provided < MPI_THREAD_FUNNELED) {
         printf("MPI_THREAD_FUNNELED not provided\n");
         MPI_Abort(MPI_COMM_WORLD, -1);
     }
@@ -558,6 +810,24 @@ int main(int argc, char* argv[]) {
     int rank, size;
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
+    trace::sync(MPI_COMM_WORLD); 
+
+    // Fall back to the funneled shuffle if MPI_THREAD_MULTIPLE is not provided 
+    if (multiple && provided < MPI_THREAD_MULTIPLE) {
+        if (!rank) fprintf(stderr, "MPI_THREAD_MULTIPLE not provided, using the funneled shuffle\n"); 
+        multiple = false; 
+    }
+
+    // One communicator per thread for the multi-threaded shuffle (same num of threads on every process)
+    vector<MPI_Comm> threadComms; 
+    if (multiple) {
+        int numThreads = omp_get_max_threads(); 
+        MPI_Allreduce(MPI_IN_PLACE, &numThreads, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD); 
+        threadComms.resize(numThreads); 
+        for (MPI_Comm& threadComm : threadComms) {
+            MPI_Comm_dup(MPI_COMM_WORLD, &threadComm); 
+        }
+    }
 
     // Get processors/nodes names
     char processor_name[MPI_MAX_PROCESSOR_NAME];
@@ -581,7 +851,9 @@ int main(int argc, char* argv[]) {
     double start_time, end_time;
     double start_time_read, end_time_read; 
     double start_time_out, end_time_out; 
-    double time_distr; 
+    double time_distr = 0; 
+    double time_map = 0; 
+    double time_shuffle = 0; 
 
     // Start measuring total elapsed time, and time for chunks distributions
     MPI_Barrier(MPI_COMM_WORLD); 
@@ -590,8 +862,8 @@ int main(int argc, char* argv[]) {
     // Set output stream
     ostream* resultsStream = &cout;
     ofstream filestream;
-    if (argc > 2) {
-        filestream = ofstream(argv[2]);
+    if (outFilename) {
+        filestream = ofstream(outFilename);
         if (filestream.is_open())
             resultsStream = &filestream;
     }
@@ -607,8 +879,7 @@ int main(int argc, char* argv[]) {
     if (!rank){
 
         // Open input file in read-only mode and store file descriptor
-        const string inFilename = argv[1];
-        int inFileDesc = open(inFilename.c_str(), O_RDONLY);
+        int inFileDesc = open(inFilename, O_RDONLY);
         
         // Get input file information using fstat 
         struct stat inFileStat;
@@ -628,7 +899,7 @@ int main(int argc, char* argv[]) {
     double end_time_mapfile = MPI_Wtime(); 
     
     // Perform chunk distribution, map phase and shuffle-communication phase in batch 
-    unordered_map<long, vector<element_t>> elementsReceived = process_in_batch (MPI_COMM_WORLD, size, rank, inFileMapped, inFileBytes, time_distr);
+    bucketIndex elementsReceived = process_in_batch (MPI_COMM_WORLD, size, rank, inFileMapped, inFileBytes, threadComms, time_distr, time_map, time_shuffle);
     
     // Unmap input file in root process 
     
@@ -648,7 +919,9 @@ int main(int argc, char* argv[]) {
     start_time_out = MPI_Wtime(); 
 
     // Write to similar pairs to output file
+    metrics::scope writing(metrics::OUTPUT); 
     outputPairs(MPI_COMM_WORLD, size, rank, resultsStream);
+    writing.stop(); 
     
     // Stop mesuring total elapsed time
     MPI_Barrier(MPI_COMM_WORLD);
@@ -660,25 +933,44 @@ int main(int argc, char* argv[]) {
     double time_unmapfile = end_time_unmapfile - start_time_unmapfile; 
     double elapsed_time = end_time - start_time;                   
     double elapsed_time_distr = time_distr + time_mapfile + time_unmapfile;
+    metrics::add(metrics::READ, elapsed_time_distr); 
+    metrics::count(metrics::MATCHES, foundSimilar); 
     double elapsed_time_out = end_time_out - start_time_out;
 
+    // Map time of the slowest process
+    double elapsed_time_map; 
+    MPI_Reduce(&time_map, &elapsed_time_map, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD); 
+
+    // Shuffle time of the slowest process
+    double elapsed_time_shuffle; 
+    MPI_Reduce(&time_shuffle, &elapsed_time_shuffle, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD); 
+
     // Results for metrics computation
     if (!rank){
 
         cout << 
             argv[0] << "\t" <<              // executables name 
-            argv[1] << "\t" <<              // dataset name
+            inFilename << "\t" <<           // dataset name
             unique_nodes.size() << "\t" <<  // num of nodes
             size << "\t" <<                 // total num of process 
+            omp_get_max_threads() << "\t" << // num of threads per process
             foundSimilarTot << "\t" <<      // num of similar pair
             elapsed_time_distr << "\t" <<   // time for chunck distribution
             elapsed_time_out << "\t" <<     // time for outputting pairs
             elapsed_time << "\t" <<         // total elapsed time 
+            elapsed_time_map << "\t" <<     // time for map phase
+            elapsed_time_shuffle << "\t" << // time for shuffle phase
+            threadComms.size() << "\t" <<   // num of threads driving the shuffle (0: funneled)
         endl; 
 
     }
+    metrics::report("mpi_omp", inFilename, MPI_COMM_WORLD); 
+    trace::write(MPI_COMM_WORLD); 
 
     // MPI environment finalization
+    for (MPI_Comm& threadComm : threadComms) {
+        MPI_Comm_free(&threadComm); 
+    }
     MPI_Finalize(); 
     
     // Sucess status 
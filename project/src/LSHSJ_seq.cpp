@@ -21,6 +21,15 @@
 #include "geometry_basics.hpp"
 #include "frechet_distance.hpp"
 
+// Join specification (cross, self, all)
+#include "join_spec.hpp"
+
+// Per-phase metrics (LSHSJ_METRICS)
+#include "metrics.hpp"
+
+// Timeline of the run (LSHSJ_TRACE)
+#include "trace.hpp"
+
 using namespace std; 
 using namespace ff; 
 
@@ -142,9 +151,14 @@ void checkHelper(const long lsh, const element_t& a, const element_t& b) {
     for (size_t ii = 0; ii < a.relativeLSHs.size(); ii++) {
         if (a.relativeLSHs[ii] == b.relativeLSHs[ii]) {
             if (lsh == a.relativeLSHs[ii]) {
+                metrics::count(metrics::CANDIDATES);
                 if (similarity_test(a.trajectory, b.trajectory)) {
                     ++foundSimilar;
+#ifdef REPORT_DISTANCE
+                    *resultsStream << a.id << "\t" << b.id << "\t" << get_frechet_distance_within(a.trajectory, b.trajectory, SIM_THRESHOLD) << endl;
+#else
                     *resultsStream << a.id << "\t" << b.id << endl;
+#endif
                 }
             }
             return;
@@ -162,7 +176,14 @@ int main(int argc, char** argv) {
     
     // Check for proper command-line arguments
     if (argc < 2) {
-        cout << "Usage: " << argv[0] << " inputDataset <outputFile>";
+        cout << "Usage: " << argv[0] << " inputDataset <outputFile> <joinSpec: cross (default), self, all [:datasets]>";
+        return EXIT_FAILURE;
+    }
+
+    // Join specification
+    joinspec::join_spec spec;
+    if (argc > 3 && !joinspec::parse(argv[3], spec)) {
+        cerr << "Invalid join specification!" << endl;
         return EXIT_FAILURE;
     }
 
@@ -192,36 +213,66 @@ int main(int argc, char** argv) {
     unordered_map<long, vector<element_t>> elements;
 
     // Process each line in the input file
-    while (getline(file, line)) {
+    metrics::counters mapping(metrics::HW_MAP);
+    trace::span tracing("map input", "map");
+    int64_t numLines = 0;
+    while (true) {
+        metrics::scope reading(metrics::READ);
+        if (!getline(file, line)) break;
+        reading.stop();
+        metrics::scope parsing(metrics::PARSE);
+        metrics::count(metrics::LINES);
+        ++numLines;
         item it = parseLine(line);
+        parsing.stop();
+        if (!spec.accepts(it.dataset)) continue;
 
         // Compute LSH values for each LSH function
+        metrics::scope hashing(metrics::HASH);
         array<long, LSH_FAMILY_SIZE> relative_lshs;
         for (size_t i = 0; i < LSH_FAMILY_SIZE; i++)
             relative_lshs[i] = lsh_family[i].hash(it.content);
+        hashing.stop();
 
         // Store the elements with their corresponding LSH hash values
+        metrics::scope grouping(metrics::GROUP);
         for (long h : relative_lshs)
             elements[h].emplace_back(h, it.dataset, it.content, relative_lshs, it.id);
+        metrics::count(metrics::ELEMENTS, LSH_FAMILY_SIZE);
     }
 
     // Close input file after processing
+    mapping.stop();
+    tracing.set_count(numLines);
+    tracing.stop();
     file.close();
     // cout << elements.size() << endl; 
 
-    // Compare all possible pairs of elements
-    for (auto& [lsh, elements_v] : elements)
-        for (size_t i = 0; i < elements_v.size(); i++)
-            for (size_t j = i + 1; j < elements_v.size(); j++)
-                
-                // Ensure they are from different datasets 
-                if (elements_v[i].dataSet != elements_v[j].dataSet) 
+    // Compare the pairs of elements requested by the join specification (similar pairs are written while joining)
+    metrics::count(metrics::BUCKETS, elements.size());
+    metrics::counters joins(metrics::HW_JOIN);
+    for (auto& [lsh, elements_v] : elements) {
+        if (elements_v.size() < 2) continue;
+        trace::span tracing("join bucket", "join", elements_v.size());
+
+        // Group elements by dataset 
+        metrics::scope grouping(metrics::GROUP);
+        stable_sort(elements_v.begin(), elements_v.end(), [](const element_t& a, const element_t& b) { return a.dataSet < b.dataSet; });
+        grouping.stop();
+        metrics::scope joining(metrics::JOIN);
+        joinspec::for_each_row(spec, elements_v.size(), 0, elements_v.size(), [&](size_t i) { return elements_v[i].dataSet; },
+            [&](size_t i, size_t first, size_t last) {
+                for (size_t j = first; j < last; j++)
 
                     // Perform similarity chenk 
                     checkHelper(lsh, elements_v[i], elements_v[j]);
+            });
+    }
+    joins.stop();
     
     // Stop timer and get execution time
     ffTime(STOP_TIME);
+    metrics::count(metrics::MATCHES, foundSimilar);
 
     // Collect outputs (similar pairs) and results (execution time and)
     cout << 
@@ -229,6 +280,8 @@ int main(int argc, char** argv) {
         foundSimilar << "\t" << 
         ffTime(GET_TIME) / 1000 << 
     endl;
+    metrics::report("seq", argv[1]);
+    trace::write();
     
     return 0;
 }
@@ -0,0 +1,408 @@
+/**
+* @author   Irene Pisani
+* @note     University of Pisa, Computer Science department.
+*           M.Sc. Computer Science, Artificial Intelligence
+*           Parallel and Distributed Systems: Paradigms and models (23/24).
+*
+* @brief    Project track 3: Locality Sensitive Hashing based Similarity Join (LSHSJ)
+* @details  Local query service: "which indexed trajectories are within Frechet distance
+*           SIM_THRESHOLD of this one?". The server memory-maps a persistent LSH index
+*           (see lsh_index.hpp) and answers batches of queries over a Unix socket
+*           (see query_protocol.hpp). Each client connection is served by its own thread,
+*           and the queries of a batch are hashed and verified by a fixed pool of workers.
+*/
+
+#include <iostream>
+#include <ostream>
+#include <sstream>
+#include <vector>
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <csignal>
+#include <cstring>
+#include <getopt.h>
+
+#include "hash.hpp"
+#include "geometry_basics.hpp"
+#include "frechet_distance.hpp"
+
+// Persistent LSH index and query protocol
+#include "lsh_index.hpp"
+#include "query_protocol.hpp"
+
+using namespace std;
+
+#define LSH_SEED 234           // Seed for LSH function
+#define LSH_RESOLUTION 80      // Resolution for LSH function
+
+// Queries of a batch handled by a single task of the pool
+#define QUERIES_PER_TASK 8
+
+// Batch latencies kept for the percentiles (most recent ones)
+#define LATENCY_SAMPLES (1 << 20)
+
+// Similarity threasholds
+const static double SIM_THRESHOLD = 10;
+const static double SIM_THRESHOLD_SQR = sqr(SIM_THRESHOLD);
+
+// Set by SIGINT/SIGTERM to stop the service
+volatile sig_atomic_t stopRequested = 0;
+
+/**
+ * @brief Structure to represent a query of a batch.
+ */
+struct query_t {
+    int dataset;                            // Dataset identifier (< 0: any dataset)
+    curve content;                          // Curve representing the trajectory
+    vector<int64_t> matches;                // Ids of the similar indexed trajectories
+};
+
+/**
+ * @brief Checks if two curves (trajectories) are similar based on various distance metrics.
+ *
+ * @param c1 The first trajectory
+ * @param c2 The second trajectory
+ * @return bool True if the curves are similar, false otherwise
+ */
+bool similarity_test(const curve& c1, const curve& c2) {
+
+    // Check euclidean distance
+    if (euclideanSqr(c1[0], c2[0]) > SIM_THRESHOLD_SQR || euclideanSqr(c1.back(), c2.back()) > SIM_THRESHOLD_SQR)
+        return false;
+
+    // Check equal time
+    if (equalTime(c1, c2, SIM_THRESHOLD_SQR) || get_frechet_distance_upper_bound(c1, c2) <= SIM_THRESHOLD)
+        return true;
+
+    // Check using negative filter
+    if (negfilter(c1, c2, SIM_THRESHOLD))
+        return false;
+
+    // Full check using Frechet distance
+    if (is_frechet_distance_at_most(c1, c2, SIM_THRESHOLD))
+        return true;
+
+    return false;
+}
+
+/**
+ * @brief Fixed pool of worker threads executing tasks in submission order.
+ */
+struct threadPool {
+
+    explicit threadPool(size_t numThreads) {
+        for (size_t i = 0; i < numThreads; ++i)
+            workers.emplace_back([this] { run(); });
+    }
+
+    ~threadPool() {
+        {
+            lock_guard<mutex> lock(m);
+            stopping = true;
+        }
+        cv.notify_all();
+        for (thread& w : workers)
+            w.join();
+    }
+
+    void submit(function<void()> task) {
+        {
+            lock_guard<mutex> lock(m);
+            tasks.push_back(move(task));
+        }
+        cv.notify_one();
+    }
+
+    void run() {
+        while (true) {
+            function<void()> task;
+            {
+                unique_lock<mutex> lock(m);
+                cv.wait(lock, [this] { return stopping || !tasks.empty(); });
+                if (tasks.empty())
+                    return;
+                task = move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+
+    vector<thread> workers;
+    deque<function<void()>> tasks;
+    mutex m;
+    condition_variable cv;
+    bool stopping = false;
+};
+
+/**
+ * @brief Service counters and batch latencies.
+ */
+struct serviceStats {
+
+    void record(size_t queries, size_t matches, float latency_us) {
+        this->queries += queries;
+        this->matches += matches;
+        ++batches;
+        lock_guard<mutex> lock(m);
+        if (latencies.size() < LATENCY_SAMPLES) latencies.push_back(latency_us);
+        else latencies[next++ % LATENCY_SAMPLES] = latency_us;
+    }
+
+    string report() {
+        vector<float> sorted;
+        {
+            lock_guard<mutex> lock(m);
+            sorted = latencies;
+        }
+        sort(sorted.begin(), sorted.end());
+        auto percentile = [&sorted](double p) -> double {
+            if (sorted.empty()) return 0;
+            return sorted[min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()))];
+        };
+        double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        ostringstream out;
+        out << "uptime_s\t" << elapsed << "\n"
+            << "connections\t" << connections << "\n"
+            << "batches\t" << batches << "\n"
+            << "queries\t" << queries << "\n"
+            << "matches\t" << matches << "\n"
+            << "qps\t" << (elapsed > 0 ? queries / elapsed : 0) << "\n"
+            << "batch_latency_p50_us\t" << percentile(0.50) << "\n"
+            << "batch_latency_p90_us\t" << percentile(0.90) << "\n"
+            << "batch_latency_p99_us\t" << percentile(0.99) << "\n"
+            << "batch_latency_max_us\t" << (sorted.empty() ? 0 : sorted.back()) << "\n";
+        return out.str();
+    }
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    atomic<uint64_t> connections{0}, batches{0}, queries{0}, matches{0};
+    vector<float> latencies;
+    size_t next = 0;
+    mutex m;
+};
+
+lshindex::mapped_index lshIndex;
+vector<FrechetLSH> lsh_family;     // Tables and concatenated functions of the index
+serviceStats stats;
+
+/**
+ * @brief Hashes a query and verifies the indexed trajectories colliding with it.
+ * @param q The query
+ * @param candidate Curve buffer for the indexed trajectories
+ */
+void answerQuery(query_t& q, curve& candidate) {
+
+    vector<int64_t> lshs = lshindex::hash_trajectory(lsh_family, lshIndex.header->concatenation, q.content);
+    if (!q.content.size())
+        return;
+    lshIndex.probe(lshs.data(), 1, q.dataset, q.content.front(), q.content.back(), SIM_THRESHOLD_SQR, candidate,
+        [&](uint32_t ref, const curve& c) {
+            if (similarity_test(q.content, c))
+                q.matches.push_back(lshIndex.records[ref].id);
+        });
+}
+
+/**
+ * @brief Answers a batch of queries with the pool and encodes the response.
+ * @param pool The worker pool
+ * @param request Payload of the QUERY_BATCH request
+ * @param response Payload of the QUERY_BATCH response
+ * @param numQueries Num of queries of the batch
+ * @param matches Num of similar trajectories found
+ * @return bool False if the request is malformed
+ */
+bool answerBatch(threadPool& pool, const vector<char>& request, vector<char>& response, size_t& numQueries, size_t& matches) {
+
+    // Decode the queries: each one takes at least 3 bytes (id, dataset and num of points)
+    const char* p = request.data();
+    const char* end = p + request.size();
+    uint64_t n = 0;
+    if (p < end && (!wire::get_varint(p, end, n) || n > static_cast<size_t>(end - p) / 3))
+        return false;
+    vector<query_t> queries(n);
+    for (query_t& q : queries) {
+        uint64_t id;
+        if (!wire::get_trajectory(p, end, id, q.dataset, q.content, wire::RAW_CODEC))
+            return false;
+    }
+    numQueries = queries.size();
+
+    // Split the batch in tasks and wait for all of them
+    size_t numTasks = (queries.size() + QUERIES_PER_TASK - 1) / QUERIES_PER_TASK;
+    mutex m;
+    condition_variable done;
+    size_t remaining = numTasks;
+    for (size_t t = 0; t < numTasks; ++t) {
+        pool.submit([&, t] {
+            curve candidate;
+            size_t last = min(queries.size(), (t + 1) * QUERIES_PER_TASK);
+            for (size_t k = t * QUERIES_PER_TASK; k < last; ++k)
+                answerQuery(queries[k], candidate);
+            lock_guard<mutex> lock(m);
+            if (--remaining == 0)
+                done.notify_one();
+        });
+    }
+    {
+        unique_lock<mutex> lock(m);
+        done.wait(lock, [&] { return remaining == 0; });
+    }
+
+    // Encode the matches of each query
+    matches = 0;
+    response.clear();
+    for (const query_t& q : queries) {
+        wire::put_varint(response, q.matches.size());
+        for (int64_t id : q.matches)
+            wire::put_varint(response, id);
+        matches += q.matches.size();
+    }
+    return true;
+}
+
+/**
+ * @brief Serves the frames of a client until it disconnects.
+ * @details A malformed frame (or a failure while answering it) closes this connection only:
+ *          the thread is detached, so no exception may leave it.
+ * @param pool The worker pool
+ * @param fd The client socket
+ */
+void serveClient(threadPool& pool, int fd) {
+
+    ++stats.connections;
+    uint8_t type;
+    vector<char> request, response;
+    try {
+        while (!stopRequested && query::recv_frame(fd, type, request)) {
+            if (type == query::QUERY_BATCH) {
+                auto start = chrono::steady_clock::now();
+                size_t numQueries, matches;
+                if (!answerBatch(pool, request, response, numQueries, matches)) {
+                    cerr << "Malformed query batch, closing the connection" << endl;
+                    break;
+                }
+                stats.record(numQueries, matches, chrono::duration<float, micro>(chrono::steady_clock::now() - start).count());
+            } else if (type == query::STATS) {
+                string report = stats.report();
+                response.assign(report.begin(), report.end());
+            } else {
+                break;
+            }
+            if (!query::send_frame(fd, type, response))
+                break;
+        }
+    } catch (const exception& e) {
+        cerr << "Error serving a client: " << e.what() << ", closing the connection" << endl;
+    }
+    close(fd);
+}
+
+/**
+* @brief Main function: maps the index and serves the clients.
+* @param argc Argument count
+* @param argv Argument values (options and index file)
+* @return int Exit status
+*/
+int main(int argc, char** argv) {
+
+    // Usage description
+    auto usage_and_exit = [argv]() {
+        printf("   use: %s [-t threads] [-s socket] [-r seconds] indexFile\n", argv[0]);
+        printf("   indexFile  -> index written by LSHSJ_index build \n");
+        printf("   -t threads -> verification threads (default: hardware concurrency) \n");
+        printf("   -s socket  -> Unix socket path (default: %s) \n", query::DEFAULT_SOCKET);
+        printf("   -r seconds -> print statistics on stderr every seconds (default: only at exit) \n\n");
+        exit(EXIT_FAILURE);
+    };
+
+    // Optional arguments
+    size_t numThreads = max(1u, thread::hardware_concurrency());
+    const char* socketPath = query::DEFAULT_SOCKET;
+    double reportSeconds = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:s:r:")) != -1) {
+        if (opt == 't') numThreads = max(1ul, stoul(optarg));
+        else if (opt == 's') socketPath = optarg;
+        else if (opt == 'r') reportSeconds = stod(optarg);
+        else usage_and_exit();
+    }
+    if (argc - optind < 1) usage_and_exit();
+
+    // Map the index
+    auto start_time = chrono::steady_clock::now();
+    if (!lshIndex.open(argv[optind])) {
+        cerr << "Error opening index file!" << endl;
+        return EXIT_FAILURE;
+    }
+    if (!lshIndex.matches(LSH_SEED, LSH_RESOLUTION)) {
+        cerr << "Index built with different LSH parameters!" << endl;
+        return EXIT_FAILURE;
+    }
+
+    // Build LSH function family (as many tables and concatenated functions as the index)
+    lsh_family = lshindex::make_family(lshIndex.header->family_size, lshIndex.header->concatenation, LSH_SEED, LSH_RESOLUTION);
+
+    // Listen on the Unix socket
+    int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr = query::socket_address(socketPath);
+    unlink(socketPath);
+    if (listenFd < 0 || bind(listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || listen(listenFd, 64) < 0) {
+        cerr << "Error listening on " << socketPath << ": " << strerror(errno) << endl;
+        return EXIT_FAILURE;
+    }
+
+    // Stop on SIGINT/SIGTERM: accept is interrupted (no SA_RESTART)
+    struct sigaction sa{};
+    sa.sa_handler = [](int) { stopRequested = 1; };
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+
+    cerr << argv[0] << "\t" << argv[optind] << "\t" << lshIndex.size() << " trajectories\t"
+         << numThreads << " threads\t" << socketPath << "\tready in "
+         << chrono::duration<double>(chrono::steady_clock::now() - start_time).count() << " s" << endl;
+
+    threadPool pool(numThreads);
+
+    // Periodic statistics
+    thread reporter;
+    if (reportSeconds > 0) {
+        reporter = thread([reportSeconds] {
+            auto next = chrono::steady_clock::now();
+            while (!stopRequested) {
+                next += chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(reportSeconds));
+                while (!stopRequested && chrono::steady_clock::now() < next)
+                    this_thread::sleep_for(chrono::milliseconds(50));
+                if (!stopRequested)
+                    cerr << stats.report() << endl;
+            }
+        });
+    }
+
+    // Serve each client on its own thread
+    while (!stopRequested) {
+        int fd = accept(listenFd, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        thread(serveClient, ref(pool), fd).detach();
+    }
+
+    close(listenFd);
+    unlink(socketPath);
+    if (reporter.joinable())
+        reporter.join();
+    cerr << stats.report();
+
+    // Clients may still be attached to the pool: skip its destruction
+    _exit(0);
+}
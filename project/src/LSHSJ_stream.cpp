@@ -0,0 +1,402 @@
+/**
+* @author   Irene Pisani
+* @note     University of Pisa, Computer Science department.
+*           M.Sc. Computer Science, Artificial Intelligence
+*           Parallel and Distributed Systems: Paradigms and models (23/24).
+*
+* @brief    Project track 3: Locality Sensitive Hashing based Similarity Join (LSHSJ)
+* @details  Incremental streaming LSHSJ on a live feed of newline-delimited trajectories.
+*           Each trajectory is hashed, joined with the trajectories of the other datasets already
+*           in the in-memory bucket index (matches are emitted right away), then inserted.
+*           An optional count or time window evicts the oldest trajectories to bound memory.
+*/
+
+#include <iostream>
+#include <fstream>
+#include <ostream>
+#include <sstream>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <csignal>
+#include <cerrno>
+#include <cstring>
+#include <getopt.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "hash.hpp"
+#include "geometry_basics.hpp"
+#include "frechet_distance.hpp"
+
+using namespace std;
+
+#define LSH_FAMILY_SIZE 8      // Number of LSH functions
+#define LSH_SEED 234           // Seed for LSH function
+#define LSH_RESOLUTION 80      // Resolution for LSH function
+
+// Polling interval when following a growing file (milliseconds)
+#define FOLLOW_POLL_MS 100
+
+// Bytes read at once from the input feed
+#define READ_CHUNK (1 << 16)
+
+// Record latencies kept for the percentiles (most recent ones)
+#define LATENCY_SAMPLES (1 << 20)
+
+// Similarity threasholds
+const static double SIM_THRESHOLD = 10;
+const static double SIM_THRESHOLD_SQR = sqr(SIM_THRESHOLD);
+
+size_t foundSimilar = 0;          // Counter for similar trajectories
+ostream* resultsStream = &cout;   // Output streams
+
+// Set by SIGINT/SIGTERM to stop following the input
+volatile sig_atomic_t stopRequested = 0;
+
+/**
+ * @brief Structure to represent an item in the dataset.
+ */
+struct item {
+    size_t id;         // Unique identifier
+    int dataset;       // Dataset identifier
+    curve content;     // Curve representing the trajectory
+};
+
+/**
+ * @brief Structure to represent a trajectory of the window.
+ */
+struct element_t {
+    int dataSet;
+    curve trajectory;
+    array<long, LSH_FAMILY_SIZE> relativeLSHs;
+    long id;
+    chrono::steady_clock::time_point arrival;   // Time of insertion in the window
+};
+
+/**
+ * @brief Window of the most recent trajectories and their LSH buckets.
+ * @details Trajectories are evicted in arrival order, so the oldest entry of each bucket
+ *          is always at its front: buckets hold sequence numbers in increasing order.
+ */
+struct streamIndex {
+    deque<element_t> window;                         // Trajectories in arrival order
+    uint64_t firstSeq = 0;                           // Sequence number of window.front()
+    unordered_map<long, deque<uint64_t>> buckets;    // Sequence numbers of each bucket
+
+    const element_t& at(uint64_t seq) const { return window[seq - firstSeq]; }
+
+    void insert(element_t&& elem) {
+        uint64_t seq = firstSeq + window.size();
+        for (size_t i = 0; i < LSH_FAMILY_SIZE; i++) {
+            long lsh = elem.relativeLSHs[i];
+            if (find(elem.relativeLSHs.begin(), elem.relativeLSHs.begin() + i, lsh) == elem.relativeLSHs.begin() + i)
+                buckets[lsh].push_back(seq);
+        }
+        window.push_back(move(elem));
+    }
+
+    void evictOldest() {
+        const element_t& elem = window.front();
+        for (size_t i = 0; i < LSH_FAMILY_SIZE; i++) {
+            long lsh = elem.relativeLSHs[i];
+            if (find(elem.relativeLSHs.begin(), elem.relativeLSHs.begin() + i, lsh) != elem.relativeLSHs.begin() + i)
+                continue;
+            auto bucket = buckets.find(lsh);
+            bucket->second.pop_front();
+            if (bucket->second.empty())
+                buckets.erase(bucket);
+        }
+        window.pop_front();
+        ++firstSeq;
+    }
+};
+
+/**
+ * @brief Parses a line of data into an item object.
+ *
+ * @param line The input line as a string
+ * @return item The parsed item containing id, dataset, and trajectory
+ */
+item parseLine(string& line) {
+    istringstream ss(line);
+    item output;
+    ss >> output.id;
+    ss >> output.dataset;
+    string tmp;
+    ss >> tmp;
+
+    // Parse trajectory
+    if (!(tmp.find_first_of("[") == string::npos)) {
+        tmp.replace(0, 1, "");
+        tmp.replace(tmp.length() - 1, tmp.length(), "");
+        bool ext = false;
+        while (!ext) {
+            string extrait = tmp.substr(tmp.find("["), tmp.find("]") + 1);
+            string extrait1 = extrait.substr(1, extrait.find(",") - 1);
+            string extrait2 = extrait.substr(extrait.find(",") + 1);
+            extrait2 = extrait2.substr(0, extrait2.length() - 1);
+            double e1 = stod(extrait1);
+            double e2 = stod(extrait2);
+            output.content.push_back(move(point(e1, e2)));
+            ext = (tmp.length() == extrait.length());
+            if (!ext)
+                tmp = tmp.substr(tmp.find_first_of("]") + 2, tmp.length());
+        }
+    }
+    return output;
+}
+
+/**
+ * @brief Checks if two curves (trajectories) are similar based on various distance metrics.
+ *
+ * @param c1 The first trajectory
+ * @param c2 The second trajectory
+ * @return bool True if the curves are similar, false otherwise
+ */
+bool similarity_test(const curve& c1, const curve& c2) {
+
+    // Check euclidean distance
+    if (euclideanSqr(c1[0], c2[0]) > SIM_THRESHOLD_SQR || euclideanSqr(c1.back(), c2.back()) > SIM_THRESHOLD_SQR)
+        return false;
+
+    // Check equal time
+    if (equalTime(c1, c2, SIM_THRESHOLD_SQR) || get_frechet_distance_upper_bound(c1, c2) <= SIM_THRESHOLD)
+        return true;
+
+    // Check using negative filter
+    if (negfilter(c1, c2, SIM_THRESHOLD))
+        return false;
+
+    // Full check using Frechet distance
+    if (is_frechet_distance_at_most(c1, c2, SIM_THRESHOLD))
+        return true;
+
+    return false;
+}
+
+/**
+* @brief Helper function to check if two elements are similar based on LSH and trajectory comparison.
+* @param lsh The hash value to compare
+* @param a The first element to compare
+* @param b The second element to compare
+* @return bool True if the pair was verified in this bucket and is similar
+*/
+bool checkHelper(const long lsh, const element_t& a, const element_t& b) {
+
+    for (size_t ii = 0; ii < a.relativeLSHs.size(); ii++) {
+        if (a.relativeLSHs[ii] == b.relativeLSHs[ii]) {
+            if (lsh == a.relativeLSHs[ii] && similarity_test(a.trajectory, b.trajectory)) {
+                ++foundSimilar;
+#ifdef REPORT_DISTANCE
+                *resultsStream << a.id << "\t" << b.id << "\t" << get_frechet_distance_within(a.trajectory, b.trajectory, SIM_THRESHOLD) << "\n";
+#else
+                *resultsStream << a.id << "\t" << b.id << "\n";
+#endif
+                return true;
+            }
+            return false;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Line reader of the input feed.
+ * @details Reads the file descriptor with read(2) rather than an istream: the stream buffers of
+ *          libstdc++ retry a read interrupted by a signal, so a SIGINT would not stop a read
+ *          blocked on an idle pipe or terminal.
+ */
+struct feedReader {
+    int fd = STDIN_FILENO;
+    string buffer;      // Bytes read, returned up to pos
+    size_t pos = 0;
+
+    /**
+    * @brief Reads the next line, waiting for more data when following a growing input.
+    * @param line The read line
+    * @param follow Wait for new data at end of input
+    * @return bool False at end of input or when a stop is requested
+    */
+    bool nextLine(string& line, bool follow) {
+        char chunk[READ_CHUNK];
+        while (!stopRequested) {
+            size_t newline = buffer.find('\n', pos);
+            if (newline != string::npos) {
+                line.assign(buffer, pos, newline - pos);
+                pos = newline + 1;
+                return true;
+            }
+            buffer.erase(0, pos);
+            pos = 0;
+            ssize_t n = read(fd, chunk, sizeof(chunk));
+            if (n > 0) {
+                buffer.append(chunk, n);
+                continue;
+            }
+            if (n < 0) {
+                if (errno == EINTR) continue;   // stopRequested is checked again
+                return false;
+            }
+
+            // End of input: the last line may not be terminated, unless more data may follow
+            if (!follow) {
+                if (buffer.empty()) return false;
+                line.swap(buffer);
+                buffer.clear();
+                return true;
+            }
+            this_thread::sleep_for(chrono::milliseconds(FOLLOW_POLL_MS));
+        }
+        return false;
+    }
+};
+
+/**
+* @brief Main function: joins each trajectory of the feed with the current window.
+* @param argc Argument count
+* @param argv Argument values (options, input feed and output file)
+* @return int Exit status
+*/
+int main(int argc, char** argv) {
+
+    // Usage description
+    auto usage_and_exit = [argv]() {
+        printf("   use: %s [-w count] [-t seconds] [-f] [inputFile] [outputFile]\n", argv[0]);
+        printf("   inputFile  -> newline-delimited trajectories, file or pipe (default or '-': standard input) \n");
+        printf("   outputFile -> output file path (default: standard output, flushed after each trajectory) \n");
+        printf("   -w count   -> keep only the last count trajectories in the window \n");
+        printf("   -t seconds -> keep only the trajectories received in the last seconds \n");
+        printf("   -f         -> follow a growing file: wait for new lines at end of file (stop with SIGINT) \n");
+        printf("   Statistics (records, similar pairs, throughput, latency percentiles in us) go to standard error \n\n");
+        exit(EXIT_FAILURE);
+    };
+
+    // Optional arguments
+    size_t windowCount = 0;
+    double windowSeconds = 0;
+    bool follow = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "w:t:f")) != -1) {
+        if (opt == 'w') windowCount = stoul(optarg);
+        else if (opt == 't') windowSeconds = stod(optarg);
+        else if (opt == 'f') follow = true;
+        else usage_and_exit();
+    }
+
+    // Open input feed
+    feedReader in;
+    if (optind < argc && strcmp(argv[optind], "-")) {
+        in.fd = open(argv[optind], O_RDONLY);
+        if (in.fd < 0) {
+            cerr << "Error opening dataset file!" << endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    ofstream filestream;
+    // If output file is provided, open it for writing results
+    if (optind + 1 < argc) {
+        filestream = ofstream(argv[optind + 1]);
+        if (filestream.is_open())
+            resultsStream = &filestream;
+    }
+
+    // Stop on SIGINT/SIGTERM: a blocking read is interrupted (no SA_RESTART), so nextLine returns
+    struct sigaction sa{};
+    sa.sa_handler = [](int) { stopRequested = 1; };
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+
+    // Build LSH function family
+    FrechetLSH lsh_family[LSH_FAMILY_SIZE];
+    for (size_t i = 0; i < LSH_FAMILY_SIZE; i++)
+        lsh_family[i].init(LSH_RESOLUTION, LSH_SEED * i, i);
+
+    streamIndex index;
+    vector<float> latencies;    // Latency of the last LATENCY_SAMPLES records (microseconds)
+    float maxLatency = 0;       // Over every record
+    size_t records = 0, evicted = 0;
+    auto start_time = chrono::steady_clock::now();
+
+    string line;
+    while (in.nextLine(line, follow)) {
+        if (line.empty()) continue;
+        auto arrival = chrono::steady_clock::now();
+
+        // Hash the new trajectory
+        item it = parseLine(line);
+        element_t elem;
+        elem.dataSet = it.dataset;
+        elem.trajectory = it.content;
+        elem.id = it.id;
+        elem.arrival = arrival;
+        for (size_t i = 0; i < LSH_FAMILY_SIZE; i++)
+            elem.relativeLSHs[i] = lsh_family[i].hash(it.content);
+
+        // Evict trajectories out of the window
+        while (!index.window.empty() &&
+               ((windowCount && index.window.size() >= windowCount) ||
+                (windowSeconds > 0 && chrono::duration<double>(arrival - index.window.front().arrival).count() > windowSeconds))) {
+            index.evictOldest();
+            ++evicted;
+        }
+
+        // Probe each distinct bucket of the trajectory
+        bool emitted = false;
+        for (size_t i = 0; i < LSH_FAMILY_SIZE; i++) {
+            long lsh = elem.relativeLSHs[i];
+            if (find(elem.relativeLSHs.begin(), elem.relativeLSHs.begin() + i, lsh) != elem.relativeLSHs.begin() + i)
+                continue;
+            auto bucket = index.buckets.find(lsh);
+            if (bucket == index.buckets.end())
+                continue;
+            for (uint64_t seq : bucket->second) {
+                const element_t& other = index.at(seq);
+                if (other.dataSet != elem.dataSet)
+                    emitted |= checkHelper(lsh, elem, other);
+            }
+        }
+        if (emitted)
+            resultsStream->flush();
+
+        // Insert it for the next trajectories
+        index.insert(move(elem));
+        ++records;
+        float latency = chrono::duration<float, micro>(chrono::steady_clock::now() - arrival).count();
+        if (latencies.size() < LATENCY_SAMPLES) latencies.push_back(latency);
+        else latencies[records % LATENCY_SAMPLES] = latency;
+        maxLatency = max(maxLatency, latency);
+    }
+    resultsStream->flush();
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start_time).count();
+
+    // Latency percentiles
+    sort(latencies.begin(), latencies.end());
+    auto percentile = [&latencies](double p) -> double {
+        if (latencies.empty()) return 0;
+        size_t k = min(latencies.size() - 1, static_cast<size_t>(p * latencies.size()));
+        return latencies[k];
+    };
+
+    // Collect results (records, similar pairs, window, throughput and latencies)
+    cerr <<
+        argv[0] << "\t" <<
+        records << "\t" <<
+        foundSimilar << "\t" <<
+        index.window.size() << "\t" <<     // trajectories in the window at the end
+        evicted << "\t" <<
+        elapsed << "\t" <<
+        (elapsed > 0 ? records / elapsed : 0) << "\t" <<   // records per second
+        percentile(0.50) << "\t" <<
+        percentile(0.90) << "\t" <<
+        percentile(0.99) << "\t" <<
+        percentile(0.999) << "\t" <<
+        maxLatency <<
+    endl;
+
+    return 0;
+}
@@ -0,0 +1,98 @@
+#ifndef JOIN_SPEC_HPP_INCLUDED
+#define JOIN_SPEC_HPP_INCLUDED
+
+/*
+ * Join specification: which pairs of trajectories sharing a bucket are verified.
+ *
+ *   cross[:d1,d2,...]   pairs from different datasets (default; N-way across every dataset of the list)
+ *   self[:d1,d2,...]    pairs within the same dataset (e.g. self:0 deduplicates dataset 0)
+ *   all[:d1,d2,...]     every pair
+ *
+ * Without a list every dataset takes part; trajectories of the other datasets are dropped before
+ * bucketing. Bucket elements sorted by dataset make the pairs of a row a contiguous range, so that
+ * only the requested combinations are enumerated.
+ */
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+namespace joinspec {
+
+enum mode_t { CROSS = 0, SELF = 1, ALL = 2 };
+constexpr const char* MODE_NAMES[] = {"cross", "self", "all"};
+
+struct join_spec {
+    mode_t mode = CROSS;
+    std::vector<int> datasets;  // Datasets taking part (empty: all)
+
+    bool accepts(int dataset) const {
+        return datasets.empty() || std::find(datasets.begin(), datasets.end(), dataset) != datasets.end();
+    }
+
+    // Partners [first, second) of row i of a bucket sorted by dataset, where rows [i, group_end) share its dataset
+    std::pair<size_t, size_t> partners(size_t i, size_t group_end, size_t n) const {
+        if (mode == CROSS) return {group_end, n};
+        if (mode == SELF) return {i + 1, group_end};
+        return {i + 1, n};
+    }
+
+    // Num of pairs of a bucket with the given num of elements per dataset
+    template<typename Counts>
+    uint64_t pairs(const Counts& perDataset) const {
+        uint64_t n = 0, same = 0;
+        for (auto& [dataset, count] : perDataset) {
+            n += count;
+            same += static_cast<uint64_t>(count) * (count - 1) / 2;
+        }
+        uint64_t all = n * (n - 1) / 2;
+        return (mode == CROSS) ? all - same : (mode == SELF) ? same : all;
+    }
+
+    std::string str() const {
+        std::string s = MODE_NAMES[mode];
+        for (size_t i = 0; i < datasets.size(); ++i)
+            s += (i ? "," : ":") + std::to_string(datasets[i]);
+        return s;
+    }
+};
+
+inline bool parse(const char* text, join_spec& spec) {
+    spec = join_spec();
+    const char* colon = strchr(text, ':');
+    std::string mode(text, colon ? colon - text : strlen(text));
+    size_t m = 0;
+    while (m < 3 && mode != MODE_NAMES[m]) ++m;
+    if (m == 3) return false;
+    spec.mode = static_cast<mode_t>(m);
+    for (const char* p = colon; p && *p; ) {
+        char* end;
+        spec.datasets.push_back(static_cast<int>(strtol(p + 1, &end, 10)));
+        if (end == p + 1 || (*end && *end != ',')) return false;
+        p = end;
+    }
+    return true;
+}
+
+// Visits rows [row_begin, row_end) of a bucket of n elements sorted by dataset: visit(i, first, last) with
+// the range of partners of row i requested by the spec
+template<typename DatasetOf, typename Visit>
+void for_each_row(const join_spec& spec, size_t n, size_t row_begin, size_t row_end, DatasetOf dataset_of, Visit visit) {
+    size_t group_end = row_begin;
+    for (size_t i = row_begin; i < row_end; ++i) {
+        if (group_end <= i) {
+            group_end = i + 1;
+            while (group_end < n && dataset_of(group_end) == dataset_of(i)) ++group_end;
+        }
+        auto [first, last] = spec.partners(i, group_end, n);
+        visit(i, first, last);
+    }
+}
+
+} // namespace joinspec
+
+#endif // JOIN_SPEC_HPP_INCLUDED
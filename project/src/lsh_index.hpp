@@ -0,0 +1,370 @@
+#ifndef LSH_INDEX_HPP_INCLUDED
+#define LSH_INDEX_HPP_INCLUDED
+
+/*
+ * Persistent LSH bucket index of a static (reference) dataset, written once and memory-mapped
+ * by every later run, so that the reference side costs neither parsing, hashing nor shuffling.
+ *
+ * File layout (native endianness, every section 8-byte aligned):
+ *   header     index_header
+ *   buckets    bucket_entry[num_buckets], sorted by key (binary searched)
+ *   refs       uint32_t[num_refs], trajectories of each bucket (bucket_entry::first, count)
+ *   records    trajectory_record[num_trajectories]
+ *   lshs       int64_t[num_trajectories * family_size], LSH values of each trajectory
+ *   points     double[2 * num_points], packed coordinates of the trajectories
+ *
+ * Records also keep the first and last point of each trajectory, so that the endpoints filter of
+ * the similarity test runs before the curve is rebuilt from the packed points.
+ *
+ * Each of the family_size tables keys a trajectory by `concatenation` LSH functions (AND): table t
+ * uses functions t * concatenation ... (t + 1) * concatenation - 1, combined by concatenate_key;
+ * hash_trajectory computes these keys for a trajectory, both when building and when probing.
+ */
+
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "geometry_basics.hpp"
+#include "hash.hpp"
+
+namespace lshindex {
+
+constexpr char INDEX_MAGIC[4] = {'L', 'S', 'H', 'I'};
+constexpr uint32_t INDEX_VERSION = 2;
+
+struct index_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t family_size;       // LSH tables (keys) of each trajectory
+    uint32_t seed;              // LSH seed
+    uint32_t concatenation;     // LSH functions concatenated in each key
+    uint32_t reserved;
+    double resolution;          // LSH resolution
+    uint64_t num_trajectories;
+    uint64_t num_buckets;
+    uint64_t num_refs;
+    uint64_t num_points;
+    uint64_t buckets_offset;    // Byte offsets of the sections
+    uint64_t refs_offset;
+    uint64_t records_offset;
+    uint64_t lshs_offset;
+    uint64_t points_offset;
+    uint64_t file_bytes;
+};
+
+struct bucket_entry {
+    int64_t key;        // LSH value
+    uint64_t first;     // First position in refs
+    uint64_t count;     // Num of trajectories in the bucket
+};
+
+struct trajectory_record {
+    int64_t id;             // Unique identifier
+    int32_t dataset;        // Dataset identifier
+    uint32_t num_points;
+    uint64_t first_point;   // Position of the first point in points
+    double front[2];        // First point
+    double back[2];         // Last point
+};
+
+// A trajectory to be indexed
+struct input_trajectory {
+    int64_t id;
+    int32_t dataset;
+    curve content;
+    std::vector<int64_t> lshs;
+};
+
+inline uint64_t align8(uint64_t bytes) { return (bytes + 7) & ~uint64_t(7); }
+
+// Bucket key of table t from the hashes of its r functions: the hash itself when r = 1, otherwise the
+// table in the high half (as FrechetLSH does with the function id) and a mix of the low halves
+inline int64_t concatenate_key(uint64_t table, const uint64_t* hashes, uint32_t r) {
+    if (r == 1) return static_cast<int64_t>(hashes[0]);
+    uint64_t mix = 0;
+    for (uint32_t j = 0; j < r; ++j)
+        mix = (mix ^ (hashes[j] & 0xffffffffu)) * UINT64_C(0x9E3779B97F4A7C15);
+    return static_cast<int64_t>((table << 32) + (mix >> 32));
+}
+
+// Family of family_size tables of r functions each, as the tables of an index are keyed
+inline std::vector<FrechetLSH> make_family(uint32_t family_size, uint32_t r, uint32_t seed, double resolution) {
+    std::vector<FrechetLSH> lsh_family(static_cast<size_t>(family_size) * r);
+    for (size_t i = 0; i < lsh_family.size(); i++)
+        lsh_family[i].init(resolution, static_cast<uint64_t>(seed) * i, i);
+    return lsh_family;
+}
+
+// Bucket keys of a trajectory: for each table the key of its r functions and, with multi-probe, the
+// keys with the perturbed hashes of one function at a time replacing its primary hash.
+// Returns the 1 + r * probes keys of each table (-1: padding)
+inline std::vector<int64_t> hash_trajectory(std::vector<FrechetLSH>& lsh_family, size_t r, const curve& c, size_t probes = 0) {
+    const size_t tables = lsh_family.size() / r, keys = 1 + r * probes;
+    std::vector<int64_t> relative_lshs(tables * keys, -1);
+    std::vector<std::vector<uint64_t>> hashes(r);
+    std::vector<uint64_t> primary(r);
+    for (size_t t = 0; t < tables; t++) {
+        for (size_t j = 0; j < r; j++) {
+            FrechetLSH& lsh = lsh_family[t * r + j];
+            hashes[j] = probes ? lsh.probes(c, probes) : std::vector<uint64_t>(1, lsh.hash(c));
+            primary[j] = hashes[j][0];
+        }
+        int64_t* out = relative_lshs.data() + t * keys;
+        *out++ = concatenate_key(t, primary.data(), r);
+        for (size_t j = 0; j < r; j++) {
+            std::vector<uint64_t> perturbed(primary);
+            for (size_t q = 1; q < hashes[j].size(); q++) {
+                perturbed[j] = hashes[j][q];
+                *out++ = concatenate_key(t, perturbed.data(), r);
+            }
+        }
+    }
+    return relative_lshs;
+}
+
+inline bool write_index(const std::string& path, const std::vector<input_trajectory>& trajectories,
+                        uint32_t family_size, uint32_t seed, double resolution, uint32_t concatenation = 1) {
+
+    // Group trajectories by LSH value, each trajectory once per distinct value
+    std::map<int64_t, std::vector<uint32_t>> buckets;
+    uint64_t num_points = 0;
+    for (size_t t = 0; t < trajectories.size(); ++t) {
+        const std::vector<int64_t>& lshs = trajectories[t].lshs;
+        for (size_t i = 0; i < family_size; ++i) {
+            if (std::find(lshs.begin(), lshs.begin() + i, lshs[i]) == lshs.begin() + i)
+                buckets[lshs[i]].push_back(static_cast<uint32_t>(t));
+        }
+        num_points += trajectories[t].content.size();
+    }
+
+    // Sections
+    index_header header{};
+    memcpy(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    header.version = INDEX_VERSION;
+    header.family_size = family_size;
+    header.seed = seed;
+    header.concatenation = concatenation;
+    header.resolution = resolution;
+    header.num_trajectories = trajectories.size();
+    header.num_buckets = buckets.size();
+    header.num_points = num_points;
+
+    std::vector<bucket_entry> entries;
+    std::vector<uint32_t> refs;
+    entries.reserve(buckets.size());
+    for (auto& [key, members] : buckets) {
+        entries.push_back({key, refs.size(), members.size()});
+        refs.insert(refs.end(), members.begin(), members.end());
+    }
+    header.num_refs = refs.size();
+
+    std::vector<trajectory_record> records(trajectories.size());
+    std::vector<int64_t> lshs;
+    std::vector<double> points;
+    lshs.reserve(trajectories.size() * family_size);
+    points.reserve(2 * num_points);
+    for (size_t t = 0; t < trajectories.size(); ++t) {
+        const input_trajectory& in = trajectories[t];
+        trajectory_record& rec = records[t];
+        rec.id = in.id;
+        rec.dataset = in.dataset;
+        rec.num_points = in.content.size();
+        rec.first_point = points.size() / 2;
+        if (rec.num_points) {
+            rec.front[0] = in.content.front().x;
+            rec.front[1] = in.content.front().y;
+            rec.back[0] = in.content.back().x;
+            rec.back[1] = in.content.back().y;
+        }
+        for (const point& p : in.content) {
+            points.push_back(p.x);
+            points.push_back(p.y);
+        }
+        lshs.insert(lshs.end(), in.lshs.begin(), in.lshs.begin() + family_size);
+    }
+
+    header.buckets_offset = align8(sizeof(index_header));
+    header.refs_offset = align8(header.buckets_offset + entries.size() * sizeof(bucket_entry));
+    header.records_offset = align8(header.refs_offset + refs.size() * sizeof(uint32_t));
+    header.lshs_offset = align8(header.records_offset + records.size() * sizeof(trajectory_record));
+    header.points_offset = align8(header.lshs_offset + lshs.size() * sizeof(int64_t));
+    header.file_bytes = header.points_offset + points.size() * sizeof(double);
+
+    // Write sections at their offsets
+    FILE* out = fopen(path.c_str(), "wb");
+    if (!out) return false;
+    auto put = [out](uint64_t offset, const void* data, size_t bytes) {
+        if (fseek(out, static_cast<long>(offset), SEEK_SET) != 0) return false;
+        return bytes == 0 || fwrite(data, 1, bytes, out) == bytes;
+    };
+    bool ok = put(0, &header, sizeof(header))
+        && put(header.buckets_offset, entries.data(), entries.size() * sizeof(bucket_entry))
+        && put(header.refs_offset, refs.data(), refs.size() * sizeof(uint32_t))
+        && put(header.records_offset, records.data(), records.size() * sizeof(trajectory_record))
+        && put(header.lshs_offset, lshs.data(), lshs.size() * sizeof(int64_t))
+        && put(header.points_offset, points.data(), points.size() * sizeof(double));
+    return (fclose(out) == 0) && ok;
+}
+
+// Read-only view of a memory-mapped index
+struct mapped_index {
+
+    const index_header* header = nullptr;
+    const bucket_entry* buckets = nullptr;
+    const uint32_t* refs = nullptr;
+    const trajectory_record* records = nullptr;
+    const int64_t* lshs = nullptr;
+    const double* points = nullptr;
+    void* base = nullptr;
+    size_t bytes = 0;
+
+    mapped_index() = default;
+    mapped_index(const mapped_index&) = delete;
+    mapped_index& operator=(const mapped_index&) = delete;
+    ~mapped_index() { close(); }
+
+    bool open(const char* path) {
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(index_header)) {
+            ::close(fd);
+            return false;
+        }
+        bytes = st.st_size;
+        base = mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (base == MAP_FAILED) {
+            base = nullptr;
+            return false;
+        }
+
+        // Validate header and sections before using them
+        const char* data = static_cast<const char*>(base);
+        header = reinterpret_cast<const index_header*>(data);
+        if (memcmp(header->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0 || header->version != INDEX_VERSION
+            || header->file_bytes != bytes) {
+            close();
+            return false;
+        }
+        // Each section (offset, count * item bytes) must be aligned and lie inside the mapping
+        auto inside = [this](uint64_t offset, uint64_t count, uint64_t item) {
+            return offset % 8 == 0 && offset >= sizeof(index_header) && offset <= bytes && count <= (bytes - offset) / item;
+        };
+        if (header->family_size == 0 || header->concatenation == 0
+            || header->num_trajectories > UINT64_MAX / header->family_size || header->num_points > UINT64_MAX / 2
+            || !inside(header->buckets_offset, header->num_buckets, sizeof(bucket_entry))
+            || !inside(header->refs_offset, header->num_refs, sizeof(uint32_t))
+            || !inside(header->records_offset, header->num_trajectories, sizeof(trajectory_record))
+            || !inside(header->lshs_offset, header->num_trajectories * header->family_size, sizeof(int64_t))
+            || !inside(header->points_offset, 2 * header->num_points, sizeof(double))) {
+            close();
+            return false;
+        }
+        buckets = reinterpret_cast<const bucket_entry*>(data + header->buckets_offset);
+        refs = reinterpret_cast<const uint32_t*>(data + header->refs_offset);
+        records = reinterpret_cast<const trajectory_record*>(data + header->records_offset);
+        lshs = reinterpret_cast<const int64_t*>(data + header->lshs_offset);
+        points = reinterpret_cast<const double*>(data + header->points_offset);
+        return true;
+    }
+
+    void close() {
+        if (base) munmap(base, bytes);
+        base = nullptr;
+        header = nullptr;
+        bytes = 0;
+    }
+
+    // Whether the index was hashed with the given LSH functions: the num of tables and of concatenated
+    // functions are read from the header by the readers (see make_family)
+    bool matches(uint32_t seed, double resolution) const {
+        return header->seed == seed && header->resolution == resolution;
+    }
+
+    size_t size() const { return header->num_trajectories; }
+
+    // Trajectories of the bucket with the given key (nullptr if none or out of the refs section)
+    const uint32_t* find(int64_t key, size_t& count) const {
+        const bucket_entry* end = buckets + header->num_buckets;
+        const bucket_entry* it = std::lower_bound(buckets, end, key,
+            [](const bucket_entry& e, int64_t k) { return e.key < k; });
+        if (it == end || it->key != key || it->first > header->num_refs || it->count > header->num_refs - it->first) {
+            count = 0;
+            return nullptr;
+        }
+        count = it->count;
+        return refs + it->first;
+    }
+
+    const int64_t* trajectory_lshs(uint32_t ref) const { return lshs + static_cast<size_t>(ref) * header->family_size; }
+
+    point front(uint32_t ref) const { return point(records[ref].front[0], records[ref].front[1]); }
+    point back(uint32_t ref) const { return point(records[ref].back[0], records[ref].back[1]); }
+
+    // Rebuild the curve of a trajectory (prefix lengths are recomputed by push_back)
+    void trajectory(uint32_t ref, curve& c) const {
+        c = curve();
+        const trajectory_record& rec = records[ref];
+        if (rec.first_point > header->num_points || rec.num_points > header->num_points - rec.first_point)
+            return;
+        const double* p = points + 2 * rec.first_point;
+        for (uint32_t i = 0; i < rec.num_points; ++i, p += 2)
+            c.push_back(point(p[0], p[1]));
+    }
+
+    // Indexed trajectories colliding with a query, each one passed to verify once: in the bucket of
+    // the first LSH function on which the two collide, as checkHelper does in the batch executables.
+    // query_lshs holds keys_per_function keys for each LSH function (multi-probe: the primary hash,
+    // then the perturbed ones; negative keys are padding), and an indexed trajectory collides with
+    // the query on a function when its (single) LSH value is one of them.
+    // Trajectories of the query dataset (none if dataset < 0) and with an endpoint farther than
+    // sqrt(max_endpoint_sqr) are skipped before their curve is rebuilt in candidate; max_endpoint_sqr
+    // is read again for each candidate, so verify may shrink it (e.g. to the current k-th distance).
+    template<typename Verify>
+    void probe(const int64_t* query_lshs, uint32_t keys_per_function, int32_t dataset, const point& front, const point& back,
+               const double& max_endpoint_sqr, curve& candidate, Verify verify) const {
+        const uint32_t family_size = header->family_size;
+        auto collides = [&](uint32_t i, int64_t lsh) {
+            const int64_t* keys = query_lshs + static_cast<size_t>(i) * keys_per_function;
+            return std::find(keys, keys + keys_per_function, lsh) != keys + keys_per_function;
+        };
+        for (uint32_t i = 0; i < family_size * keys_per_function; ++i) {
+            int64_t lsh = query_lshs[i];
+            if (lsh < 0 || std::find(query_lshs, query_lshs + i, lsh) != query_lshs + i)
+                continue;
+            size_t count;
+            const uint32_t* bucket = find(lsh, count);
+            for (size_t k = 0; k < count; ++k) {
+                uint32_t ref = bucket[k];
+                if (ref >= header->num_trajectories)
+                    continue;
+                if (dataset >= 0 && records[ref].dataset == dataset)
+                    continue;
+                const int64_t* lshs = trajectory_lshs(ref);
+                uint32_t ii = 0;
+                while (ii < family_size && !collides(ii, lshs[ii])) ++ii;
+                if (ii == family_size || lshs[ii] != lsh)
+                    continue;
+                if (euclideanSqr(front, this->front(ref)) > max_endpoint_sqr || euclideanSqr(back, this->back(ref)) > max_endpoint_sqr)
+                    continue;
+                trajectory(ref, candidate);
+                verify(ref, candidate);
+            }
+        }
+    }
+};
+
+} // namespace lshindex
+
+#endif // LSH_INDEX_HPP_INCLUDED
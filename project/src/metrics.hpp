@@ -0,0 +1,295 @@
+#ifndef METRICS_HPP_INCLUDED
+#define METRICS_HPP_INCLUDED
+
+/*
+ * Per-phase metrics shared by every backend (seq, FF, MPI, MPI + OpenMP, FF + MPI), enabled at
+ * runtime by naming the output file in the environment:
+ *
+ *   LSHSJ_METRICS=outputs/metrics.csv    CSV rows
+ *   LSHSJ_METRICS=outputs/metrics.json   JSON lines (one object per row)
+ *
+ * Each thread (FF node, OpenMP thread, main thread) owns a slot with the monotonic time spent in
+ * each phase and the counts of processed items; slot 0 is the main thread, the others are numbered
+ * in order of first use. Every
+ * run appends rows of a single long-format schema
+ *
+ *   run,backend,input,rank,thread,metric,value
+ *
+ * where metric is time.<phase> and count.<name> for each thread, time.total (since program start)
+ * and memory.peak_rss_kb for each process (thread -1). Under MPI (include this header after mpi.h)
+ * the rows of every rank are gathered and written by rank 0. When disabled, scopes and counts cost
+ * a single branch.
+ *
+ * With LSHSJ_COUNTERS=1 as well, each thread also opens a group of hardware counters (see
+ * perf_counters.hpp) read around the coarse map, shuffle and join phases, which adds the rows
+ * hw.events (num of counters opened, 0 when unavailable) and hw.<phase>.<event> for each thread.
+ * Reading a group is a system call: counters wrap whole phases, never single lines or elements.
+ */
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <fstream>
+#include <iostream>
+
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+#include "perf_counters.hpp"
+
+namespace metrics {
+
+// Phases: read (input I/O and chunk distribution), parse, hash (LSH values), shuffle (elements to
+// their reducer), group (elements by bucket and dataset), join (candidate verification), output
+enum phase_t { READ = 0, PARSE, HASH, SHUFFLE, GROUP, JOIN, OUTPUT, NUM_PHASES };
+constexpr const char* PHASE_NAMES[] = {"read", "parse", "hash", "shuffle", "group", "join", "output"};
+
+// Counts: input lines, elements (trajectory, LSH function) emitted by the map phase, buckets joined,
+// candidate pairs verified by the similarity test, similar pairs
+enum count_t { LINES = 0, ELEMENTS, BUCKETS, CANDIDATES, MATCHES, NUM_COUNTS };
+constexpr const char* COUNT_NAMES[] = {"lines", "elements", "buckets", "candidates", "matches"};
+
+// Coarse phases measured with hardware counters
+enum hw_phase_t { HW_MAP = 0, HW_SHUFFLE, HW_JOIN, NUM_HW_PHASES };
+constexpr const char* HW_PHASE_NAMES[] = {"map", "shuffle", "join"};
+
+using steady = std::chrono::steady_clock;
+
+// Metrics of a thread
+struct slot_t {
+    double seconds[NUM_PHASES] = {};
+    uint64_t counts[NUM_COUNTS] = {};
+    perfctr::group counters;                            // Opened at the first counted phase of the thread
+    bool counters_tried = false;
+    bool hw_used[NUM_HW_PHASES] = {};
+    uint64_t hw[NUM_HW_PHASES][perfctr::NUM_EVENTS] = {};
+};
+
+inline thread_local slot_t* current = nullptr;  // Slot of the calling thread
+
+struct state_t {
+    const char* path = std::getenv("LSHSJ_METRICS");
+    const bool hw = path && *path && std::getenv("LSHSJ_COUNTERS") && std::atoi(std::getenv("LSHSJ_COUNTERS"));
+    std::atomic<int> hw_error{0};   // errno of a failed counter group, reported once by report()
+    steady::time_point start = steady::now();
+    long long run = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    std::mutex lock;
+    std::deque<slot_t> slots;   // Stable addresses: threads keep a pointer to their slot
+
+    state_t() { current = &slots.emplace_back(); }
+};
+
+inline state_t state;
+
+inline bool enabled() { return state.path && *state.path; }
+
+inline slot_t& local() {
+    if (!current) {
+        std::lock_guard<std::mutex> guard(state.lock);
+        current = &state.slots.emplace_back();
+    }
+    return *current;
+}
+
+// Adds time measured elsewhere (e.g. by MPI_Wtime) to a phase of the calling thread
+inline void add(phase_t phase, double seconds) {
+    if (enabled()) local().seconds[phase] += seconds;
+}
+
+inline void count(count_t what, uint64_t n = 1) {
+    if (enabled()) local().counts[what] += n;
+}
+
+// Counter group of the calling thread, nullptr when counters are off or unavailable
+inline perfctr::group* local_counters() {
+    if (!state.hw) return nullptr;
+    slot_t& slot = local();
+    if (!slot.counters_tried) {
+        slot.counters_tried = true;
+        if (!slot.counters.open()) state.hw_error = slot.counters.error();
+    }
+    return slot.counters.is_open() ? &slot.counters : nullptr;
+}
+
+// Accumulates the hardware counters of the calling thread over a coarse phase, between start and
+// stop (or destruction); start and stop must run on the same thread
+class counters {
+public:
+    explicit counters(hw_phase_t phase, bool start_now = true) : phase(phase) {
+        if (start_now) start();
+    }
+    ~counters() { stop(); }
+    counters(const counters&) = delete;
+    counters& operator=(const counters&) = delete;
+
+    void start() {
+        perfctr::group* group = local_counters();
+        on = group && group->read(begin);
+    }
+
+    void stop() {
+        if (!on) return;
+        on = false;
+        uint64_t end[perfctr::NUM_EVENTS];
+        if (!local().counters.read(end)) return;
+        slot_t& slot = local();
+        for (int e = 0; e < perfctr::NUM_EVENTS; ++e) slot.hw[phase][e] += end[e] - begin[e];
+        slot.hw_used[phase] = true;
+    }
+
+private:
+    hw_phase_t phase;
+    bool on = false;
+    uint64_t begin[perfctr::NUM_EVENTS];
+};
+
+// Times a phase of the calling thread until destruction (or stop)
+class scope {
+public:
+    explicit scope(phase_t phase) : phase(phase), on(enabled()) {
+        if (on) begin = steady::now();
+    }
+    ~scope() { stop(); }
+    scope(const scope&) = delete;
+    scope& operator=(const scope&) = delete;
+
+    void stop() {
+        if (!on) return;
+        local().seconds[phase] += std::chrono::duration<double>(steady::now() - begin).count();
+        on = false;
+    }
+
+private:
+    phase_t phase;
+    bool on;
+    steady::time_point begin;
+};
+
+struct row_t {
+    int rank;
+    int thread;
+    std::string metric;
+    std::string value;
+};
+
+// Rows of the calling process
+inline std::vector<row_t> collect(int rank) {
+    std::vector<row_t> rows;
+    auto seconds = [](double s) { std::ostringstream os; os.precision(9); os << s; return os.str(); };
+    {
+        std::lock_guard<std::mutex> guard(state.lock);
+        for (size_t t = 0; t < state.slots.size(); ++t) {
+            const slot_t& slot = state.slots[t];
+            for (int p = 0; p < NUM_PHASES; ++p)
+                rows.push_back({rank, static_cast<int>(t), std::string("time.") + PHASE_NAMES[p], seconds(slot.seconds[p])});
+            for (int c = 0; c < NUM_COUNTS; ++c)
+                rows.push_back({rank, static_cast<int>(t), std::string("count.") + COUNT_NAMES[c], std::to_string(slot.counts[c])});
+            if (!state.hw || !slot.counters_tried) continue;
+            rows.push_back({rank, static_cast<int>(t), "hw.events", std::to_string(slot.counters.size())});
+            for (int p = 0; p < NUM_HW_PHASES; ++p) {
+                if (!slot.hw_used[p]) continue;
+                for (int e = 0; e < perfctr::NUM_EVENTS; ++e) {
+                    if (slot.counters.has(e))
+                        rows.push_back({rank, static_cast<int>(t), std::string("hw.") + HW_PHASE_NAMES[p] + "." + perfctr::EVENT_NAMES[e], std::to_string(slot.hw[p][e])});
+                }
+            }
+        }
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    rows.push_back({rank, -1, "time.total", seconds(std::chrono::duration<double>(steady::now() - state.start).count())});
+    rows.push_back({rank, -1, "memory.peak_rss_kb", std::to_string(usage.ru_maxrss)});
+    return rows;
+}
+
+// Appends rows to the metrics file (CSV header only for a new file)
+inline void write(const char* backend, const std::string& input, const std::vector<row_t>& rows) {
+    const std::string path = state.path;
+    auto ends_with = [&](const char* ext) {
+        size_t n = std::char_traits<char>::length(ext);
+        return path.size() >= n && path.compare(path.size() - n, n, ext) == 0;
+    };
+    const bool json = ends_with(".json") || ends_with(".jsonl");
+    struct stat st;
+    const bool fresh = stat(path.c_str(), &st) != 0 || st.st_size == 0;
+
+    std::ofstream out(path, std::ios::app);
+    if (!out.is_open()) {
+        std::cerr << "Error opening metrics file!" << std::endl;
+        return;
+    }
+    if (!json && fresh) out << "run,backend,input,rank,thread,metric,value\n";
+    for (const row_t& r : rows) {
+        if (json) {
+            out << "{\"run\":" << state.run << ",\"backend\":\"" << backend << "\",\"input\":\"" << input
+                << "\",\"rank\":" << r.rank << ",\"thread\":" << r.thread
+                << ",\"metric\":\"" << r.metric << "\",\"value\":" << r.value << "}\n";
+        } else {
+            out << state.run << ',' << backend << ',' << input << ',' << r.rank << ',' << r.thread
+                << ',' << r.metric << ',' << r.value << '\n';
+        }
+    }
+}
+
+inline void warn_counters(int ranks) {
+    std::cerr << "Hardware counters unavailable" << (ranks ? " on " + std::to_string(ranks) + " ranks" : std::string());
+    if (state.hw_error) std::cerr << " (perf_event_open: " << std::strerror(state.hw_error) << ")";
+    std::cerr << ", reporting timings only" << std::endl;
+}
+
+inline void report(const char* backend, const std::string& input) {
+    if (!enabled()) return;
+    if (state.hw_error) warn_counters(0);
+    write(backend, input, collect(0));
+}
+
+#ifdef MPI_VERSION
+// Gathers the rows of every rank to rank 0 (collective: metrics are written only if enabled on every rank)
+inline void report(const char* backend, const std::string& input, MPI_Comm comm) {
+    int on = enabled();
+    MPI_Allreduce(MPI_IN_PLACE, &on, 1, MPI_INT, MPI_MIN, comm);
+    if (!on) return;
+
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    int failed = state.hw_error != 0, failedRanks;
+    MPI_Reduce(&failed, &failedRanks, 1, MPI_INT, MPI_SUM, 0, comm);
+    if (rank == 0 && failedRanks) warn_counters(failedRanks);
+    std::string text;
+    for (const row_t& r : collect(rank))
+        text += std::to_string(r.thread) + ' ' + r.metric + ' ' + r.value + '\n';
+
+    int bytes = static_cast<int>(text.size());
+    std::vector<int> counts(size), displs(size);
+    MPI_Gather(&bytes, 1, MPI_INT, counts.data(), 1, MPI_INT, 0, comm);
+    int total = 0;
+    for (int r = 0; r < size; ++r) {
+        displs[r] = total;
+        total += counts[r];
+    }
+    std::vector<char> all(rank == 0 ? total : 0);
+    MPI_Gatherv(text.data(), bytes, MPI_CHAR, all.data(), counts.data(), displs.data(), MPI_CHAR, 0, comm);
+    if (rank != 0) return;
+
+    std::vector<row_t> rows;
+    for (int r = 0; r < size; ++r) {
+        std::istringstream in(std::string(all.data() + displs[r], counts[r]));
+        row_t row{r, 0, "", ""};
+        while (in >> row.thread >> row.metric >> row.value) rows.push_back(row);
+    }
+    write(backend, input, rows);
+}
+#endif
+
+} // namespace metrics
+
+#endif // METRICS_HPP_INCLUDED
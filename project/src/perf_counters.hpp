@@ -0,0 +1,116 @@
+#ifndef PERF_COUNTERS_HPP_INCLUDED
+#define PERF_COUNTERS_HPP_INCLUDED
+
+/*
+ * Hardware performance counters of the calling thread (cycles, instructions, last level cache
+ * misses, branch mispredictions), opened as one perf_event_open group so that every event counts
+ * over the same interval. Only user-space events are requested (allowed with perf_event_paranoid
+ * up to 2). Events the machine does not expose are left out of the group. When the PMU
+ * multiplexes the group, values are scaled by enabled / running time.
+ *
+ * On containers, VMs without a virtual PMU, or platforms other than Linux, open() fails and the
+ * caller keeps timings only.
+ */
+
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace perfctr {
+
+enum event_t { CYCLES = 0, INSTRUCTIONS, LLC_MISSES, BRANCH_MISSES, NUM_EVENTS };
+constexpr const char* EVENT_NAMES[] = {"cycles", "instructions", "llc_misses", "branch_misses"};
+
+class group {
+public:
+    group() = default;
+    group(const group&) = delete;
+    group& operator=(const group&) = delete;
+    ~group() { close(); }
+
+    // Opens the available events for the calling thread, false (and error() set) if none is
+    bool open() {
+#ifdef __linux__
+        static const uint64_t configs[NUM_EVENTS] = {
+            PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+        };
+        for (int e = 0; e < NUM_EVENTS; ++e) {
+            struct perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = configs[e];
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            int fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0));
+            if (fd < 0) {
+                if (leader < 0) err = errno;
+                continue;
+            }
+            if (leader < 0) leader = fd;
+            fds[e] = fd;
+            order[members++] = e;
+        }
+        return leader >= 0;
+#else
+        err = ENOSYS;
+        return false;
+#endif
+    }
+
+    bool is_open() const { return leader >= 0; }
+    bool has(int e) const { return fds[e] >= 0; }
+    int error() const { return err; }
+
+    int size() const { return members; }
+
+    // Current values of the events (unavailable ones are 0)
+    bool read(uint64_t (&values)[NUM_EVENTS]) const {
+#ifdef __linux__
+        if (leader < 0) return false;
+
+        // Group layout: nr, time enabled, time running, values in order of opening
+        uint64_t buffer[3 + NUM_EVENTS];
+        if (::read(leader, buffer, sizeof(buffer)) < static_cast<ssize_t>((3 + members) * sizeof(uint64_t))) return false;
+        const uint64_t enabled = buffer[1], running = buffer[2];
+        for (int e = 0; e < NUM_EVENTS; ++e) values[e] = 0;
+        for (int i = 0; i < members; ++i) {
+            uint64_t value = buffer[3 + i];
+            if (running && running < enabled) value = static_cast<uint64_t>(static_cast<double>(value) * enabled / running);
+            values[order[i]] = value;
+        }
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    void close() {
+#ifdef __linux__
+        for (int e = 0; e < NUM_EVENTS; ++e) {
+            if (fds[e] >= 0) ::close(fds[e]);
+            fds[e] = -1;
+        }
+#endif
+        leader = -1;
+        members = 0;
+    }
+
+private:
+    int fds[NUM_EVENTS] = {-1, -1, -1, -1};
+    int order[NUM_EVENTS] = {};     // Events in order of opening (order of the values read)
+    int members = 0;
+    int leader = -1;
+    int err = 0;
+};
+
+} // namespace perfctr
+
+#endif // PERF_COUNTERS_HPP_INCLUDED
@@ -0,0 +1,89 @@
+#ifndef QUERY_PROTOCOL_HPP_INCLUDED
+#define QUERY_PROTOCOL_HPP_INCLUDED
+
+/*
+ * Binary protocol of the local query service (LSHSJ_server / LSHSJ_client) over a Unix socket.
+ *
+ * Every message is a frame: 1 byte type, 4 bytes payload length (native endianness), payload.
+ *   QUERY_BATCH request:  varint n, then n trajectories (wire::put_trajectory, raw coordinates);
+ *                         a negative dataset of a query matches the indexed trajectories of every dataset
+ *   QUERY_BATCH response: for each query, varint m, then the m ids of the similar indexed trajectories
+ *   STATS request:        empty
+ *   STATS response:       text, one "name\tvalue" line per statistic
+ */
+
+#include <cstdint>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+#include <string>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "trajectory_codec.hpp"
+
+namespace query {
+
+constexpr const char* DEFAULT_SOCKET = "/tmp/lshsj.sock";
+constexpr uint32_t MAX_FRAME_BYTES = 1u << 30;
+
+enum frame_t : uint8_t {
+    QUERY_BATCH = 'Q',
+    STATS = 'S'
+};
+
+inline bool write_full(int fd, const void* data, size_t bytes) {
+    const char* p = static_cast<const char*>(data);
+    while (bytes) {
+        ssize_t n = ::write(fd, p, bytes);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        bytes -= n;
+    }
+    return true;
+}
+
+inline bool read_full(int fd, void* data, size_t bytes) {
+    char* p = static_cast<char*>(data);
+    while (bytes) {
+        ssize_t n = ::read(fd, p, bytes);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        bytes -= n;
+    }
+    return true;
+}
+
+inline bool send_frame(int fd, uint8_t type, const std::vector<char>& payload) {
+    char header[5];
+    uint32_t length = payload.size();
+    header[0] = static_cast<char>(type);
+    memcpy(header + 1, &length, sizeof(length));
+    return write_full(fd, header, sizeof(header)) && write_full(fd, payload.data(), payload.size());
+}
+
+inline bool recv_frame(int fd, uint8_t& type, std::vector<char>& payload) {
+    char header[5];
+    uint32_t length;
+    if (!read_full(fd, header, sizeof(header))) return false;
+    type = static_cast<uint8_t>(header[0]);
+    memcpy(&length, header + 1, sizeof(length));
+    if (length > MAX_FRAME_BYTES) return false;
+    payload.resize(length);
+    return read_full(fd, payload.data(), length);
+}
+
+inline sockaddr_un socket_address(const char* path) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    return addr;
+}
+
+} // namespace query
+
+#endif // QUERY_PROTOCOL_HPP_INCLUDED
@@ -0,0 +1,276 @@
+#ifndef TRACE_HPP_INCLUDED
+#define TRACE_HPP_INCLUDED
+
+/*
+ * Timeline tracer of threads and ranks, written as a Chrome trace (JSON object format) that opens
+ * offline in chrome://tracing or ui.perfetto.dev. Enabled at runtime by naming the output file:
+ *
+ *   LSHSJ_TRACE=outputs/trace.json         trace file
+ *   LSHSJ_TRACE_EVENTS=262144              events kept per thread (default 2^18)
+ *
+ * Each thread records complete events (name, category, begin, duration, optional count) in its
+ * own ring buffer, without locks: when the buffer is full the oldest events are overwritten and
+ * the num of dropped events is reported. Spans wrap coarse units of work (a block of lines, a
+ * batch, a bucket with pairs to join, an MPI collective), so that recording (two clock reads and a
+ * store) stays far below the work it measures; when disabled a span costs a single branch.
+ *
+ * Under MPI (include this header after mpi.h) each rank is a process of the trace (pid = rank):
+ * sync() aligns the clocks of the ranks after a barrier, and write() sends the events of every
+ * rank to rank 0 in turn, in chunks of at most GATHER_CHUNK bytes, so that a rank may hold more than
+ * 2 GB of events. Threads are numbered in order of first event (0: main thread).
+ */
+
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <iostream>
+
+namespace trace {
+
+using steady = std::chrono::steady_clock;
+
+struct event_t {
+    const char* name;   // Static strings only
+    const char* cat;
+    int64_t begin;      // ns since the origin
+    int64_t duration;   // ns
+    int64_t count;      // Items processed (-1: none)
+};
+
+// Ring buffer of a thread
+struct buffer_t {
+    std::unique_ptr<event_t[]> ring;    // Allocated (uninitialized) at the first event
+    uint64_t recorded = 0;              // Events recorded so far (next slot: recorded % capacity)
+    std::string name;
+};
+
+inline thread_local buffer_t* current = nullptr;   // Buffer of the calling thread
+
+struct state_t {
+    const char* path = std::getenv("LSHSJ_TRACE");
+    const bool on = path && *path;
+    const size_t capacity = std::getenv("LSHSJ_TRACE_EVENTS") && std::atol(std::getenv("LSHSJ_TRACE_EVENTS")) > 0 ?
+        std::atol(std::getenv("LSHSJ_TRACE_EVENTS")) : (1 << 18);
+    steady::time_point origin = steady::now();
+    std::mutex lock;
+    std::deque<buffer_t> buffers;   // Stable addresses: threads keep a pointer to their buffer
+
+    state_t() {
+        current = &buffers.emplace_back();
+        current->name = "main";
+    }
+};
+
+inline state_t state;
+
+inline bool enabled() { return state.on; }
+
+inline int64_t now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(steady::now() - state.origin).count();
+}
+
+inline buffer_t& local() {
+    if (!current) {
+        std::lock_guard<std::mutex> guard(state.lock);
+        current = &state.buffers.emplace_back();
+        current->name = "thread " + std::to_string(state.buffers.size() - 1);
+    }
+    return *current;
+}
+
+inline void record(const char* name, const char* cat, int64_t begin, int64_t end, int64_t count = -1) {
+    buffer_t& buffer = local();
+    if (!buffer.ring) buffer.ring.reset(new event_t[state.capacity]);
+    buffer.ring[buffer.recorded++ % state.capacity] = {name, cat, begin, end - begin, count};
+}
+
+// Label of the calling thread in the timeline (e.g. mapper, reducer)
+inline void thread_name(const std::string& name) {
+    if (enabled()) local().name = name;
+}
+
+// Complete event from construction to destruction (or stop)
+class span {
+public:
+    span(const char* name, const char* cat, int64_t count = -1) : name(name), cat(cat), count(count), on(enabled()) {
+        if (on) begin = now();
+    }
+    ~span() { stop(); }
+    span(const span&) = delete;
+    span& operator=(const span&) = delete;
+
+    void set_count(int64_t n) { count = n; }
+
+    void stop() {
+        if (!on) return;
+        on = false;
+        record(name, cat, begin, now(), count);
+    }
+
+private:
+    const char* name;
+    const char* cat;
+    int64_t count;
+    bool on;
+    int64_t begin = 0;
+};
+
+// Busy intervals of a thread that handles one stream item per call (e.g. an FF svc): calls closer
+// than `gap` ns are merged into a single event counting the items, so that holes in the timeline are
+// the time spent waiting for input. flush() must run on the same thread (e.g. in svc_end).
+class activity {
+public:
+    activity(const char* name, const char* cat, int64_t gap = 20000) : name(name), cat(cat), gap(gap) {}
+
+    void begin() {
+        if (!enabled()) return;
+        int64_t t = now();
+        if (items && t - last > gap) flush();
+        if (!items) first = t;
+    }
+
+    void end() {
+        if (!enabled()) return;
+        last = now();
+        ++items;
+    }
+
+    void flush() {
+        if (items) record(name, cat, first, last, items);
+        items = 0;
+    }
+
+private:
+    const char* name;
+    const char* cat;
+    int64_t gap;
+    int64_t first = 0, last = 0;
+    int64_t items = 0;
+};
+
+// Trace events of the calling process, one JSON object per line
+inline std::string events(int pid, uint64_t& dropped) {
+    std::ostringstream os;
+    os.setf(std::ios::fixed);
+    os.precision(3);
+    os << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"args\":{\"name\":\"rank " << pid << "\"}}\n";
+    std::lock_guard<std::mutex> guard(state.lock);
+    for (size_t t = 0; t < state.buffers.size(); ++t) {
+        const buffer_t& buffer = state.buffers[t];
+        os << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":" << t
+           << ",\"args\":{\"name\":\"" << buffer.name << "\"}}\n";
+        uint64_t kept = std::min<uint64_t>(buffer.recorded, state.capacity);
+        dropped += buffer.recorded - kept;
+        for (uint64_t i = buffer.recorded - kept; i < buffer.recorded; ++i) {
+            const event_t& e = buffer.ring[i % state.capacity];
+            os << "{\"name\":\"" << e.name << "\",\"cat\":\"" << e.cat << "\",\"ph\":\"X\",\"ts\":" << e.begin / 1e3
+               << ",\"dur\":" << e.duration / 1e3 << ",\"pid\":" << pid << ",\"tid\":" << t;
+            if (e.count >= 0) os << ",\"args\":{\"n\":" << e.count << "}";
+            os << "}\n";
+        }
+    }
+    return os.str();
+}
+
+// Trace file, filled with the events (one per line) of one process at a time
+class file_writer {
+public:
+    file_writer() : out(state.path) {
+        if (!out.is_open()) {
+            std::cerr << "Error opening trace file!" << std::endl;
+            return;
+        }
+        out << "{\"traceEvents\":[\n";
+    }
+
+    void append(const std::string& lines) {
+        if (!out.is_open()) return;
+        std::istringstream in(lines);
+        std::string line;
+        while (std::getline(in, line)) {
+            if (line.empty()) continue;
+            out << (first ? "" : ",\n") << line;
+            first = false;
+        }
+    }
+
+    void close(uint64_t dropped) {
+        if (!out.is_open()) return;
+        out << "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"dropped_events\":" << dropped << "}}\n";
+        out.close();
+        if (dropped) {
+            std::cerr << "Trace: " << dropped << " events overwritten, raise LSHSJ_TRACE_EVENTS to keep them" << std::endl;
+        }
+    }
+
+private:
+    std::ofstream out;
+    bool first = true;
+};
+
+inline void write() {
+    if (!enabled()) return;
+    uint64_t dropped = 0;
+    std::string lines = events(0, dropped);
+    file_writer file;
+    file.append(lines);
+    file.close(dropped);
+}
+
+#ifdef MPI_VERSION
+// Common time origin of the ranks (call right after MPI_Init, collective)
+inline void sync(MPI_Comm comm) {
+    if (!enabled()) return;
+    MPI_Barrier(comm);
+    state.origin = steady::now();
+}
+
+constexpr uint64_t GATHER_CHUNK = 1 << 26;   // Bytes of a message of write()
+constexpr int GATHER_TAG = 0x7ace;
+
+// Collects the events of every rank on rank 0, one rank at a time (collective: written only if
+// enabled on every rank)
+inline void write(MPI_Comm comm) {
+    int on = enabled();
+    MPI_Allreduce(MPI_IN_PLACE, &on, 1, MPI_INT, MPI_MIN, comm);
+    if (!on) return;
+
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    uint64_t dropped = 0, droppedTot = 0;
+    std::string lines = events(rank, dropped);
+    MPI_Reduce(&dropped, &droppedTot, 1, MPI_UINT64_T, MPI_SUM, 0, comm);
+
+    // Rank 0 receives (and writes) the events of the others in rank order, even if the file could not be opened
+    uint64_t bytes = lines.size();
+    if (rank != 0) {
+        MPI_Send(&bytes, 1, MPI_UINT64_T, 0, GATHER_TAG, comm);
+        for (uint64_t offset = 0; offset < bytes; offset += GATHER_CHUNK)
+            MPI_Send(lines.data() + offset, static_cast<int>(std::min(GATHER_CHUNK, bytes - offset)), MPI_CHAR, 0, GATHER_TAG, comm);
+        return;
+    }
+    file_writer file;
+    file.append(lines);
+    for (int r = 1; r < size; ++r) {
+        MPI_Recv(&bytes, 1, MPI_UINT64_T, r, GATHER_TAG, comm, MPI_STATUS_IGNORE);
+        lines.resize(bytes);
+        for (uint64_t offset = 0; offset < bytes; offset += GATHER_CHUNK)
+            MPI_Recv(lines.data() + offset, static_cast<int>(std::min(GATHER_CHUNK, bytes - offset)), MPI_CHAR, r, GATHER_TAG, comm,
+                     MPI_STATUS_IGNORE);
+        file.append(lines);
+    }
+    file.close(droppedTot);
+}
+#endif
+
+} // namespace trace
+
+#endif // TRACE_HPP_INCLUDED
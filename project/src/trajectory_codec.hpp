@@ -0,0 +1,205 @@
+#ifndef TRAJECTORY_CODEC_HPP_INCLUDED
+#define TRAJECTORY_CODEC_HPP_INCLUDED
+
+/*
+ * Compact binary encoding of trajectories, used to ship curves between processes (MPI shuffle)
+ * and to store them in files (spill, checkpoint, binary datasets).
+ *
+ * Only the actualSize points of a curve are written: prefix lengths are not shipped, they are
+ * recomputed by curve::push_back while decoding. Coordinates are written either as raw doubles
+ * (lossless) or as fixed-point deltas between consecutive points encoded as zig-zag varints,
+ * which takes 2-3 bytes per coordinate on GPS-like data with small steps. With the delta codec
+ * a coordinate is rounded to the nearest multiple of 1/scale: data with at most log10(scale)
+ * decimal digits (e.g. 6 for the taxi datasets and scale 1e6) is decoded exactly.
+ */
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <istream>
+#include <ostream>
+
+#include "geometry_basics.hpp"
+
+namespace wire {
+
+enum coords_t : uint8_t {
+    RAW = 0,    // 8 bytes little-endian double per coordinate
+    DELTA = 1   // fixed-point zig-zag varint delta per coordinate
+};
+
+struct codec_t {
+    coords_t coords;    // Coordinates encoding
+    double scale;       // Fixed-point scale (DELTA only)
+};
+
+constexpr codec_t RAW_CODEC{RAW, 0};
+
+// Upper bound on the bytes written by put_varint, put_curve and put_trajectory
+constexpr size_t MAX_VARINT_BYTES = 10;
+constexpr size_t MAX_CURVE_BYTES = MAX_VARINT_BYTES + TRAJ_MAX_SIZE * 2 * MAX_VARINT_BYTES;
+constexpr size_t MAX_TRAJECTORY_BYTES = 2 * MAX_VARINT_BYTES + MAX_CURVE_BYTES;
+
+// Variable-length (LEB128) encoding of unsigned integers
+inline void put_varint(std::vector<char>& buf, uint64_t v) {
+    while (v >= 0x80) {
+        buf.push_back(static_cast<char>(v | 0x80));
+        v >>= 7;
+    }
+    buf.push_back(static_cast<char>(v));
+}
+
+inline uint64_t get_varint(const char*& p) {
+    uint64_t v = 0;
+    int shift = 0;
+    uint8_t byte;
+    do {
+        byte = static_cast<uint8_t>(*p++);
+        v |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    return v;
+}
+
+// Bounds-checked variant for untrusted input: false if the varint is truncated at end or too long
+inline bool get_varint(const char*& p, const char* end, uint64_t& v) {
+    v = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7) {
+        uint8_t byte = static_cast<uint8_t>(*p++);
+        v |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+// Zig-zag mapping of signed integers, so that small negative values get short varints
+inline uint64_t zigzag(int64_t v) { return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63); }
+inline int64_t unzigzag(uint64_t v) { return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1); }
+
+inline void put_double(std::vector<char>& buf, double d) {
+    size_t offset = buf.size();
+    buf.resize(offset + sizeof(double));
+    memcpy(buf.data() + offset, &d, sizeof(double));
+}
+
+inline double get_double(const char*& p) {
+    double d;
+    memcpy(&d, p, sizeof(double));
+    p += sizeof(double);
+    return d;
+}
+
+inline void put_curve(std::vector<char>& buf, const curve& c, const codec_t& codec) {
+    put_varint(buf, c.size());
+    if (codec.coords == RAW) {
+        for (const point& p : c) {
+            put_double(buf, p.x);
+            put_double(buf, p.y);
+        }
+        return;
+    }
+    int64_t last_x = 0, last_y = 0;
+    for (const point& p : c) {
+        int64_t x = std::llround(p.x * codec.scale);
+        int64_t y = std::llround(p.y * codec.scale);
+        put_varint(buf, zigzag(x - last_x));
+        put_varint(buf, zigzag(y - last_y));
+        last_x = x;
+        last_y = y;
+    }
+}
+
+inline void get_curve(const char*& p, curve& c, const codec_t& codec) {
+    c = curve();
+    size_t n = get_varint(p);
+    if (codec.coords == RAW) {
+        for (size_t i = 0; i < n; ++i) {
+            double x = get_double(p);
+            double y = get_double(p);
+            c.push_back(point(x, y));
+        }
+        return;
+    }
+    int64_t x = 0, y = 0;
+    for (size_t i = 0; i < n; ++i) {
+        x += unzigzag(get_varint(p));
+        y += unzigzag(get_varint(p));
+        c.push_back(point(x / codec.scale, y / codec.scale));
+    }
+}
+
+// Bounds-checked variant for untrusted input: false if the curve is longer than TRAJ_MAX_SIZE
+// or runs past end
+inline bool get_curve(const char*& p, const char* end, curve& c, const codec_t& codec) {
+    c = curve();
+    uint64_t n;
+    if (!get_varint(p, end, n) || n > TRAJ_MAX_SIZE) return false;
+    if (codec.coords == RAW) {
+        if (n * 2 * sizeof(double) > static_cast<size_t>(end - p)) return false;
+        for (size_t i = 0; i < n; ++i) {
+            double x = get_double(p);
+            double y = get_double(p);
+            c.push_back(point(x, y));
+        }
+        return true;
+    }
+    int64_t x = 0, y = 0;
+    for (size_t i = 0; i < n; ++i) {
+        uint64_t dx, dy;
+        if (!get_varint(p, end, dx) || !get_varint(p, end, dy)) return false;
+        x += unzigzag(dx);
+        y += unzigzag(dy);
+        c.push_back(point(x / codec.scale, y / codec.scale));
+    }
+    return true;
+}
+
+// A trajectory as read from the input datasets: identifier, dataset identifier and curve
+inline void put_trajectory(std::vector<char>& buf, uint64_t id, int dataset, const curve& c, const codec_t& codec) {
+    put_varint(buf, id);
+    put_varint(buf, zigzag(dataset));
+    put_curve(buf, c, codec);
+}
+
+inline void get_trajectory(const char*& p, uint64_t& id, int& dataset, curve& c, const codec_t& codec) {
+    id = get_varint(p);
+    dataset = static_cast<int>(unzigzag(get_varint(p)));
+    get_curve(p, c, codec);
+}
+
+inline bool get_trajectory(const char*& p, const char* end, uint64_t& id, int& dataset, curve& c, const codec_t& codec) {
+    uint64_t zdataset;
+    if (!get_varint(p, end, id) || !get_varint(p, end, zdataset)) return false;
+    dataset = static_cast<int>(unzigzag(zdataset));
+    return get_curve(p, end, c, codec);
+}
+
+/*
+ * Files of encoded trajectories start with a fixed header describing the codec,
+ * so that they can be decoded independently of the build flags of the reader.
+ */
+constexpr char FILE_MAGIC[4] = {'L', 'S', 'H', 'T'};
+constexpr uint8_t FILE_VERSION = 1;
+
+inline void write_header(std::ostream& out, const codec_t& codec) {
+    out.write(FILE_MAGIC, sizeof(FILE_MAGIC));
+    out.put(static_cast<char>(FILE_VERSION));
+    out.put(static_cast<char>(codec.coords));
+    out.write(reinterpret_cast<const char*>(&codec.scale), sizeof(codec.scale));
+}
+
+inline bool read_header(std::istream& in, codec_t& codec) {
+    char magic[sizeof(FILE_MAGIC)];
+    if (!in.read(magic, sizeof(magic)) || memcmp(magic, FILE_MAGIC, sizeof(magic)) != 0)
+        return false;
+    if (in.get() != FILE_VERSION)
+        return false;
+    codec.coords = static_cast<coords_t>(in.get());
+    in.read(reinterpret_cast<char*>(&codec.scale), sizeof(codec.scale));
+    return static_cast<bool>(in) && (codec.coords == RAW || codec.coords == DELTA);
+}
+
+} // namespace wire
+
+#endif // TRAJECTORY_CODEC_HPP_INCLUDED
@@ -0,0 +1,36 @@
+#!/bin/bash
+
+#SBATCH --job-name=LSHSJ_eval
+#SBATCH --nodes=1
+#SBATCH --ntasks=1
+#SBATCH --cpus-per-task=32
+#SBATCH -o ./logs/out_eval.log
+#SBATCH -e ./logs/err_eval.log
+#SBATCH -t 02:00:00
+
+cd ".."
+
+# Usage info: 
+#   path_to/executable_filename [-n threads] [-w resolution] [-r functions] [-L tables] [-p probes] [-g truth_filename] path_to/dataset_filename
+#   threads: threads of the exact (ground truth) join, default hardware concurrency
+#   resolution, functions, tables, probes: LSH setup under evaluation (default 80, 1, 8, 0)
+#   truth_filename: ground truth pairs, computed and written by the first run, read by the next ones
+#   output: setup, true pairs, found pairs, recall, candidates, precision (true pairs per candidate), Frechet decisions, times
+
+make lshsj_eval
+
+# Cost vs recall on a sample dataset: resolution
+build/LSHSJ_eval -n 32 -g outputs/truth_lsh1GB.dat -w 20 datasets/lsh1GB.dat >> results/eval.csv
+build/LSHSJ_eval -n 32 -g outputs/truth_lsh1GB.dat -w 40 datasets/lsh1GB.dat >> results/eval.csv
+build/LSHSJ_eval -n 32 -g outputs/truth_lsh1GB.dat -w 80 datasets/lsh1GB.dat >> results/eval.csv
+build/LSHSJ_eval -n 32 -g outputs/truth_lsh1GB.dat -w 160 datasets/lsh1GB.dat >> results/eval.csv
+
+# Cost vs recall: num of tables
+#build/LSHSJ_eval -g outputs/truth_lsh1GB.dat -L 2 datasets/lsh1GB.dat >> results/eval.csv
+#build/LSHSJ_eval -g outputs/truth_lsh1GB.dat -L 4 datasets/lsh1GB.dat >> results/eval.csv
+#build/LSHSJ_eval -g outputs/truth_lsh1GB.dat -L 16 datasets/lsh1GB.dat >> results/eval.csv
+
+# Cost vs recall: concatenated functions and multi-probe
+#build/LSHSJ_eval -g outputs/truth_lsh1GB.dat -r 2 -L 16 datasets/lsh1GB.dat >> results/eval.csv
+#build/LSHSJ_eval -g outputs/truth_lsh1GB.dat -L 3 -p 4 datasets/lsh1GB.dat >> results/eval.csv
+#build/LSHSJ_eval -g outputs/truth_lsh1GB.dat -L 3 -p 8 datasets/lsh1GB.dat >> results/eval.csv
@@ -11,6 +11,7 @@ cd ".."
 
 # Usage info: 
 #   path_to/executable_filename num_mapper_threads num_reducer_threads policy path_to/dataset_filename path_to/output_filename
+#   optional join_spec after the output file: cross (default), self, all [:datasets]
 #   policy 0: round-robin - 1: on-demand
 
 # FF mapping string 
@@ -80,4 +81,17 @@ build/LSHSJ_ff datasets/lsh10GB.dat 8 8 1 outputs/out_lsh10GB.dat
 #build/LSHSJ_ff datasets/lsh10GB.dat 4 4 1 outputs/out_lsh10GB.dat >> results/ff_strong.csv
 #build/LSHSJ_ff datasets/lsh10GB.dat 8 8 1 outputs/out_lsh10GB.dat >> results/ff_strong.csv
 #build/LSHSJ_ff datasets/lsh10GB.dat 8 16 1 outputs/out_lsh10GB.dat >> results/ff_strong.csv
-#build/LSHSJ_ff datasets/lsh10GB.dat 8 24 1 outputs/out_lsh10GB.dat >> results/ff_strong.csv
\ No newline at end of file
+#build/LSHSJ_ff datasets/lsh10GB.dat 8 24 1 outputs/out_lsh10GB.dat >> results/ff_strong.csv
+
+# Self-join (deduplication of dataset 0) and join of every pair
+#build/LSHSJ_ff datasets/lsh1GB.dat 8 8 1 outputs/out_self_lsh1GB.dat self:0 >> results/ff_join_spec.csv
+#build/LSHSJ_ff datasets/lsh1GB.dat 8 8 1 outputs/out_all_lsh1GB.dat all >> results/ff_join_spec.csv
+
+# Per-phase metrics of each mapper and reducer thread (schema shared by every backend, .json for JSON lines)
+#LSHSJ_METRICS=results/metrics.csv build/LSHSJ_ff datasets/lsh1GB.dat 8 8 1 outputs/out_lsh1GB.dat >> results/ff_strong.csv
+#LSHSJ_METRICS=results/metrics.csv build/LSHSJ_ff datasets/lsh1GB.dat 8 16 1 outputs/out_lsh1GB.dat >> results/ff_strong.csv
+# Hardware counters (cycles, instructions, LLC and branch misses) of the map, shuffle and join phases of each thread
+#LSHSJ_METRICS=results/metrics.csv LSHSJ_COUNTERS=1 build/LSHSJ_ff datasets/lsh1GB.dat 8 8 1 outputs/out_lsh1GB.dat >> results/ff_strong.csv
+
+# Timeline of mappers and reducers (open in chrome://tracing or ui.perfetto.dev)
+#LSHSJ_TRACE=results/trace_ff.json build/LSHSJ_ff datasets/lsh1GB.dat 8 8 1 outputs/out_lsh1GB.dat >> results/ff_strong.csv
@@ -0,0 +1,34 @@
+#!/bin/bash
+
+#SBATCH --job-name=LSHSJ_ff_mpi
+#SBATCH --nodes=8
+#SBATCH --ntasks-per-node=1
+#SBATCH --cpus-per-task=16
+#SBATCH -o ./logs/out_ff_mpi.log
+#SBATCH -e ./logs/err_ff_mpi.log
+#SBATCH -t 02:00:00
+
+cd ".."
+
+# Usage info: 
+#   change --nodes to set the desidered number of nodes (one process per node)
+#   srun --mpi=pmix path_to/executable_filename path_to/dataset_filename num_mapper_threads num_reducer_threads policy path_to/output_filename
+#   policy 0: round-robin - 1: on-demand
+#   each process also runs a receiver and a sender thread for the cross-node shuffle (requires MPI_THREAD_MULTIPLE)
+
+# RUN EXAMPLE TEST on different-sized datasets with: 8 NODE, 1 PROCESS PER NODE, 7 MAPPERS AND 7 REDUCERS PER PROCESS
+srun --mpi=pmix build/LSHSJ_ff_mpi datasets/lsh1GB.dat 7 7 0 outputs/out_lsh1GB.dat
+srun --mpi=pmix build/LSHSJ_ff_mpi datasets/lsh5GB.dat 7 7 0 outputs/out_lsh5GB.dat
+srun --mpi=pmix build/LSHSJ_ff_mpi datasets/lsh10GB.dat 7 7 0 outputs/out_lsh10GB.dat
+
+# TEST - Strong Performance analysis on 5GB dataset (compare with results/mpi_strong_1GB.csv and results/ff_strong.csv)
+#   --> change sbatch and use
+#   --nodes=1, 2, 4, 8
+#srun --mpi=pmix build/LSHSJ_ff_mpi datasets/lsh5GB.dat 7 7 0 outputs/out_lsh5GB.dat >> results/ff_mpi_strong.csv
+#srun --mpi=pmix build/LSHSJ_ff_mpi datasets/lsh5GB.dat 7 7 1 outputs/out_lsh5GB.dat >> results/ff_mpi_strong.csv
+
+# Per-phase metrics of each thread of each rank (schema shared by every backend)
+#LSHSJ_METRICS=results/metrics.csv srun --mpi=pmix build/LSHSJ_ff_mpi datasets/lsh5GB.dat 7 7 0 outputs/out_lsh5GB.dat >> results/ff_mpi_strong.csv
+
+# Timeline of the threads of each rank (one process per rank in the trace)
+#LSHSJ_TRACE=results/trace_ff_mpi.json srun --mpi=pmix build/LSHSJ_ff_mpi datasets/lsh5GB.dat 7 7 0 outputs/out_lsh5GB.dat >> results/ff_mpi_strong.csv
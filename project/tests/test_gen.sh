@@ -0,0 +1,34 @@
+#!/bin/bash
+
+#SBATCH --job-name=LSHSJ_gen
+#SBATCH --nodes=1
+#SBATCH --ntasks=1
+#SBATCH --cpus-per-task=32
+#SBATCH -o ./logs/out_gen.log
+#SBATCH -e ./logs/err_gen.log
+#SBATCH -t 02:00:00
+
+cd ".."
+
+# Usage info: 
+#   path_to/executable_filename [-s seed] (-n trajectories | -S size) [-t threads] [-D datasets] [-l min:max[:shape]] [-a area] [-w step]
+#                               [-H hotspots[:share[:radius]]] [-d share[:jitter]] [-B raw|delta] path_to/output_filename
+#   the output only depends on the seed and the options, not on the num of threads
+
+make lshsj_gen
+
+# Synthetic datasets of the benchmarks
+build/LSHSJ_gen -s 1 -S 1G datasets/lsh1GB.dat >> results/gen.csv
+build/LSHSJ_gen -s 1 -S 5G datasets/lsh5GB.dat >> results/gen.csv
+build/LSHSJ_gen -s 1 -S 10G datasets/lsh10GB.dat >> results/gen.csv
+
+# Spatial skew: 90% of the trajectories around 16 hotspots (large buckets)
+#build/LSHSJ_gen -s 1 -S 1G -H 16:0.9:200 datasets/lsh1GB_skew.dat >> results/gen.csv
+
+# Share of near-duplicate cross-dataset pairs
+#build/LSHSJ_gen -s 1 -S 1G -d 0.05 datasets/lsh1GB_dup5.dat >> results/gen.csv
+#build/LSHSJ_gen -s 1 -S 1G -d 0.5 datasets/lsh1GB_dup50.dat >> results/gen.csv
+
+# Binary datasets (trajectory_codec.hpp), read by LSHSJ_index
+#build/LSHSJ_gen -s 1 -S 1G -B delta datasets/lsh1GB.bin >> results/gen.csv
+#build/LSHSJ_index build -d 0 datasets/lsh1GB.bin outputs/lsh1GB.idx
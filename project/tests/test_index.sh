@@ -0,0 +1,46 @@
+#!/bin/bash
+
+#SBATCH --job-name=LSHSJ_index
+#SBATCH --nodes=1
+#SBATCH --ntasks=1
+#SBATCH -o ./logs/out_index.log
+#SBATCH -e ./logs/err_index.log
+#SBATCH -t 02:00:00
+
+cd ".."
+
+# Usage info: 
+#   path_to/executable_filename build [-d dataset] [-L tables] [-r functions] [-R recall] path_to/dataset_filename path_to/index_filename
+#   path_to/executable_filename probe [-k neighbours] [-p probes] path_to/index_filename path_to/query_filename path_to/output_filename
+#   dataset: index only the trajectories of the given dataset (reference side), default all
+#   tables: num of LSH tables of the index (default 8)
+#   functions: LSH functions concatenated (AND) in the key of each table (default 1)
+#   recall: choose functions and tables for the target recall; build prints r, L, buckets, largest bucket, candidate pairs
+#   probes: multi-probe, perturbed hashes of each query looked up in every table (default 0)
+#   neighbours: kNN join, the k nearest indexed trajectories of each query (query id, indexed id, distance)
+
+make lshsj_index
+
+# Build once the index of the reference dataset (dataset 0), then probe it with the whole datasets 
+build/LSHSJ_index build -d 0 datasets/lsh1GB.dat outputs/lsh1GB_d0.idx >> results/index_build.csv
+build/LSHSJ_index probe outputs/lsh1GB_d0.idx datasets/lsh1GB.dat outputs/out_lsh1GB.dat >> results/index_probe.csv
+build/LSHSJ_index build -d 0 datasets/lsh5GB.dat outputs/lsh5GB_d0.idx >> results/index_build.csv
+build/LSHSJ_index probe outputs/lsh5GB_d0.idx datasets/lsh5GB.dat outputs/out_lsh5GB.dat >> results/index_probe.csv
+
+# kNN join: top-k most similar trajectories of dataset 0 for each trajectory of dataset 1
+build/LSHSJ_index probe -k 1 outputs/lsh1GB_d0.idx datasets/lsh1GB.dat outputs/out_knn1_lsh1GB.dat >> results/index_knn.csv
+build/LSHSJ_index probe -k 10 outputs/lsh1GB_d0.idx datasets/lsh1GB.dat outputs/out_knn10_lsh1GB.dat >> results/index_knn.csv
+#build/LSHSJ_index probe -k 100 outputs/lsh1GB_d0.idx datasets/lsh1GB.dat outputs/out_knn100_lsh1GB.dat >> results/index_knn.csv
+
+# Multi-probe: smaller indexes (2-4 tables) probed with perturbed hashes vs the 8 tables index
+#build/LSHSJ_index build -d 0 -L 3 datasets/lsh1GB.dat outputs/lsh1GB_d0_L3.idx >> results/index_build.csv
+#build/LSHSJ_index probe -p 0 outputs/lsh1GB_d0_L3.idx datasets/lsh1GB.dat outputs/out_L3_lsh1GB.dat >> results/index_multiprobe.csv
+#build/LSHSJ_index probe -p 2 outputs/lsh1GB_d0_L3.idx datasets/lsh1GB.dat outputs/out_L3_p2_lsh1GB.dat >> results/index_multiprobe.csv
+#build/LSHSJ_index probe -p 4 outputs/lsh1GB_d0_L3.idx datasets/lsh1GB.dat outputs/out_L3_p4_lsh1GB.dat >> results/index_multiprobe.csv
+#build/LSHSJ_index probe -p 8 outputs/lsh1GB_d0_L3.idx datasets/lsh1GB.dat outputs/out_L3_p8_lsh1GB.dat >> results/index_multiprobe.csv
+
+# Concatenated (AND) keys: bucket sizes and candidates vs recall
+#build/LSHSJ_index build -d 0 -r 2 -L 16 datasets/lsh1GB.dat outputs/lsh1GB_d0_r2.idx >> results/index_build.csv
+#build/LSHSJ_index probe outputs/lsh1GB_d0_r2.idx datasets/lsh1GB.dat outputs/out_r2_lsh1GB.dat >> results/index_amplification.csv
+#build/LSHSJ_index build -d 0 -R 0.95 datasets/lsh1GB.dat outputs/lsh1GB_d0_R95.idx >> results/index_build.csv
+#build/LSHSJ_index probe outputs/lsh1GB_d0_R95.idx datasets/lsh1GB.dat outputs/out_R95_lsh1GB.dat >> results/index_amplification.csv
@@ -11,7 +11,12 @@ cd ".."
 
 # Usage info: 
 #   change --nodes and --ntask-per-node to set the desidered number of process and nodes
-#   srun --mpi=pmix path_to/executable_filename path_to/dataset_filename path_to/output_filename
+#   srun --mpi=pmix path_to/executable_filename [-s shuffle] [-d dynamic] [-J mode] [-t thresholds] [-j spec] path_to/dataset_filename path_to/output_filename
+#   shuffle (LSHSJ_mpi only): alltoallv (default) - rma - node
+#   dynamic (LSHSJ_mpi only): 1 (default, work-stealing join) - 0 (static join); per-rank join statistics are printed on stderr
+#   mode (LSHSJ_mpi only): auto (default) - shuffle - broadcast (replicate the smaller of two datasets, no shuffle)
+#   thresholds (LSHSJ_mpi only): comma-separated list joined in a single pass, pairs tagged with the smallest threshold satisfied
+#   spec (LSHSJ_mpi only): cross (default, different datasets) - self (same dataset) - all, optionally restricted to datasets (e.g. self:0)
 
 # RUN EXAMPLE TEST on different-sized datasets with: 8 NODE, 2 PROCESS PER NODES
 srun --mpi=pmix build/LSHSJ_mpi datasets/lsh1GB.dat outputs/out_lsh1GB.dat
@@ -90,3 +95,60 @@ srun --mpi=pmix build/LSHSJ_mpi datasets/lsh10GB.dat outputs/out_lsh10GB.dat
 #   --nodes=2 --ntasks-per-node=10
 #   --nodes=4 --ntasks-per-node=10
 #srun --mpi=pmix build/LSHSJ_mpi datasets/lsh10GB.dat outputs/out_lsh10GB.dat >> results/mpi_weak_P.csv
+
+# TEST - Shuffle engines: blocking all-to-all, one-sided RMA and node-aware of LSHSJ_mpi vs non-blocking LSHSJ_mpi_nb
+#   --> change sbatch and use the configurations of the strong analysis
+#srun --mpi=pmix build/LSHSJ_mpi -s alltoallv datasets/lsh1GB.dat outputs/out_lsh1GB.dat >> results/mpi_shuffle.csv
+#srun --mpi=pmix build/LSHSJ_mpi -s rma datasets/lsh1GB.dat outputs/out_lsh1GB.dat >> results/mpi_shuffle.csv
+#srun --mpi=pmix build/LSHSJ_mpi -s node datasets/lsh1GB.dat outputs/out_lsh1GB.dat >> results/mpi_shuffle.csv
+#srun --mpi=pmix build/LSHSJ_mpi_nb datasets/lsh1GB.dat outputs/out_lsh1GB.dat >> results/mpi_shuffle.csv
+#srun --mpi=pmix build/LSHSJ_mpi -s alltoallv datasets/lsh5GB.dat outputs/out_lsh5GB.dat >> results/mpi_shuffle.csv
+#srun --mpi=pmix build/LSHSJ_mpi -s rma datasets/lsh5GB.dat outputs/out_lsh5GB.dat >> results/mpi_shuffle.csv
+#srun --mpi=pmix build/LSHSJ_mpi -s node datasets/lsh5GB.dat outputs/out_lsh5GB.dat >> results/mpi_shuffle.csv
+#srun --mpi=pmix build/LSHSJ_mpi_nb datasets/lsh5GB.dat outputs/out_lsh5GB.dat >> results/mpi_shuffle.csv
+#srun --mpi=pmix build/LSHSJ_mpi -s alltoallv datasets/lsh10GB.dat outputs/out_lsh10GB.dat >> results/mpi_shuffle.csv
+#srun --mpi=pmix build/LSHSJ_mpi -s rma datasets/lsh10GB.dat outputs/out_lsh10GB.dat >> results/mpi_shuffle.csv
+#srun --mpi=pmix build/LSHSJ_mpi -s node datasets/lsh10GB.dat outputs/out_lsh10GB.dat >> results/mpi_shuffle.csv
+#srun --mpi=pmix build/LSHSJ_mpi_nb datasets/lsh10GB.dat outputs/out_lsh10GB.dat >> results/mpi_shuffle.csv
+
+# TEST - Node-aware shuffle with several process per node (same configurations of mpi_strong_1N)
+#   --> change sbatch and use
+#   --nodes=1 --ntasks-per-node=16
+#   --nodes=2 --ntasks-per-node=8
+#   --nodes=4 --ntasks-per-node=4
+#   --nodes=8 --ntasks-per-node=2
+#srun --mpi=pmix build/LSHSJ_mpi -s node datasets/lsh1GB.dat outputs/out_lsh1GB.dat >> results/mpi_strong_1N_node.csv
+#srun --mpi=pmix build/LSHSJ_mpi -s node datasets/lsh5GB.dat outputs/out_lsh5GB.dat >> results/mpi_strong_1N_node.csv
+#srun --mpi=pmix build/LSHSJ_mpi -s node datasets/lsh10GB.dat outputs/out_lsh10GB.dat >> results/mpi_strong_1N_node.csv
+
+# TEST - Join scheduling: static vs work-stealing join phase (per-rank busy/idle times in logs/err_mpi.log)
+#srun --mpi=pmix build/LSHSJ_mpi -d 0 datasets/lsh5GB.dat outputs/out_lsh5GB.dat >> results/mpi_join.csv
+#srun --mpi=pmix build/LSHSJ_mpi -d 1 datasets/lsh5GB.dat outputs/out_lsh5GB.dat >> results/mpi_join.csv
+#srun --mpi=pmix build/LSHSJ_mpi -d 0 datasets/lsh10GB.dat outputs/out_lsh10GB.dat >> results/mpi_join.csv
+#srun --mpi=pmix build/LSHSJ_mpi -d 1 datasets/lsh10GB.dat outputs/out_lsh10GB.dat >> results/mpi_join.csv
+
+# TEST - Join mode on asymmetric datasets (few reference trajectories in dataset 0 vs many traces in dataset 1)
+#srun --mpi=pmix build/LSHSJ_mpi -J shuffle datasets/lsh5GB_asym.dat outputs/out_lsh5GB_asym.dat >> results/mpi_join_mode.csv
+#srun --mpi=pmix build/LSHSJ_mpi -J broadcast datasets/lsh5GB_asym.dat outputs/out_lsh5GB_asym.dat >> results/mpi_join_mode.csv
+#srun --mpi=pmix build/LSHSJ_mpi -J auto datasets/lsh5GB_asym.dat outputs/out_lsh5GB_asym.dat >> results/mpi_join_mode.csv
+
+# TEST - Multi-threshold join: one pass at 5, 10 and 20 units vs one run per threshold
+#srun --mpi=pmix build/LSHSJ_mpi -t 5,10,20 datasets/lsh5GB.dat outputs/out_lsh5GB_multi.dat >> results/mpi_thresholds.csv
+#srun --mpi=pmix build/LSHSJ_mpi -t 5 datasets/lsh5GB.dat outputs/out_lsh5GB_5.dat >> results/mpi_thresholds.csv
+#srun --mpi=pmix build/LSHSJ_mpi -t 10 datasets/lsh5GB.dat outputs/out_lsh5GB_10.dat >> results/mpi_thresholds.csv
+#srun --mpi=pmix build/LSHSJ_mpi -t 20 datasets/lsh5GB.dat outputs/out_lsh5GB_20.dat >> results/mpi_thresholds.csv
+
+# TEST - Join specification: self-join of every dataset, deduplication of dataset 0, every pair
+#srun --mpi=pmix build/LSHSJ_mpi -j self datasets/lsh5GB.dat outputs/out_lsh5GB_self.dat >> results/mpi_join_spec.csv
+#srun --mpi=pmix build/LSHSJ_mpi -j self:0 datasets/lsh5GB.dat outputs/out_lsh5GB_self0.dat >> results/mpi_join_spec.csv
+#srun --mpi=pmix build/LSHSJ_mpi -j all datasets/lsh5GB.dat outputs/out_lsh5GB_all.dat >> results/mpi_join_spec.csv
+
+# Per-phase metrics of each rank, gathered by rank 0 (schema shared by every backend, srun exports the variable)
+#LSHSJ_METRICS=results/metrics.csv srun --mpi=pmix build/LSHSJ_mpi datasets/lsh5GB.dat outputs/out_lsh5GB.dat >> results/mpi_strong_1N.csv
+#LSHSJ_METRICS=results/metrics.csv srun --mpi=pmix build/LSHSJ_mpi_nb datasets/lsh5GB.dat outputs/out_lsh5GB.dat >> results/mpi_shuffle.csv
+# Hardware counters of the map, shuffle and join phases of each rank (needs perf_event_paranoid <= 2, timings only otherwise)
+#LSHSJ_METRICS=results/metrics.csv LSHSJ_COUNTERS=1 srun --mpi=pmix build/LSHSJ_mpi datasets/lsh5GB.dat outputs/out_lsh5GB.dat >> results/mpi_strong_1N.csv
+
+# Timeline of map, shuffle batches, join tasks and collectives of each rank (chrome://tracing or ui.perfetto.dev)
+#LSHSJ_TRACE=results/trace_mpi.json srun --mpi=pmix build/LSHSJ_mpi datasets/lsh5GB.dat outputs/out_lsh5GB.dat >> results/mpi_strong_1N.csv
+#LSHSJ_TRACE=results/trace_mpi_nb.json srun --mpi=pmix build/LSHSJ_mpi_nb datasets/lsh5GB.dat outputs/out_lsh5GB.dat >> results/mpi_shuffle.csv
@@ -13,7 +13,8 @@ cd ".."
 # Usage info: 
 #   change --nodes and --ntask-per-node and -n to set the desidered number of process 
 #   change --cpus-per-task and OMP_NUM_THREADS to set the desidered number of threads 
-#   mpirun -x OMP_NUM_THREADS=8 --bynode --bind-to none -n 16 path_to/executable_filename path_to/dataset_filename path_to/output_filename
+#   mpirun -x OMP_NUM_THREADS=8 --bynode --bind-to none -n 16 path_to/executable_filename [-m] path_to/dataset_filename path_to/output_filename
+#   -m: every thread drives the shuffle on its own communicator (needs MPI_THREAD_MULTIPLE, falls back to the funneled shuffle)
 
 # RUN EXAMPLE TEST on different-sized datasets with: 8 NODE, 2 PROCESS PER NODES, 8 THREADS PER PROCESS
 mpirun -x OMP_NUM_THREADS=8 --bynode --bind-to none -n 16 build/LSHSJ_mpi_omp datasets/lsh1GB.dat outputs/out_lsh1GB.dat
@@ -52,3 +53,24 @@ mpirun -x OMP_NUM_THREADS=8 --bynode --bind-to none -n 16 build/LSHSJ_mpi_omp da
 #   --> change sbatch and use
 #   --cpus-per-task=10
 #mpirun -x OMP_NUM_THREADS=10 --bynode --bind-to none -n 16 build/LSHSJ_mpi_omp datasets/lsh1GB.dat outputs/out_lsh1GB.dat >> results/mpi_omp.csv
+
+# TEST - Map phase scalability (last column of the results is the map phase time of the slowest process)
+#   --> change sbatch and use
+#   --nodes=1 --ntasks-per-node=1 --cpus-per-task=16
+#mpirun -x OMP_NUM_THREADS=1 --bind-to none -n 1 build/LSHSJ_mpi_omp datasets/lsh1GB.dat outputs/out_lsh1GB.dat >> results/mpi_omp_map.csv
+#mpirun -x OMP_NUM_THREADS=2 --bind-to none -n 1 build/LSHSJ_mpi_omp datasets/lsh1GB.dat outputs/out_lsh1GB.dat >> results/mpi_omp_map.csv
+#mpirun -x OMP_NUM_THREADS=4 --bind-to none -n 1 build/LSHSJ_mpi_omp datasets/lsh1GB.dat outputs/out_lsh1GB.dat >> results/mpi_omp_map.csv
+#mpirun -x OMP_NUM_THREADS=8 --bind-to none -n 1 build/LSHSJ_mpi_omp datasets/lsh1GB.dat outputs/out_lsh1GB.dat >> results/mpi_omp_map.csv
+#mpirun -x OMP_NUM_THREADS=16 --bind-to none -n 1 build/LSHSJ_mpi_omp datasets/lsh1GB.dat outputs/out_lsh1GB.dat >> results/mpi_omp_map.csv
+
+# TEST - Funneled vs multi-threaded shuffle (shuffle time and num of shuffle threads are the last two columns)
+#mpirun -x OMP_NUM_THREADS=8 --bynode --bind-to none -n 16 build/LSHSJ_mpi_omp datasets/lsh5GB.dat outputs/out_lsh5GB.dat >> results/mpi_omp_shuffle.csv
+#mpirun -x OMP_NUM_THREADS=8 --bynode --bind-to none -n 16 build/LSHSJ_mpi_omp -m datasets/lsh5GB.dat outputs/out_lsh5GB.dat >> results/mpi_omp_shuffle.csv
+#mpirun -x OMP_NUM_THREADS=8 --bynode --bind-to none -n 16 build/LSHSJ_mpi_omp datasets/lsh10GB.dat outputs/out_lsh10GB.dat >> results/mpi_omp_shuffle.csv
+#mpirun -x OMP_NUM_THREADS=8 --bynode --bind-to none -n 16 build/LSHSJ_mpi_omp -m datasets/lsh10GB.dat outputs/out_lsh10GB.dat >> results/mpi_omp_shuffle.csv
+
+# Per-phase metrics of each thread of each rank (schema shared by every backend)
+#mpirun -x OMP_NUM_THREADS=8 -x LSHSJ_METRICS=results/metrics.csv --bynode --bind-to none -n 16 build/LSHSJ_mpi_omp datasets/lsh5GB.dat outputs/out_lsh5GB.dat >> results/mpi_omp_shuffle.csv
+
+# Timeline of the OpenMP threads of each rank
+#mpirun -x OMP_NUM_THREADS=8 -x LSHSJ_TRACE=results/trace_mpi_omp.json --bynode --bind-to none -n 16 build/LSHSJ_mpi_omp -m datasets/lsh5GB.dat outputs/out_lsh5GB.dat >> results/mpi_omp_shuffle.csv
@@ -10,9 +10,23 @@
 cd ".."
 
 # Usage info: 
-# path_to/executable_filename path_to/dataset_filename path_to/output_filename
+# path_to/executable_filename path_to/dataset_filename path_to/output_filename [join_spec: cross (default), self, all [:datasets]]
 
 # Run sequential test on different sized datasets
 build/LSHSJ_seq datasets/lsh1GB.dat outputs/out_lsh1GB.dat >> results/seq.csv
 build/LSHSJ_seq datasets/lsh5GB.dat outputs/out_lsh5GB.dat >> results/seq.csv
 build/LSHSJ_seq datasets/lsh10GB.dat outputs/out_lsh10GB.dat >> results/seq.csv
+
+# Report the Frechet distance of each similar pair as a third output column (rebuild with make DISTANCE=1)
+#make clean && make DISTANCE=1 build/LSHSJ_seq
+#build/LSHSJ_seq datasets/lsh1GB.dat outputs/out_dist_lsh1GB.dat >> results/seq_distance.csv
+
+# Self-join (deduplication of dataset 0) and join of every pair
+#build/LSHSJ_seq datasets/lsh1GB.dat outputs/out_self_lsh1GB.dat self:0 >> results/seq_join_spec.csv
+#build/LSHSJ_seq datasets/lsh1GB.dat outputs/out_all_lsh1GB.dat all >> results/seq_join_spec.csv
+
+# Per-phase metrics (time, counts, peak RSS) in the schema shared by every backend, appended to results/metrics.csv
+#LSHSJ_METRICS=results/metrics.csv build/LSHSJ_seq datasets/lsh1GB.dat outputs/out_lsh1GB.dat >> results/seq.csv
+#LSHSJ_METRICS=results/metrics.csv LSHSJ_COUNTERS=1 build/LSHSJ_seq datasets/lsh1GB.dat outputs/out_lsh1GB.dat >> results/seq.csv
+# Timeline of the map phase and of each bucket joined
+#LSHSJ_TRACE=results/trace_seq.json build/LSHSJ_seq datasets/lsh1GB.dat outputs/out_lsh1GB.dat >> results/seq.csv
@@ -0,0 +1,37 @@
+#!/bin/bash
+
+#SBATCH --job-name=LSHSJ_service
+#SBATCH --nodes=1
+#SBATCH --ntasks=1
+#SBATCH --cpus-per-task=32
+#SBATCH -o ./logs/out_service.log
+#SBATCH -e ./logs/err_service.log
+#SBATCH -t 02:00:00
+
+cd ".."
+
+# Usage info: 
+#   path_to/server_filename [-t threads] [-s socket] [-r seconds] path_to/index_filename
+#   path_to/client_filename [-s socket] [-c connections] [-b batch] [-n batches] [-o output_filename] [-S] path_to/query_filename
+#   client results: connections, batch, queries, similar pairs, time, queries/s, batch latency p50 p90 p99 max in us
+#   server statistics are printed on stderr at exit (SIGINT) and every -r seconds
+
+make lshsj_index lshsj_service
+
+# Index the reference dataset once
+build/LSHSJ_index build -d 0 datasets/lsh1GB.dat outputs/lsh1GB_0.idx
+
+build/LSHSJ_server -t 32 -s /tmp/lshsj_$SLURM_JOB_ID.sock outputs/lsh1GB_0.idx 2>> results/service_server.csv &
+SERVER_PID=$!
+sleep 5
+
+# One pass over the queries (similar pairs written), then throughput with growing connections and batches
+build/LSHSJ_client -s /tmp/lshsj_$SLURM_JOB_ID.sock -c 4 -o outputs/out_service_lsh1GB.dat datasets/lsh1GB.dat >> results/service.csv
+build/LSHSJ_client -s /tmp/lshsj_$SLURM_JOB_ID.sock -c 1 -b 64 -n 1000 datasets/lsh1GB.dat >> results/service.csv
+build/LSHSJ_client -s /tmp/lshsj_$SLURM_JOB_ID.sock -c 8 -b 64 -n 1000 datasets/lsh1GB.dat >> results/service.csv
+build/LSHSJ_client -s /tmp/lshsj_$SLURM_JOB_ID.sock -c 32 -b 64 -n 1000 datasets/lsh1GB.dat >> results/service.csv
+#build/LSHSJ_client -s /tmp/lshsj_$SLURM_JOB_ID.sock -c 32 -b 1 -n 10000 datasets/lsh1GB.dat >> results/service.csv
+#build/LSHSJ_client -s /tmp/lshsj_$SLURM_JOB_ID.sock -c 32 -b 1024 -n 100 datasets/lsh1GB.dat >> results/service.csv
+
+kill -INT $SERVER_PID
+wait $SERVER_PID
@@ -0,0 +1,22 @@
+#!/bin/bash
+
+#SBATCH --job-name=LSHSJ_stream
+#SBATCH --nodes=1
+#SBATCH --ntasks=1
+#SBATCH -o ./logs/out_stream.log
+#SBATCH -e ./logs/err_stream.log
+#SBATCH -t 02:00:00
+
+cd ".."
+
+# Usage info: 
+#   path_to/executable_filename [-w count] [-t seconds] [-f] [path_to/dataset_filename|-] [path_to/output_filename]
+#   count: count-based window - seconds: time-based window - f: follow a growing file
+#   statistics (records, similar pairs, window, evicted, time, records/s, latency p50 p90 p99 p99.9 max in us) are printed on stderr
+
+make lshsj_stream
+
+# Replay datasets as a feed through a pipe, unbounded and count-based windows
+cat datasets/lsh1GB.dat | build/LSHSJ_stream - outputs/out_lsh1GB.dat 2>> results/stream.csv
+cat datasets/lsh1GB.dat | build/LSHSJ_stream -w 100000 - outputs/out_lsh1GB.dat 2>> results/stream.csv
+cat datasets/lsh1GB.dat | build/LSHSJ_stream -w 10000 - outputs/out_lsh1GB.dat 2>> results/stream.csv